@@ -287,8 +287,14 @@ namespace learn::webgpu
       
         wgpuBufferMapAsync(mOutputBuffer, wgpu::MapMode::Read, /*offset*/ 0, /*size_t*/ 16, onCallback, (void*)&context);
 
+        // Don't just spin on pollDevice() here, that keeps a core at 100% until the copy is done.
+        // wgpu can wait inside the driver (wait = true) and wake us up when there's work done.
         while(!context.ready) {
+        #if defined(WEBGPU_BACKEND_WGPU)
+            wgpuDevicePoll(mDevice, true, nullptr);
+        #else
             pollDevice();
+        #endif
         }
        
         mInputBuffer.release();
@@ -0,0 +1,417 @@
+#include <webgpu/webgpu.hpp>
+#ifdef WEBGPU_BACKEND_WGPU
+#  include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "AdapterSelector.h"
+#include "AsyncRequests.h"
+#include "Hash.h"
+
+namespace learn::webgpu
+{
+
+    AdapterInfo readAdapterInfo(wgpu::Adapter adapter)
+    {
+        wgpu::AdapterProperties properties = {};
+        adapter.getProperties(&properties);
+
+        AdapterInfo info;
+        info.name = properties.name ? properties.name : "";
+        info.vendorName = properties.vendorName ? properties.vendorName : "";
+        info.driverDescription = properties.driverDescription ? properties.driverDescription : "";
+        info.vendorID = properties.vendorID;
+        info.deviceID = properties.deviceID;
+        info.adapterType = properties.adapterType;
+        info.backendType = properties.backendType;
+        return info;
+    }
+
+    namespace
+    {
+        const char *adapterTypeName(wgpu::AdapterType type)
+        {
+            switch (type)
+            {
+            case wgpu::AdapterType::DiscreteGPU:
+                return "discrete";
+            case wgpu::AdapterType::IntegratedGPU:
+                return "integrated";
+            case wgpu::AdapterType::CPU:
+                return "cpu";
+            default:
+                return "unknown";
+            }
+        }
+
+        double log2OrZero(uint64_t value)
+        {
+            return value > 1 ? std::log2(static_cast<double>(value)) : 0.0;
+        }
+    } // namespace
+
+    uint64_t AdapterInfo::identity() const
+    {
+        uint64_t hash = hashString(name);
+        hash = hashString(vendorName, hash);
+        hash = hashString(driverDescription, hash);
+        hash = hashValue(vendorID, hash);
+        hash = hashValue(deviceID, hash);
+        hash = hashValue(static_cast<uint32_t>(adapterType), hash);
+        hash = hashValue(static_cast<uint32_t>(backendType), hash);
+        return hash;
+    }
+
+    AdapterSelector::~AdapterSelector()
+    {
+        for (AdapterCandidate &candidate : mCandidates)
+        {
+            if (candidate.adapter)
+            {
+                candidate.adapter.release();
+            }
+        }
+    }
+
+    bool canPresentTo(wgpu::Surface surface, wgpu::Adapter adapter)
+    {
+        if (surface.getPreferredFormat(adapter) == wgpu::TextureFormat::Undefined)
+        {
+            return false;
+        }
+        wgpu::SurfaceCapabilities capabilities;
+        surface.getCapabilities(adapter, &capabilities);
+        bool hasFormat = capabilities.formatCount > 0;
+        capabilities.freeMembers();
+        return hasFormat;
+    }
+
+    wgpu::Adapter AdapterSelector::select(wgpu::Surface compatibleSurface)
+    {
+        rank();
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            if (!compatibleSurface || canPresentTo(compatibleSurface, mCandidates[i].adapter))
+            {
+                return choose(i);
+            }
+        }
+        return nullptr;
+    }
+
+    void AdapterSelector::rank()
+    {
+        enumerate();
+        mCachedFirst = false;
+        mUsedCache = false;
+        if (mCandidates.empty())
+        {
+            return;
+        }
+
+        // Limits and features are cheap to read, the calibration is not, so it only
+        // runs when the cache does not know this set of adapters yet.
+        mFingerprint = fingerprint();
+        uint64_t cachedIdentity = 0;
+        bool cacheHit = loadCachedChoice(mFingerprint, cachedIdentity);
+        for (AdapterCandidate &candidate : mCandidates)
+        {
+            if (!cacheHit && mOptions.calibrate)
+            {
+                candidate.calibrationMs = runCalibration(candidate.adapter);
+            }
+            scoreCandidate(candidate);
+        }
+
+        std::stable_sort(mCandidates.begin(), mCandidates.end(),
+                         [](const AdapterCandidate &a, const AdapterCandidate &b)
+                         { return a.score > b.score; });
+
+        if (cacheHit)
+        {
+            auto cached = std::find_if(mCandidates.begin(), mCandidates.end(),
+                                       [cachedIdentity](const AdapterCandidate &candidate)
+                                       { return candidate.info.identity() == cachedIdentity; });
+            if (cached != mCandidates.end())
+            {
+                std::rotate(mCandidates.begin(), cached, cached + 1);
+                mCachedFirst = true;
+            }
+        }
+    }
+
+    wgpu::Adapter AdapterSelector::choose(size_t index)
+    {
+        // The cache stores what was used, not what scored best: the winner may not be able
+        // to present to the window, and it would be probed first again on every launch.
+        mUsedCache = mCachedFirst && index == 0;
+        if (!mUsedCache)
+        {
+            storeCachedChoice(mFingerprint, mCandidates[index].info.identity());
+        }
+
+        // Hand it over to the caller, it is not ours to release anymore.
+        wgpu::Adapter selected = mCandidates[index].adapter;
+        mCandidates[index].adapter = nullptr;
+        return selected;
+    }
+
+    void AdapterSelector::enumerate()
+    {
+        std::vector<wgpu::Adapter> adapters;
+#ifdef WEBGPU_BACKEND_WGPU
+        // wgpu-native can list every adapter of every backend directly.
+        if (!mOptions.forceFallbackAdapter)
+        {
+            size_t adapterCount = wgpuInstanceEnumerateAdapters(mInstance, nullptr, nullptr);
+            std::vector<WGPUAdapter> rawAdapters(adapterCount);
+            wgpuInstanceEnumerateAdapters(mInstance, nullptr, rawAdapters.data());
+            adapters.assign(rawAdapters.begin(), rawAdapters.end());
+        }
+#endif // WEBGPU_BACKEND_WGPU
+
+        if (adapters.empty())
+        {
+            // Otherwise there is no standard enumeration, so we ask for each power preference
+            // and for the fallback adapter, then drop the duplicates below.
+            wgpu::RequestAdapterOptions options = {};
+            if (!mOptions.forceFallbackAdapter)
+            {
+                options.powerPreference = wgpu::PowerPreference::HighPerformance;
+                adapters.push_back(requestAdapter(mInstance, options));
+                options.powerPreference = wgpu::PowerPreference::LowPower;
+                adapters.push_back(requestAdapter(mInstance, options));
+            }
+            options.powerPreference = wgpu::PowerPreference::Undefined;
+            options.forceFallbackAdapter = true;
+            adapters.push_back(requestAdapter(mInstance, options));
+        }
+
+        mCandidates.clear();
+        for (wgpu::Adapter adapter : adapters)
+        {
+            if (!adapter)
+            {
+                continue;
+            }
+
+            AdapterCandidate candidate;
+            candidate.adapter = adapter;
+            candidate.info = readAdapterInfo(adapter);
+
+            bool duplicate = std::any_of(mCandidates.begin(), mCandidates.end(),
+                                         [&candidate](const AdapterCandidate &other)
+                                         { return other.info.identity() == candidate.info.identity(); });
+            bool wrongKind = mOptions.forceFallbackAdapter && candidate.info.adapterType != wgpu::AdapterType::CPU;
+            if (duplicate || wrongKind)
+            {
+                adapter.release();
+                continue;
+            }
+
+            adapter.getLimits(&candidate.limits);
+            candidate.hasShaderF16 = adapter.hasFeature(wgpu::FeatureName::ShaderF16);
+            candidate.hasTimestampQuery = adapter.hasFeature(wgpu::FeatureName::TimestampQuery);
+            mCandidates.push_back(candidate);
+        }
+    }
+
+    // The weights are rough on purpose: a discrete GPU should beat an integrated one unless
+    // the integrated one is much better equipped, and anything beats the software rasterizer.
+    void AdapterSelector::scoreCandidate(AdapterCandidate &candidate)
+    {
+        double score = 0.0;
+        switch (candidate.info.adapterType)
+        {
+        case wgpu::AdapterType::DiscreteGPU:
+            score += 1000.0;
+            break;
+        case wgpu::AdapterType::IntegratedGPU:
+            score += 600.0;
+            break;
+        case wgpu::AdapterType::CPU:
+            score += 50.0;
+            break;
+        default:
+            score += 200.0;
+            break;
+        }
+
+        if (candidate.hasShaderF16)
+            score += 150.0;
+        if (candidate.hasTimestampQuery)
+            score += 50.0;
+
+        const WGPULimits &limits = candidate.limits.limits;
+        score += 10.0 * log2OrZero(limits.maxTextureDimension2D);
+        score += 5.0 * log2OrZero(limits.maxBufferSize);
+        score += 5.0 * log2OrZero(limits.maxStorageBufferBindingSize);
+        score += limits.maxComputeInvocationsPerWorkgroup / 16.0;
+
+        // Copy bandwidth in GB/s, capped so a single fast number can't hide everything else.
+        if (candidate.calibrationMs > 0.0)
+        {
+            double gigabytesPerSecond = kCalibrationBytes / (candidate.calibrationMs * 1.0e6);
+            score += std::min(gigabytesPerSecond, 500.0);
+        }
+        candidate.score = score;
+    }
+
+    // A tiny workload that every adapter supports: copy a few MiB back and forth between two
+    // buffers and wait for the GPU. It is far from a real benchmark but is enough to tell a
+    // GPU from a software implementation that reports generous limits.
+    double AdapterSelector::runCalibration(wgpu::Adapter adapter)
+    {
+        wgpu::DeviceDescriptor deviceDesc = {};
+        deviceDesc.label = "Adapter calibration";
+        deviceDesc.defaultQueue.label = "Calibration queue";
+        wgpu::Device device = requestDevice(mInstance, adapter, deviceDesc);
+        if (!device)
+        {
+            return -1.0;
+        }
+        wgpu::Queue queue = device.getQueue();
+
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Calibration buffer";
+        bufferDesc.size = kCalibrationBufferSize;
+        bufferDesc.usage = wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst;
+        bufferDesc.mappedAtCreation = false;
+        wgpu::Buffer first = device.createBuffer(bufferDesc);
+        wgpu::Buffer second = device.createBuffer(bufferDesc);
+
+        std::vector<uint8_t> data(kCalibrationBufferSize, 0x5a);
+        queue.writeBuffer(first, 0, data.data(), data.size());
+        // The upload is not what we want to measure.
+        waitForSubmittedWork(device, queue);
+
+        auto start = std::chrono::steady_clock::now();
+        wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+        for (int i = 0; i < kCalibrationCopies; ++i)
+        {
+            if (i % 2 == 0)
+                encoder.copyBufferToBuffer(first, 0, second, 0, kCalibrationBufferSize);
+            else
+                encoder.copyBufferToBuffer(second, 0, first, 0, kCalibrationBufferSize);
+        }
+        wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+        encoder.release();
+        queue.submit(command);
+        command.release();
+        waitForSubmittedWork(device, queue);
+        auto end = std::chrono::steady_clock::now();
+
+        first.destroy();
+        first.release();
+        second.destroy();
+        second.release();
+        queue.release();
+        device.release();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // Identifies the machine configuration: which adapters and drivers are present.
+    // A driver update or a new GPU changes it, which invalidates the cached choice.
+    uint64_t AdapterSelector::fingerprint() const
+    {
+        std::vector<uint64_t> identities;
+        for (const AdapterCandidate &candidate : mCandidates)
+        {
+            identities.push_back(candidate.info.identity());
+        }
+        std::sort(identities.begin(), identities.end());
+
+        uint64_t hash = hashValue(mOptions.forceFallbackAdapter);
+        for (uint64_t identity : identities)
+        {
+            hash = hashValue(identity, hash);
+        }
+        return hash;
+    }
+
+    // The cache file has one "<fingerprint> <adapter identity>" pair per line, in hex.
+    bool AdapterSelector::loadCachedChoice(uint64_t fingerprint, uint64_t &identity) const
+    {
+        if (mOptions.cachePath.empty())
+        {
+            return false;
+        }
+
+        std::ifstream file(mOptions.cachePath);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            uint64_t lineFingerprint = 0;
+            uint64_t lineIdentity = 0;
+            if (fields >> std::hex >> lineFingerprint >> lineIdentity && lineFingerprint == fingerprint)
+            {
+                identity = lineIdentity;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void AdapterSelector::storeCachedChoice(uint64_t fingerprint, uint64_t identity) const
+    {
+        if (mOptions.cachePath.empty())
+        {
+            return;
+        }
+
+        // Keep the entries of other configurations (e.g. with and without the fallback adapter).
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(mOptions.cachePath);
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream fields(line);
+                uint64_t lineFingerprint = 0;
+                if (fields >> std::hex >> lineFingerprint && lineFingerprint != fingerprint)
+                {
+                    lines.push_back(line);
+                }
+            }
+        }
+        lines.push_back(hashToHex(fingerprint) + " " + hashToHex(identity));
+
+        std::ofstream file(mOptions.cachePath, std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "could not write adapter cache " << mOptions.cachePath << std::endl;
+            return;
+        }
+        for (const std::string &line : lines)
+        {
+            file << line << "\n";
+        }
+    }
+
+    void AdapterSelector::report(std::ostream &out) const
+    {
+        out << "Adapters" << (mUsedCache ? " (choice from cache)" : "") << ":" << std::endl;
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            const AdapterCandidate &candidate = mCandidates[i];
+            out << " " << i << ". " << candidate.info.name
+                << " [" << adapterTypeName(candidate.info.adapterType)
+                << ", backend " << static_cast<uint32_t>(candidate.info.backendType)
+                << ", driver " << candidate.info.driverDescription << "]"
+                << " f16=" << candidate.hasShaderF16;
+            if (candidate.calibrationMs >= 0.0)
+            {
+                out << " calibration=" << std::fixed << std::setprecision(2) << candidate.calibrationMs << "ms" << std::defaultfloat;
+            }
+            out << " score=" << candidate.score << std::endl;
+        }
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // What we know about an adapter without creating a device on it.
+    struct AdapterInfo
+    {
+        std::string name;
+        std::string vendorName;
+        std::string driverDescription;
+        uint32_t vendorID = 0;
+        uint32_t deviceID = 0;
+        wgpu::AdapterType adapterType = wgpu::AdapterType::Unknown;
+        wgpu::BackendType backendType = wgpu::BackendType::Undefined;
+
+        // Hash of everything above, the same GPU with a different driver gets a different id.
+        uint64_t identity() const;
+    };
+
+    AdapterInfo readAdapterInfo(wgpu::Adapter adapter);
+
+    // Whether the adapter can present to the surface: it has a preferred format for it and
+    // the surface capabilities list at least one format.
+    bool canPresentTo(wgpu::Surface surface, wgpu::Adapter adapter);
+
+    struct AdapterCandidate
+    {
+        wgpu::Adapter adapter = nullptr;
+        AdapterInfo info;
+        wgpu::SupportedLimits limits = {};
+        bool hasShaderF16 = false;
+        bool hasTimestampQuery = false;
+        // Time for the calibration copy workload, negative if it was not run.
+        double calibrationMs = -1.0;
+        double score = 0.0;
+    };
+
+    struct AdapterSelectorOptions
+    {
+        // Only look at the fallback (software) adapter, e.g. lavapipe or SwiftShader.
+        // This is how we run on a Linux box without a GPU.
+        bool forceFallbackAdapter = false;
+        // Run the calibration workload on every adapter, it needs a device per adapter
+        // so it is the expensive part of the selection.
+        bool calibrate = true;
+        // Where the winning adapter is remembered between launches, empty disables the cache.
+        std::string cachePath = "adapter_cache.txt";
+    };
+
+    // Enumerates every adapter the instance can see, ranks them by adapter type, limits,
+    // features (ShaderF16 etc.) and a short calibration workload, and returns the best one.
+    // The adapter that is actually used is saved in a small text file keyed by the set of
+    // adapters that were found, so the next launch on the same machine and drivers ranks it
+    // first without probing again.
+    class AdapterSelector
+    {
+    public:
+        AdapterSelector(wgpu::Instance instance, AdapterSelectorOptions options)
+            : mInstance(instance), mOptions(std::move(options)) {}
+        ~AdapterSelector();
+
+        AdapterSelector(const AdapterSelector &) = delete;
+        AdapterSelector &operator=(const AdapterSelector &) = delete;
+
+        // The best adapter that can present to compatibleSurface, any adapter when it is null.
+        // Same as rank() followed by choose(). Returns nullptr when there is no such adapter.
+        wgpu::Adapter select(wgpu::Surface compatibleSurface = nullptr);
+
+        // Enumerates and ranks the adapters into candidates(), the cached choice first.
+        // Nothing is chosen yet, the caller can still skip candidates it can't use, for
+        // instance the ones the window surface doesn't work with.
+        void rank();
+        // Hands candidates()[index] over to the caller and remembers it as the choice for
+        // this set of adapters. Every other enumerated adapter is released when the selector
+        // goes away.
+        wgpu::Adapter choose(size_t index);
+
+        // Ranked candidates from the last rank(), best first.
+        const std::vector<AdapterCandidate> &candidates() const { return mCandidates; }
+        bool usedCache() const { return mUsedCache; }
+
+        void report(std::ostream &out) const;
+
+    private:
+        static constexpr uint64_t kCalibrationBufferSize = 4 * 1024 * 1024;
+        static constexpr int kCalibrationCopies = 16;
+        static constexpr double kCalibrationBytes = static_cast<double>(kCalibrationBufferSize) * kCalibrationCopies;
+
+        void enumerate();
+        void scoreCandidate(AdapterCandidate &candidate);
+        double runCalibration(wgpu::Adapter adapter);
+        uint64_t fingerprint() const;
+        bool loadCachedChoice(uint64_t fingerprint, uint64_t &identity) const;
+        void storeCachedChoice(uint64_t fingerprint, uint64_t identity) const;
+
+        wgpu::Instance mInstance;
+        AdapterSelectorOptions mOptions;
+        std::vector<AdapterCandidate> mCandidates;
+        uint64_t mFingerprint = 0;
+        // The candidate the cache named is first in mCandidates.
+        bool mCachedFirst = false;
+        bool mUsedCache = false;
+    };
+} // namespace learn::webgpu
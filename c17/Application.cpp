@@ -1,76 +1,374 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 #include "Application.h"
+#include "AdapterSelector.h"
+#include "AsyncRequests.h"
+#include "CullingShader.h"
+#include "GpuHelpers.h"
+#include "InstancedShader.h"
+#include "Hash.h"
+#include "IndexPacking.h"
+#include "LimitsNegotiator.h"
+#include "MappedUpload.h"
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
+#include "TransientBufferPool.h"
+#include "TriangleShader.h"
 
 namespace learn::webgpu
 {
 
+    namespace
+    {
+        // A grid of size x size quads in [-0.9, 0.9] as a triangle soup, colored by position.
+        // Big grids stand in for heavy scenes.
+        void makeGridSoup(uint32_t size, std::vector<float> &points, std::vector<float> &colors)
+        {
+            points.clear();
+            colors.clear();
+            points.reserve(size_t(size) * size * 12);
+            colors.reserve(size_t(size) * size * 18);
+            auto corner = [&](uint32_t x, uint32_t y)
+            {
+                float u = static_cast<float>(x) / static_cast<float>(size);
+                float v = static_cast<float>(y) / static_cast<float>(size);
+                points.insert(points.end(), {-0.9f + 1.8f * u, -0.9f + 1.8f * v});
+                colors.insert(colors.end(), {u, v, 0.5f});
+            };
+            for (uint32_t y = 0; y < size; ++y)
+            {
+                for (uint32_t x = 0; x < size; ++x)
+                {
+                    corner(x, y);
+                    corner(x + 1, y);
+                    corner(x + 1, y + 1);
+                    corner(x, y);
+                    corner(x + 1, y + 1);
+                    corner(x, y + 1);
+                }
+            }
+        }
+
+        bool readTextFile(const std::string &path, std::string &text)
+        {
+            std::ifstream file(path);
+            if (!file)
+            {
+                return false;
+            }
+            std::ostringstream content;
+            content << file.rdbuf();
+            text = content.str();
+            return true;
+        }
+    } // namespace
+
     bool Application::init()
     {
+        mStartupTimeline.reset();
+        auto initPhase = mStartupTimeline.scope("init total");
+        processMesh();
+        setupResourceLayouts();
 
-        
-        SDL_SetMainReady();
-        if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-            std::cerr << "Could not initialize SDL! Error: " << SDL_GetError() << std::endl;
-            return 1;
+        if (mOptions.clearPipelineCache)
+        {
+            mPipelineCache.clear();
         }
-       
-        int windowFlags = 0;
-        mWindow = SDL_CreateWindow("Learn WebGPU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, kWindowWidth, kWindowHieght, windowFlags);
-        if (!mWindow)
+        // The SPIR-V translated by the build is used as long as the WGSL is the same. The
+        // pipeline compiles the shader after the vertex layout rewrote its VertexInput, so that
+        // is the text it is registered for. Every layout declares position and color as
+        // floats, which gives back the embedded text, if it ever doesn't the SPIR-V would not
+        // match the layout's WGSL and it is left out.
+        const std::string layoutWgsl = mVertexLayout.applyToWgsl(shaders::kTriangleWgsl);
+        if (layoutWgsl == shaders::kTriangleWgsl)
         {
-            SDL_DestroyWindow(mWindow);
-            SDL_Quit();
-            return false;
+            mPipelineCache.addPrebuiltSpirv(layoutWgsl, shaders::kTriangleSpirv, shaders::kTriangleSpirvWords);
+        }
+        // Shader modules come from the pipeline cache when a previous launch left them there.
+        mRegistry.setShaderFactory([this](wgpu::Device device, const std::string &label, const std::string &source)
+                                   { return createShaderModule(device, label, source); });
+
+        if (mOptions.recordThreads != 1)
+        {
+            mRecorder = std::make_unique<ParallelRecorder>(mOptions.recordThreads);
         }
 
+        mTriangleShaderSource = shaders::kTriangleWgsl;
+        if (!mOptions.shaderDirectory.empty())
+        {
+            std::string path = mOptions.shaderDirectory + "/" + kTriangleShaderFile;
+            if (readTextFile(path, mTriangleShaderSource))
+            {
+                mShaderWatcher = std::make_unique<ShaderWatcher>(mOptions.shaderDirectory);
+            }
+            else
+            {
+                std::cout << "could not read " << path << ", using the embedded shader without hot reload" << std::endl;
+            }
+        }
+        // The VertexInput has to match the vertex layout picked in setupResourceLayouts.
+        mTriangleShaderSource = mVertexLayout.applyToWgsl(mTriangleShaderSource);
+
+        // The instance is kept until terminate(), we need it again to get a new
+        // adapter and device if the device is ever lost.
         wgpu::InstanceDescriptor desc = {};
-        wgpu::Instance instance = wgpu::createInstance(desc);
+        mInstance = wgpu::createInstance(desc);
 
-        if (!instance)
+        if (!mInstance)
         {
             std::cout << "falied to create wgpu instance" << std::endl;
             return false;
         }
 
-        mSurface = SDL_GetWGPUSurface(instance, mWindow);
-        wgpu::RequestAdapterOptions options = {};
-        options.compatibleSurface = mSurface;
-        options.powerPreference = wgpu::PowerPreference::HighPerformance;
-        wgpu::Adapter adapter = instance.requestAdapter(options);
+        // Getting the adapter and the device is the slowest part of a cold start and it
+        // does not need the window at all, so we kick it off first on a worker thread.
+        // The surface does not exist yet, so the worker ranks the adapters and requests a
+        // device on the best one. Below, once the window is there, we check that this adapter
+        // can present to it and otherwise move on to the next candidate that can.
+        AdapterSelector selector(mInstance, adapterSelectorOptions());
+        std::future<wgpu::Device> deviceFuture = launchAsync([this, &selector]() -> wgpu::Device
+        {
+            {
+                auto phase = mStartupTimeline.scope("adapter selection");
+                selector.rank();
+            }
+            if (selector.candidates().empty())
+            {
+                return nullptr;
+            }
 
+            auto phase = mStartupTimeline.scope("device request");
+            return createDevice(selector.candidates().front().adapter);
+        });
+        if (!mOptions.overlappedInit)
+        {
+            deviceFuture.wait();
+        }
 
-        std::vector<wgpu::FeatureName> features;
+        // Meanwhile the window is created on the main thread, SDL wants that.
+        // In headless mode there is no window at all, we draw into a texture of our own.
+        if (!mOptions.headless)
+        {
+            auto phase = mStartupTimeline.scope("window creation");
+            SDL_SetMainReady();
+            if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+                std::cerr << "Could not initialize SDL! Error: " << SDL_GetError() << std::endl;
+                deviceFuture.wait();
+                return false;
+            }
+           
+            int windowFlags = 0;
+            mWindow = SDL_CreateWindow("Learn WebGPU", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, kWindowWidth, kWindowHieght, windowFlags);
+            if (!mWindow)
+            {
+                SDL_Quit();
+                deviceFuture.wait();
+                return false;
+            }
+
+            mSurface = SDL_GetWGPUSurface(mInstance, mWindow);
+        }
+
+        wgpu::Device device = nullptr;
+        {
+            auto phase = mStartupTimeline.scope("wait for device");
+            device = deviceFuture.get();
+        }
+        // The first candidate that can present to the window and gives us a device wins.
+        // Only a fallback to another adapter requests its device here on the main thread.
+        size_t chosen = 0;
+        for (; chosen < selector.candidates().size(); ++chosen)
+        {
+            const AdapterCandidate &candidate = selector.candidates()[chosen];
+            bool canPresent = mOptions.headless || canPresentTo(mSurface, candidate.adapter);
+            if (!canPresent && device)
+            {
+                device.release();
+                device = nullptr;
+                // Releasing the device may have called the lost callback, nothing was lost.
+                mDeviceLost = false;
+            }
+            else if (canPresent && chosen > 0)
+            {
+                device = createDevice(candidate.adapter);
+            }
+            if (device)
+            {
+                break;
+            }
+            std::cout << "adapter " << candidate.info.name << (canPresent ? " gave no device" : " can not present to the window")
+                      << ", trying the next one" << std::endl;
+        }
+        if (!device)
+        {
+            std::cout << "failed to get a device" << std::endl;
+            return false;
+        }
+        mDevice = device;
+        wgpu::Adapter adapter = selector.choose(chosen);
+        selector.report(std::cout);
+
+        // Get teh format of the surface that we will draw on to.
+        mTextureFormat = mOptions.headless ? kOffscreenFormat : mSurface.getPreferredFormat(adapter);
+
+        if (!mOptions.headless)
+        {
+            mPresentModes = supportedPresentModes(mSurface, adapter);
+            mPresentMode = choosePresentMode(mOptions.presentMode, mPresentModes);
+            if (mPresentMode != mOptions.presentMode)
+            {
+                std::cout << "present mode " << presentModeName(mOptions.presentMode) << " is not supported, using "
+                          << presentModeName(mPresentMode) << std::endl;
+            }
+        }
+
+        // Release the WGPUAdapter, we no longer need it after getting our device.
+        adapter.release();
+
+        // Initialize the command queue for the current device that we are working with.
+        mQueue = mDevice.getQueue();
+        mTimeline.reset(mDevice, mQueue);
+        configureUniformRing();
+        // Everything created from now on goes through the registry, so it can be rebuilt
+        // if the device is lost.
+        mRegistry.attach(mDevice, mQueue);
+
+        mPipelineCache.setContext(mAdapterIdentity, describePipeline());
+        // Before the worker threads below start using the device, see validateSpirv.
+        mPipelineCache.validateSpirv(mDevice, mTriangleShaderSource);
+
+        // Once the device is acquired, configuration for the rendering on the device is complete,
+        // and also we got our Queue from the device to send buffers/commands. it's time to setup
+        // the rendering pipeline. Shader compilation and buffer uploads don't depend on each other
+        // so they run on their own threads while we configure the surface here.
+        std::future<void> pipelineFuture = launchAsync([this]()
+        {
+            auto phase = mStartupTimeline.scope("pipeline setup");
+            setupPipeline();
+        });
+        if (!mOptions.overlappedInit)
+        {
+            pipelineFuture.wait();
+        }
+
+        std::future<void> buffersFuture = launchAsync([this]()
+        {
+            auto phase = mStartupTimeline.scope("buffer setup");
+            setupBuffers();
+        });
+        if (!mOptions.overlappedInit)
+        {
+            buffersFuture.wait();
+        }
+
+        {
+            auto phase = mStartupTimeline.scope("surface configure");
+            configureRenderTarget();
+        }
+
+        // The bind group needs both the layout from the pipeline and the uniform buffer.
+        pipelineFuture.get();
+        buffersFuture.get();
+        setupBindGroup();
+        setupCulling();
+        setupInstancing();
+
+        if (!mOptions.writeMeshPath.empty())
+        {
+            saveMesh(mOptions.writeMeshPath);
+        }
+
+        return true;
+    }
+
+    // Rank every adapter instead of taking whatever HighPerformance gives us,
+    // the choice is cached so only the first launch pays for the probing.
+    AdapterSelectorOptions Application::adapterSelectorOptions() const
+    {
+        AdapterSelectorOptions selectorOptions;
+        selectorOptions.forceFallbackAdapter = mOptions.forceFallbackAdapter;
+        selectorOptions.cachePath = mOptions.adapterCachePath;
+        return selectorOptions;
+    }
+
+    // The window is already there, so only adapters that can present to it are considered.
+    wgpu::Adapter Application::selectAdapter()
+    {
+        AdapterSelector selector(mInstance, adapterSelectorOptions());
+        wgpu::Adapter adapter = selector.select(mSurface);
+        selector.report(std::cout);
+        return adapter;
+    }
+
+    wgpu::Device Application::createDevice(wgpu::Adapter adapter)
+    {
         wgpu::DeviceDescriptor deviceDesc = {};
         deviceDesc.label = "GPU"; 
         deviceDesc.requiredFeatures = nullptr;
-        deviceDesc.requiredLimits = nullptr; // we do not require any specific limit
         deviceDesc.defaultQueue.nextInChain = nullptr;
         deviceDesc.defaultQueue.label = "The default queue";
-        deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const *message, void * /* pUserData */)
+        // The callback can come from any thread, it only raises a flag and
+        // render() takes care of the recovery on the main thread.
+        deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const *message, void *pUserData)
         {
             std::cout << "Device lost: reason " << reason;
             if (message)
                 std::cout << " (" << message << ")";
             std::cout << std::endl;
+            reinterpret_cast<Application *>(pUserData)->mDeviceLost = true;
         };
+        deviceDesc.deviceLostUserdata = this;
+
+        // Dawn devices are not thread safe unless they lock every call, which the
+        // ImplicitDeviceSynchronization feature does. ParallelRecorder creates encoders on
+        // several threads, without the feature everything is recorded on the render thread.
+        // wgpu-native devices are always thread safe.
+        mConcurrentRecording = true;
+#ifdef WEBGPU_BACKEND_DAWN
+        std::vector<wgpu::FeatureName> requiredFeatures;
+        mConcurrentRecording = adapter.hasFeature(wgpu::FeatureName::ImplicitDeviceSynchronization);
+        if (mConcurrentRecording)
+        {
+            requiredFeatures.push_back(wgpu::FeatureName::ImplicitDeviceSynchronization);
+        }
+        else if (mOptions.recordThreads != 1)
+        {
+            std::cout << "the adapter has no ImplicitDeviceSynchronization, recording on a single thread" << std::endl;
+        }
+        deviceDesc.requiredFeatureCount = requiredFeatures.size();
+        deviceDesc.requiredFeatures = (WGPUFeatureName *)requiredFeatures.data();
+#endif // WEBGPU_BACKEND_DAWN
+
+        // Lets Dawn keep its compiled shaders and pipelines on disk.
+        mAdapterIdentity = readAdapterInfo(adapter).identity();
+        mPipelineCache.chainDeviceDescriptor(deviceDesc, mAdapterIdentity);
 
         // Get the adapter limits
         wgpu::RequiredLimits requiredLimits = getRequiredLimits(adapter);
+        // Something that can't be chunked needs more than this adapter has, the device would
+        // fail later on the first pipeline or bind group. No device makes init move on to the
+        // next adapter instead, the notes above say which limit was short.
+        if (!mNegotiatedLimits.satisfiable)
+        {
+            std::cout << "adapter " << readAdapterInfo(adapter).name << " can not satisfy the required limits" << std::endl;
+            return nullptr;
+        }
         deviceDesc.requiredLimits = &requiredLimits;
         // Get the actual device that we will use.
         // Think of device as a GPU, basically anything that we want to do with GPU
         // we need to work with the device. 
-        mDevice = adapter.requestDevice(deviceDesc);
-
-        // Get teh format of the surface that we will draw on to.
-        mTextureFormat = mSurface.getPreferredFormat(adapter);
-
-        // Release the WGPUInstance and WGPUAdapter, we no longer need them after getting our device.
-        instance.release();
-        adapter.release();
+        wgpu::Device device = requestDevice(mInstance, adapter, deviceDesc);
+        if (!device)
+        {
+            return nullptr;
+        }
 
         // Setup the global error handler on the  device because sometimes we have errors 
         // on the device/GPU and we need a capture all error handler for these global
@@ -82,8 +380,12 @@ namespace learn::webgpu
                 std::cout << " (" << message << ")";
             std::cout << std::endl;
         };
-        mDevice.setUncapturedErrorCallback(onDeviceError);
+        device.setUncapturedErrorCallback(onDeviceError);
+        return device;
+    }
 
+    void Application::configureSurface()
+    {
         // configure the surface
         // Even though the surface is acquired from the window with the same adapter from which
         // we got the device, we should reconfigure the surface, this way we can control height and width 
@@ -99,54 +401,211 @@ namespace learn::webgpu
         surfaceConfig.usage = wgpu::TextureUsage::RenderAttachment;
         // Link ths surface and the device
         surfaceConfig.device = mDevice;
-        surfaceConfig.presentMode = wgpu::PresentMode::Fifo;
+        // Chosen in init() from the modes the surface supports, see setPresentMode.
+        surfaceConfig.presentMode = mPresentMode;
         surfaceConfig.alphaMode = wgpu::CompositeAlphaMode::Auto;
         // Reconfigure the surface using the SurfaceConfig.
         mSurface.configure(surfaceConfig);
+    }
 
+    // Without a surface we own the texture we draw on. CopySrc so the frames can be
+    // read back or copied somewhere else.
+    void Application::createOffscreenTarget()
+    {
+        wgpu::TextureDescriptor textureDesc;
+        textureDesc.label = "Offscreen target";
+        textureDesc.dimension = wgpu::TextureDimension::_2D;
+        textureDesc.size.width = static_cast<uint32_t>(kWindowWidth);
+        textureDesc.size.height = static_cast<uint32_t>(kWindowHieght);
+        textureDesc.size.depthOrArrayLayers = 1;
+        textureDesc.format = mTextureFormat;
+        textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+        textureDesc.mipLevelCount = 1;
+        textureDesc.sampleCount = 1;
+        textureDesc.viewFormatCount = 0;
+        textureDesc.viewFormats = nullptr;
+        mOffscreenTexture = mDevice.createTexture(textureDesc);
+    }
 
-        // Initialize the command queue for the current device that we are working with.
-        mQueue = mDevice.getQueue();
+    void Application::configureRenderTarget()
+    {
+        if (mOptions.headless)
+        {
+            createOffscreenTarget();
+            if (mOptions.readbackFrames)
+            {
+                mFrameReadback.create(mDevice);
+            }
+        }
+        else
+        {
+            configureSurface();
+        }
+        // Bundles are recorded for the format of the target.
+        mSceneBundles.configure(mDevice, mTextureFormat);
+    }
 
-        // Once the device is acquired, configuration for the rendering on the device is complete,
-        // and also we got our Queue from the device to send buffers/commands. it's time to setup
-        // the rendering pipeline.
-        setupPipeline();
+    // The dynamic offsets have to be multiples of the device's minUniformBufferOffsetAlignment.
+    void Application::configureUniformRing()
+    {
+        wgpu::SupportedLimits deviceLimits;
+        mDevice.getLimits(&deviceLimits);
+        mUniformRing.setAlignment(deviceLimits.limits.minUniformBufferOffsetAlignment);
+    }
 
-        setupBuffers();
+    // Welds the duplicated vertices of the imported triangles and reorders the result for the
+    // post-transform vertex cache, so the vertex shader runs as few times as possible.
+    void Application::processMesh()
+    {
+        if (!mPackedIndices.draws.empty())
+        {
+            // Already done by a previous init().
+            return;
+        }
 
-        return true;
-    }
+        if (mOptions.meshGridSize > 0)
+        {
+            makeGridSoup(mOptions.meshGridSize, mPointData, mColorData);
+        }
 
-    // A function that gets the limits on the adapter
-    wgpu::RequiredLimits Application::getRequiredLimits(wgpu::Adapter adapter) {
-        wgpu::SupportedLimits supportedLimits;
-        adapter.getLimits(&supportedLimits);
+        // The optimizer works on whole vertices: position then color.
+        const uint32_t floatsPerVertex = 5;
+        uint32_t soupCount = static_cast<uint32_t>(mPointData.size() / 2);
+        std::vector<float> soup;
+        soup.reserve(soupCount * floatsPerVertex);
+        for (uint32_t v = 0; v < soupCount; ++v)
+        {
+            soup.insert(soup.end(), mPointData.begin() + 2 * v, mPointData.begin() + 2 * v + 2);
+            soup.insert(soup.end(), mColorData.begin() + 3 * v, mColorData.begin() + 3 * v + 3);
+        }
 
-        wgpu::RequiredLimits requiredLimits = wgpu::Default;
+        MeshData mesh = weldVertices(soup, floatsPerVertex, 2);
+        std::cout << "mesh welding: " << soupCount << " -> " << mesh.vertexCount() << " vertices" << std::endl;
+        optimizeMesh(mesh).report(std::cout, "mesh optimization");
 
-        //Uniform limits
-        requiredLimits.limits.maxBindGroups = 1;
-        requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
-        requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4;
+        // 16 bit indices whenever possible, a mesh of more than 65536 vertices is drawn in
+        // several pieces that each get their own copy of the vertices they use.
+        mPackedIndices = packIndices(mesh.indices, mesh.vertexCount(), mOptions.indexPacking);
+        mPackedIndices.report(std::cout);
+        if (!mPackedIndices.vertexRemap.empty())
+        {
+            mesh.vertices = remapVertices(mesh.vertices, floatsPerVertex, mPackedIndices.vertexRemap);
+        }
 
-        requiredLimits.limits.maxVertexAttributes = 2;
+        mPointData.clear();
+        mColorData.clear();
+        for (uint32_t v = 0; v < mesh.vertexCount(); ++v)
+        {
+            const float *vertex = mesh.vertices.data() + v * floatsPerVertex;
+            mPointData.insert(mPointData.end(), vertex, vertex + 2);
+            mColorData.insert(mColorData.end(), vertex + 2, vertex + 5);
+        }
+    }
 
-        requiredLimits.limits.maxVertexBuffers = 2;
+    // The vertex layouts and the bind group layout entries are needed twice: once to work out
+    // the device limits before we even have a device, and once in setupPipeline. So they are
+    // built here, before anything else, and kept around as members.
+    void Application::setupResourceLayouts()
+    {
+        // We only declare what the shader reads, the vertex layout picks the formats and
+        // the buffers. Positions fit in [-1, 1] and colors in [0, 1], so they become
+        // Snorm16x2 and Unorm8x4 in one interleaved buffer: 8 bytes a vertex instead of 20.
+        VertexAttributeDesc position;
+        position.name = "position";
+        position.location = 0;
+        position.components = 2;
+        position.measure(mPointData.data(), mPointData.size());
+        // Well below a pixel of our 600x600 window.
+        position.tolerance = 1e-4f;
+
+        VertexAttributeDesc color;
+        color.name = "color"; //@location(1) from the shader  code
+        color.location = 1;
+        color.components = 3;
+        color.measure(mColorData.data(), mColorData.size());
+        // What an 8 bit swapchain shows anyway.
+        color.tolerance = 1.0f / 255.0f;
+
+        mVertexLayout = VertexLayout({position, color}, mOptions.vertexLayout);
+        mVertexLayout.report(std::cout);
+
+        // The uTime uniform
+        wgpu::BindGroupLayoutEntry bindingLayout = wgpu::Default;
+        bindingLayout.binding = 0;
+        bindingLayout.visibility = wgpu::ShaderStage::Vertex;
+        bindingLayout.buffer.type = wgpu::BufferBindingType::Uniform;
+        bindingLayout.buffer.minBindingSize = sizeof(float);
+        // The block used by a draw is chosen in setBindGroup, see UniformRing.
+        bindingLayout.buffer.hasDynamicOffset = true;
+        mBindGroupLayoutEntries = {bindingLayout};
+    }
 
-        requiredLimits.limits.maxBufferSize = 6 * 3 * sizeof(float);
+    // Modules come from the pipeline cache, and are tagged with the hash of their WGSL so the
+    // render pipeline cache can tell that two modules are the same.
+    wgpu::ShaderModule Application::createShaderModule(wgpu::Device device, const std::string &label, const std::string &source)
+    {
+        wgpu::ShaderModule shaderModule = mPipelineCache.createShaderModule(device, label, source);
+        mRenderPipelineCache.setObjectKey(shaderModule, hashString(source));
+        return shaderModule;
+    }
 
-        requiredLimits.limits.maxVertexBufferArrayStride = 3 * sizeof(float);
+    // Everything in the render pipeline that changes the code the backend generates for
+    // the shaders, it goes into the pipeline cache keys.
+    std::string Application::describePipeline() const
+    {
+        std::ostringstream description;
+        description << "vs_main fs_main topology " << static_cast<uint32_t>(wgpu::PrimitiveTopology::TriangleList)
+                    << " target " << static_cast<uint32_t>(mTextureFormat);
+        for (const wgpu::VertexBufferLayout &layout : mVertexLayout.bufferLayouts())
+        {
+            description << " buffer " << layout.arrayStride << " " << static_cast<uint32_t>(layout.stepMode);
+            for (uint32_t i = 0; i < layout.attributeCount; ++i)
+            {
+                const WGPUVertexAttribute &attribute = layout.attributes[i];
+                description << " @" << attribute.shaderLocation << " " << static_cast<uint32_t>(attribute.format)
+                            << "+" << attribute.offset;
+            }
+        }
+        return description.str();
+    }
 
-        requiredLimits.limits.maxInterStageShaderComponents = 3;
+    // Tell the negotiator everything we are about to create so it can size the limits.
+    void Application::describeResources(LimitsNegotiator &negotiator) const
+    {
+        negotiator.addVertexBufferLayouts(mVertexLayout.bufferLayouts());
+        negotiator.addBindGroupLayout(mBindGroupLayoutEntries);
+        for (const wgpu::VertexBufferLayout &layout : mVertexLayout.bufferLayouts())
+        {
+            negotiator.addBuffer(layout.arrayStride * vertexCount());
+        }
+        negotiator.addBuffer(mPackedIndices.bytes.size());
+        negotiator.addBuffer(mUniformRing.bufferSize());
+        // VertexOutput carries the color, a vec3f
+        negotiator.addInterStageComponents(3);
+        negotiator.addTexture2D(kWindowWidth, kWindowHieght);
+        if (mOptions.cullObjects > 0)
+        {
+            GpuCulling::describeResources(negotiator, mOptions.cullObjects);
+        }
+        if (mOptions.instances > 0)
+        {
+            InstancedRenderer::describeResources(negotiator, mVertexLayout, mOptions.instances);
+        }
+    }
 
-        requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
-        requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
+    // A function that gets the limits on the adapter
+    wgpu::RequiredLimits Application::getRequiredLimits(wgpu::Adapter adapter) {
+        wgpu::SupportedLimits supportedLimits;
+        adapter.getLimits(&supportedLimits);
 
-        requiredLimits.limits.maxTextureDimension2D = 1080;
+        LimitsNegotiator negotiator;
+        describeResources(negotiator);
+        mNegotiatedLimits = negotiator.negotiate(supportedLimits);
+        mNegotiatedLimits.report(std::cout);
 
-        return requiredLimits;
+        return mNegotiatedLimits.limits;
     }
+
     // Pipeline is nothing but setting up our shaders, GPU is not a general pupose
     // programming hardware, it's a specialist hardware with fixed set of pipeline executions on it.
     // We simply configure the pipeline with the appropriate data and code we want to execute at
@@ -163,58 +622,31 @@ namespace learn::webgpu
     void Application::setupPipeline()
     {
         // Setup shaderModule that binds together our shader code WGSL with
-        // vertext and fragment shader calls
-        wgpu::ShaderModuleDescriptor shaderModuleDesc = {};
-        shaderModuleDesc.label = "triangle shader module";
-#ifdef WEBGPU_BACKEND_WGPU
-        shaderModuleDesc.hintCount = 0;
-        shaderModuleDesc.hints = nullptr;
-#endif
-        // ShaderModule needs code, and it can't be directly connected to the ShaderModule.
-        // We need a ShaderModuleWGSLDescriptor for that.
-        wgpu::ShaderModuleWGSLDescriptor shaderCodeDesc;
-        shaderCodeDesc.chain.next = nullptr;
-        shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
-        shaderCodeDesc.code = shaderSource;
-
-        // Chain the module with the code.
-        shaderModuleDesc.nextInChain = &shaderCodeDesc.chain;
-        // Create the ShaderModule
-        wgpu::ShaderModule shaderModule = mDevice.createShaderModule(shaderModuleDesc);
-
-        std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts(2);
-        
-        //VertextBufferLayout setup for vertex position
-        wgpu::VertexAttribute positionAttrib;
-        positionAttrib.shaderLocation = 0;
-        positionAttrib.format = wgpu::VertexFormat::Float32x2;
-        positionAttrib.offset = 0;
-        //Setup the VertexBufferLayout for the position
-        vertexBufferLayouts[0].attributeCount = 1;
-        vertexBufferLayouts[0].attributes = &positionAttrib;
-        vertexBufferLayouts[0].arrayStride = 2 * sizeof(float);
-        vertexBufferLayouts[0].stepMode = wgpu::VertexStepMode::Vertex;
-
-        // VertexAttrib for the color
-        wgpu::VertexAttribute colorAttrib;
-        colorAttrib.shaderLocation = 1; //@location(1) from the shader  code
-        colorAttrib.format = wgpu::VertexFormat::Float32x3;
-        colorAttrib.offset = 0;
-        //Setup the VertexBufferLayout for the color
-        vertexBufferLayouts[1].attributeCount = 1;
-        vertexBufferLayouts[1].attributes = &colorAttrib;
-        vertexBufferLayouts[1].arrayStride = 3 * sizeof(float);
-        vertexBufferLayouts[1].stepMode = wgpu::VertexStepMode::Vertex;
+        // vertext and fragment shader calls. The registry keeps the WGSL source and the
+        // layout entries around, and the pipeline is described by a builder function, so all
+        // of it can be created again on a new device.
+        mShaderHandle = mRegistry.addShader("triangle shader module", mTriangleShaderSource);
+        mBindGroupLayoutHandle = mRegistry.addBindGroupLayout("uniform layout", mBindGroupLayoutEntries);
+        mPipelineHandle = mRegistry.addRenderPipeline("triangle pipeline", [this](wgpu::Device device, const ResourceRegistry &registry)
+        {
+            return createTrianglePipeline(device, registry.shader(mShaderHandle), registry.bindGroupLayout(mBindGroupLayoutHandle));
+        });
 
+        mBindGroupLayout = mRegistry.bindGroupLayout(mBindGroupLayoutHandle);
+        mTrianglePipeline = mRegistry.renderPipeline(mPipelineHandle);
+    }
 
+    wgpu::RenderPipeline Application::createTrianglePipeline(wgpu::Device device, wgpu::ShaderModule shaderModule, wgpu::BindGroupLayout bindGroupLayout,
+                                                             const PipelineBuilder &build)
+    {
         // Setup vertex shader
         // We are not using the buffers
         // Rendering pipeline configuration so that we can render our triangle using the GPU pipeline
         // This takes the vertext and fragment information on the pipeline.
         wgpu::RenderPipelineDescriptor trianglePipelineDesc;
         trianglePipelineDesc.layout = nullptr;
-        trianglePipelineDesc.vertex.bufferCount = static_cast<uint32_t>(vertexBufferLayouts.size());
-        trianglePipelineDesc.vertex.buffers = vertexBufferLayouts.data();
+        trianglePipelineDesc.vertex.bufferCount = static_cast<uint32_t>(mVertexLayout.streamCount());
+        trianglePipelineDesc.vertex.buffers = mVertexLayout.bufferLayouts().data();
         trianglePipelineDesc.vertex.module = shaderModule;
         trianglePipelineDesc.vertex.entryPoint = "vs_main";
         trianglePipelineDesc.vertex.constantCount = 0;
@@ -261,83 +693,558 @@ namespace learn::webgpu
         trianglePipelineDesc.depthStencil = nullptr;
 
         //Setup Uniform
-        wgpu::BindGroupLayoutEntry bindingLayout = wgpu::Default;
-        bindingLayout.binding = 0;
-        bindingLayout.visibility = wgpu::ShaderStage::Vertex;
-        bindingLayout.buffer.type = wgpu::BufferBindingType::Uniform;
-        bindingLayout.buffer.minBindingSize = sizeof(float);
-
-        wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
-        bindGroupLayoutDesc.entryCount = 1;
-        bindGroupLayoutDesc.entries = &bindingLayout;
-        mBindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
-
-        wgpu::PipelineLayoutDescriptor layoutDesc{};
-        layoutDesc.bindGroupLayoutCount = 1;
-        layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
-        wgpu::PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
+        // The layout and the pipeline come from the render pipeline cache, building the
+        // same state twice gives back the pipeline that was already compiled.
+        mRenderPipelineCache.setObjectKey(bindGroupLayout, RenderPipelineCache::hashBindGroupLayoutEntries(mBindGroupLayoutEntries));
+        wgpu::PipelineLayout layout = mRenderPipelineCache.pipelineLayout(device, {bindGroupLayout});
         trianglePipelineDesc.layout = layout;
 
-
-        
-        // Create an actual pipeline that chains together our vertex and fragment shader
-        mTrianglePipeline = mDevice.createRenderPipeline(trianglePipelineDesc);
-        shaderModule.release();
+        // Create an actual pipeline that chains together our vertex and fragment shader.
+        // A reload on Dawn builds it asynchronously instead, without the cache.
+        wgpu::RenderPipeline pipeline = build ? build(trianglePipelineDesc) : mRenderPipelineCache.renderPipeline(device, trianglePipelineDesc);
+        layout.release();
+        return pipeline;
     }
 
     // Buffers are a memory location in the GPU/VRAM.
     // They represent data/information or whatever you want to store there for GPU to access.
     void Application::setupBuffers()
     {
-        
-        wgpu::BufferDescriptor bufferDesc;
-        bufferDesc.mappedAtCreation = false;
-        
-        bufferDesc.label = "Vertex Point Buffer";
-        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Vertex;
-        bufferDesc.size = mPointData.size() * sizeof(float);
-        mPointBuffer = mDevice.createBuffer(bufferDesc);
-        mQueue.writeBuffer(mPointBuffer, 0, mPointData.data(), bufferDesc.size);
-
-        bufferDesc.label = "Color buffer";
-        bufferDesc.size = mColorData.size() * sizeof(float);
-        mColorBuffer = mDevice.createBuffer(bufferDesc);
-        mQueue.writeBuffer(mColorBuffer, 0, mColorData.data(), bufferDesc.size);
-
-        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Index;
-        bufferDesc.label = "Index Buffer";
-        bufferDesc.size = mIndexData.size() * sizeof(uint16_t);
-        mIndexBuffer = mDevice.createBuffer(bufferDesc);
-        mQueue.writeBuffer(mIndexBuffer, 0, mIndexData.data(), bufferDesc.size);
-
-        // Uniform buffer setup
-        bufferDesc.label = "Uniform";
-        bufferDesc.size = sizeof(float);
-        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
-        mUniformBuffer = mDevice.createBuffer(bufferDesc);
-        mQueue.writeBuffer(mUniformBuffer, 0, &mCurrentTime, sizeof(float));
-
-
-
-        wgpu::BindGroupEntry binding;
+        // Every piece of data is a range of a shared block rather than a buffer of its own,
+        // see BufferSuballocator. The blocks live in the registry, which keeps a copy of their
+        // content to upload it again if the device is lost.
+        mBufferAllocator.setBlockSize(std::min(BufferSuballocator::kDefaultBlockSize, mNegotiatedLimits.maxBufferChunkSize));
+        WGPUBufferUsageFlags vertexUsage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Vertex;
+        std::vector<std::vector<uint8_t>> streams = mVertexLayout.pack({mPointData.data(), mColorData.data()}, vertexCount());
+        mVertexStreams.resize(streams.size());
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            mVertexStreams[i].allocation = mBufferAllocator.upload(vertexUsage, streams[i].data(), streams[i].size());
+        }
+
+        // Every draw of the packed indices is split again at triangle boundaries when it is
+        // bigger than the device's maxBufferSize, every chunk is drawn on its own in render().
+        WGPUBufferUsageFlags indexUsage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Index;
+        const uint32_t indexSize = mPackedIndices.indexSize();
+        for (const IndexedDraw &draw : mPackedIndices.draws)
+        {
+            const uint8_t *indexBytes = mPackedIndices.bytes.data() + draw.byteOffset;
+            for (const BufferChunk &chunk : chunkRanges(uint64_t(draw.indexCount) * indexSize, 3 * indexSize, mNegotiatedLimits.maxBufferChunkSize))
+            {
+                IndexChunk indexChunk;
+                indexChunk.allocation = mBufferAllocator.upload(indexUsage, indexBytes + chunk.offset, chunk.size);
+                indexChunk.indexCount = static_cast<uint32_t>(chunk.size / indexSize);
+                indexChunk.baseVertex = draw.baseVertex;
+                mIndexChunks.push_back(indexChunk);
+            }
+        }
+
+        // Uniform buffer setup, the blocks are written every frame so it starts out empty.
+        WGPUBufferUsageFlags uniformUsage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+        // 256 is the largest minUniformBufferOffsetAlignment a device can ask for.
+        mUniformAllocation = mBufferAllocator.allocate(uniformUsage, mUniformRing.bufferSize(), 256);
+
+        // A mesh file replaces the built-in mesh. Nothing is read here, render() streams it.
+        if (!mOptions.meshPath.empty())
+        {
+            std::string error;
+            if (mMeshStream.open(mOptions.meshPath, mVertexLayout.identity(), mVertexLayout.bytesPerVertex(),
+                                 mNegotiatedLimits.maxBufferChunkSize, error))
+            {
+                mMeshStream.start(mDevice);
+            }
+            else
+            {
+                std::cout << "mesh file: " << error << std::endl;
+            }
+        }
+
+        refreshResourceHandles();
+    }
+
+    // Every draw of mPackedIndices becomes a part of the file with the vertices it uses, see
+    // MeshFile. The vertices of a draw are the ones from its base vertex to the next one's.
+    void Application::saveMesh(const std::string &path)
+    {
+        std::vector<std::vector<uint8_t>> streams = mVertexLayout.pack({mPointData.data(), mColorData.data()}, vertexCount());
+        if (streams.size() != 1)
+        {
+            std::cout << "mesh file: only interleaved vertices can be saved" << std::endl;
+            return;
+        }
+        const uint32_t bytesPerVertex = static_cast<uint32_t>(mVertexLayout.bytesPerVertex());
+        std::vector<MeshFilePartData> parts;
+        for (size_t i = 0; i < mPackedIndices.draws.size(); ++i)
+        {
+            const IndexedDraw &draw = mPackedIndices.draws[i];
+            uint32_t firstVertex = static_cast<uint32_t>(draw.baseVertex);
+            uint32_t endVertex = i + 1 < mPackedIndices.draws.size() ? static_cast<uint32_t>(mPackedIndices.draws[i + 1].baseVertex) : vertexCount();
+            MeshFilePartData part;
+            part.vertices = streams[0].data() + uint64_t(firstVertex) * bytesPerVertex;
+            part.vertexCount = endVertex - firstVertex;
+            part.indices = mPackedIndices.bytes.data() + draw.byteOffset;
+            part.indexCount = draw.indexCount;
+            parts.push_back(part);
+        }
+        std::string error;
+        if (learn::webgpu::writeMeshFile(path, mVertexLayout.identity(), bytesPerVertex, mPackedIndices.indexSize(), parts, error))
+        {
+            std::cout << "mesh file: wrote " << parts.size() << " part(s) to " << path << std::endl;
+        }
+        else
+        {
+            std::cout << "mesh file: " << error << std::endl;
+        }
+    }
+
+    // The buffer ranges of the mesh, for the modules that draw copies of it.
+    CulledMesh Application::meshRanges() const
+    {
+        CulledMesh mesh;
+        for (const VertexStream &stream : mVertexStreams)
+        {
+            mesh.vertexStreams.push_back({stream.buffer, stream.allocation.offset, stream.allocation.size});
+        }
+        for (const IndexChunk &chunk : mIndexChunks)
+        {
+            mesh.indexChunks.push_back({chunk.buffer, chunk.allocation.offset, chunk.allocation.size, chunk.indexCount, chunk.baseVertex});
+        }
+        mesh.indexFormat = mPackedIndices.format;
+        return mesh;
+    }
+
+    float Application::meshRadius() const
+    {
+        float radius = 0.0f;
+        for (size_t i = 0; i + 1 < mPointData.size(); i += 2)
+        {
+            radius = std::max(radius, std::sqrt(mPointData[i] * mPointData[i] + mPointData[i + 1] * mPointData[i + 1]));
+        }
+        return radius;
+    }
+
+    // The copies of the mesh draw the vertex and index buffers of setupBuffers, so this and
+    // setupInstancing come after them, and again after a device loss.
+    void Application::setupCulling()
+    {
+        if (mOptions.cullObjects == 0 || mMeshStream.isOpen())
+        {
+            return;
+        }
+        if (!mCulling.create(mDevice, mQueue, mVertexLayout.applyToWgsl(shaders::kCullingWgsl), mVertexLayout, mTextureFormat, meshRanges(),
+                             scatterObjects(mOptions.cullObjects, meshRadius())))
+        {
+            std::cout << "GPU culling setup failed, drawing the mesh once" << std::endl;
+        }
+    }
+
+    void Application::setupInstancing()
+    {
+        if (mOptions.instances == 0 || mOptions.cullObjects > 0 || mMeshStream.isOpen())
+        {
+            return;
+        }
+        if (!mInstancing.create(mDevice, mQueue, mVertexLayout.applyToWgsl(shaders::kInstancedWgsl), mVertexLayout, mTextureFormat,
+                                meshRanges(), gridInstances(mOptions.instances, meshRadius())))
+        {
+            std::cout << "Instancing setup failed, drawing the mesh once" << std::endl;
+        }
+    }
+
+    // The bind group links the uniform buffer from setupBuffers to the layout
+    // from setupPipeline, so it can only be created once both of them are done.
+    void Application::setupBindGroup()
+    {
+        ResourceRegistry::BufferBinding binding;
         binding.binding = 0;
-        binding.buffer = mUniformBuffer;
-        binding.offset = 0;
+        binding.buffer = mUniformAllocation.buffer;
+        binding.offset = mUniformAllocation.offset;
         binding.size = sizeof(float);
+        mBindGroupHandle = mRegistry.addBindGroup("Uniform bind group", mBindGroupLayoutHandle, {binding});
+        mBindGroup = mRegistry.bindGroup(mBindGroupHandle);
+    }
 
-        wgpu::BindGroupDescriptor bindGroupDesc;
-        bindGroupDesc.layout = mBindGroupLayout;
-        bindGroupDesc.entryCount = 1; // bindGroupLayoutDesc.entryCount;
-        bindGroupDesc.entries = &binding;
-        mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+    // The members below are only shortcuts to what the registry owns, they have to be
+    // fetched again whenever the registry recreates its objects.
+    void Application::refreshResourceHandles()
+    {
+        if (mPipelineHandle != ResourceRegistry::kInvalidHandle)
+        {
+            mTrianglePipeline = mRegistry.renderPipeline(mPipelineHandle);
+            mBindGroupLayout = mRegistry.bindGroupLayout(mBindGroupLayoutHandle);
+        }
+        if (mUniformAllocation.valid())
+        {
+            for (VertexStream &stream : mVertexStreams)
+            {
+                stream.buffer = mBufferAllocator.buffer(stream.allocation);
+            }
+            mUniformBuffer = mBufferAllocator.buffer(mUniformAllocation);
+            for (IndexChunk &chunk : mIndexChunks)
+            {
+                chunk.buffer = mBufferAllocator.buffer(chunk.allocation);
+            }
+        }
+        if (mBindGroupHandle != ResourceRegistry::kInvalidHandle)
+        {
+            mBindGroup = mRegistry.bindGroup(mBindGroupHandle);
+        }
+    }
 
+    // After a driver reset or a device.destroy() everything that came from the old device
+    // is dead. We get a new adapter (the selection is cached so this is quick) and device,
+    // then the registry rebuilds the shaders, pipelines, buffers and bind groups in parallel.
+    bool Application::recoverFromDeviceLoss()
+    {
+        auto start = std::chrono::steady_clock::now();
+        discardShaderReload();
+        // Cached pipelines belong to the old device.
+        mRenderPipelineCache.clear();
+        // Frames still on their way back were drawn by the old device, they are lost with it.
+        mFrameReadback.release();
+        mMeshStream.stop();
+        mCulling.release();
+        mInstancing.release();
+        mSceneBundles.release();
+        // Already gone when an earlier attempt failed.
+        if (mQueue)
+        {
+            mQueue.release();
+            mQueue = nullptr;
+        }
+        if (mDevice)
+        {
+            mDevice.release();
+            mDevice = nullptr;
+        }
 
-        wgpu::CommandEncoder encoder = mDevice.createCommandEncoder(wgpu::Default);
-        wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
-        encoder.release();
-        mQueue.submit(command);
-        command.release();
-       
+        wgpu::Adapter adapter = selectAdapter();
+        if (!adapter)
+        {
+            std::cout << "device recovery failed: no adapter" << std::endl;
+            return false;
+        }
+        mDevice = createDevice(adapter);
+        adapter.release();
+        if (!mDevice)
+        {
+            std::cout << "device recovery failed: no device" << std::endl;
+            return false;
+        }
+        mQueue = mDevice.getQueue();
+        mTimeline.reset(mDevice, mQueue);
+        mFrames.reset();
+        configureUniformRing();
+
+        // The new adapter may not be the old one, its shaders get cache entries of their own.
+        mPipelineCache.setContext(mAdapterIdentity, describePipeline());
+        mPipelineCache.validateSpirv(mDevice, mTriangleShaderSource);
+        mRegistry.recreate(mDevice, mQueue);
+        refreshResourceHandles();
+        // The file is still mapped, the mesh streams in again from its first byte.
+        if (mMeshStream.isOpen())
+        {
+            mMeshStream.start(mDevice);
+        }
+        setupCulling();
+        setupInstancing();
+        if (mOffscreenTexture)
+        {
+            mOffscreenTexture.release();
+            mOffscreenTexture = nullptr;
+        }
+        configureRenderTarget();
+
+        // Only now, a failed attempt leaves it set so the next frame tries again.
+        mDeviceLost = false;
+        mLastRecoveryMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ++mRecoveryCount;
+        std::cout << "Device recovered in " << mLastRecoveryMs << " ms" << std::endl;
+        return true;
+    }
+
+    // Destroying the device is the closest we can get to a driver reset from inside the
+    // application: the lost callback fires and every object of the device becomes invalid.
+    void Application::simulateDeviceLoss()
+    {
+        mDevice.destroy();
+        // The lost callback is delivered when the device is polled.
+        pollDevice();
+    }
+
+    void Application::pollDevice()
+    {
+        // No device between a failed recovery and the next attempt.
+        if (!mDevice)
+        {
+            return;
+        }
+        #if defined(WEBGPU_BACKEND_DAWN)
+            wgpuDeviceTick(mDevice);
+        #elif defined(WEBGPU_BACKEND_WGPU)
+            wgpuDevicePoll(mDevice, false, nullptr);
+        #elif defined(WEBGPU_BACKEND_EMSCRIPTEN)
+            emscripten_sleep(100);
+        #endif
+    }
+
+    void Application::waitForGpu()
+    {
+        mTimeline.wait(mTimeline.signal());
+    }
+
+    void Application::benchmarkUploads(std::ostream &out)
+    {
+        learn::webgpu::benchmarkUploads(mDevice, mQueue, mNegotiatedLimits.maxBufferChunkSize, out);
+    }
+
+    void Application::benchmarkReadbacks(std::ostream &out)
+    {
+        learn::webgpu::benchmarkReadbacks(mDevice, mQueue, out);
+    }
+
+    void Application::benchmarkTransientBuffers(std::ostream &out)
+    {
+        learn::webgpu::benchmarkTransientBuffers(mDevice, mQueue, out);
+    }
+
+    void Application::benchmarkIndirectDraws(std::ostream &out)
+    {
+        learn::webgpu::benchmarkIndirectDraws(mDevice, mQueue, out);
+    }
+
+    void Application::benchmarkInstancing(std::ostream &out)
+    {
+        learn::webgpu::benchmarkInstancing(mDevice, mQueue, mNegotiatedLimits.maxBufferChunkSize, out);
+    }
+
+    void Application::benchmarkRenderBundles(std::ostream &out)
+    {
+        learn::webgpu::benchmarkRenderBundles(mDevice, mQueue, out);
+    }
+
+    void Application::benchmarkParallelRecording(std::ostream &out)
+    {
+        // Without --record-threads every core is compared with one.
+        uint32_t threads = mOptions.recordThreads == 1 ? 0 : mOptions.recordThreads;
+        if (!mConcurrentRecording)
+        {
+            out << "the device can't be used by several threads, comparing one thread with itself" << std::endl;
+            threads = 1;
+        }
+        learn::webgpu::benchmarkParallelRecording(mDevice, mQueue, threads, out);
+    }
+
+    void Application::setPresentMode(wgpu::PresentMode mode)
+    {
+        if (mOptions.headless)
+        {
+            return;
+        }
+        mPresentMode = choosePresentMode(mode, mPresentModes);
+        // Configuring again replaces the swap chain, the frames in flight are finished first.
+        waitForGpu();
+        configureSurface();
+        mPresentTimer.reset();
+    }
+
+    void Application::benchmarkPresentModes(std::ostream &out, int framesPerMode)
+    {
+        if (mOptions.headless)
+        {
+            out << "present modes need a window, run without --headless" << std::endl;
+            return;
+        }
+        const wgpu::PresentMode initialMode = mPresentMode;
+        for (wgpu::PresentMode mode : mPresentModes)
+        {
+            setPresentMode(mode);
+            for (int frame = 0; frame < framesPerMode && isRunning(); ++frame)
+            {
+                render();
+                mainLoop();
+            }
+            mPresentTimer.report(mode, out);
+        }
+        out << "(acquire wait is the time getCurrentTexture blocked, acquire to present the time the frame held the texture)"
+            << std::endl;
+        setPresentMode(initialMode);
+    }
+
+    // Builds the shader module and the pipeline of the new source without stalling render().
+    // Error scopes are only pushed and popped on this thread: Dawn keeps a stack of them per
+    // thread, and a scope popped by a worker in the middle of a frame would break the stack
+    // of the frame. A WGSL mistake gives us an error message and no pipeline, instead of a
+    // broken pipeline and an uncaptured error.
+    // The module is only parsed and validated, that is quick, so it is created right here
+    // in a scope of its own. The pipeline is where the backend compiles the shader:
+    //  - Dawn builds it on its own threads with createRenderPipelineAsync, the callback comes
+    //    back on this thread from pollDevice with the pipeline or with the error,
+    //  - wgpu-native has no createRenderPipelineAsync, so a worker thread builds it. Its error
+    //    scopes belong to the device, the one around the worker is pushed here and popped in
+    //    finishShaderReload once the worker is done. An error of a frame recorded meanwhile
+    //    ends up in it too and fails the reload, the previous pipeline is then kept and the
+    //    next save tries again.
+    void Application::startShaderReload()
+    {
+        std::string path = mOptions.shaderDirectory + "/" + kTriangleShaderFile;
+        std::string source;
+        if (!readTextFile(path, source))
+        {
+            std::cout << "could not read " << path << std::endl;
+            return;
+        }
+        source = mVertexLayout.applyToWgsl(source);
+
+        auto start = std::chrono::steady_clock::now();
+        ShaderReload reload;
+        mDevice.pushErrorScope(wgpu::ErrorFilter::Validation);
+        reload.shaderModule = createShaderModule(mDevice, "triangle shader module", source);
+        if (popErrorScope(mDevice, reload.error))
+        {
+            if (reload.shaderModule)
+                reload.shaderModule.release();
+            reload.shaderModule = nullptr;
+            std::promise<ShaderReload> failed;
+            failed.set_value(std::move(reload));
+            mShaderReload = failed.get_future();
+            return;
+        }
+        reload.source = std::move(source);
+
+#ifdef WEBGPU_BACKEND_DAWN
+        struct PendingReload
+        {
+            ShaderReload reload;
+            std::chrono::steady_clock::time_point start;
+            std::promise<ShaderReload> done;
+        };
+        PendingReload *pending = new PendingReload{std::move(reload), start, {}};
+        mShaderReload = pending->done.get_future();
+        auto onCreated = [](WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline pipeline, char const *message, void *pUserData)
+        {
+            std::unique_ptr<PendingReload> pending(reinterpret_cast<PendingReload *>(pUserData));
+            ShaderReload &reload = pending->reload;
+            if (status == WGPUCreatePipelineAsyncStatus_Success)
+            {
+                reload.pipeline = pipeline;
+            }
+            else
+            {
+                if (pipeline)
+                    wgpuRenderPipelineRelease(pipeline);
+                reload.shaderModule.release();
+                reload.shaderModule = nullptr;
+                reload.error = message ? message : "pipeline creation failed";
+            }
+            reload.compileMs = elapsedMs(pending->start);
+            pending->done.set_value(std::move(reload));
+        };
+        createTrianglePipeline(mDevice, pending->reload.shaderModule, mBindGroupLayout,
+                               [this, pending, onCreated](const wgpu::RenderPipelineDescriptor &descriptor) -> wgpu::RenderPipeline
+                               {
+                                   wgpuDeviceCreateRenderPipelineAsync(mDevice, &descriptor, onCreated, pending);
+                                   return nullptr;
+                               });
+#else
+        mDevice.pushErrorScope(wgpu::ErrorFilter::Validation);
+        mShaderReloadScope = true;
+        mShaderReload = launchAsync([this, reload = std::move(reload), start]() mutable
+        {
+            reload.pipeline = createTrianglePipeline(mDevice, reload.shaderModule, mBindGroupLayout);
+            reload.compileMs = elapsedMs(start);
+            return std::move(reload);
+        });
+#endif // WEBGPU_BACKEND_DAWN
+    }
+
+    // The result of the reload started last, it must be done. On wgpu-native this pops the
+    // scope that was open while the worker built the pipeline.
+    Application::ShaderReload Application::finishShaderReload()
+    {
+        ShaderReload reload = mShaderReload.get();
+        if (!mShaderReloadScope)
+        {
+            return reload;
+        }
+        mShaderReloadScope = false;
+        std::string error;
+        if (popErrorScope(mDevice, error))
+        {
+            if (reload.pipeline)
+                reload.pipeline.release();
+            if (reload.shaderModule)
+                reload.shaderModule.release();
+            reload.pipeline = nullptr;
+            reload.shaderModule = nullptr;
+            reload.error = error;
+        }
+        return reload;
+    }
+
+    // Called between frames: picks up saved files, and swaps in the new pipeline once it
+    // is built. render() never waits for a compilation.
+    void Application::pollShaderReload()
+    {
+        if (!mShaderWatcher)
+        {
+            return;
+        }
+        for (const std::string &name : mShaderWatcher->poll())
+        {
+            if (name == kTriangleShaderFile)
+            {
+                mShaderReloadPending = true;
+            }
+        }
+
+        if (mShaderReload.valid() && mShaderReload.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            ShaderReload reload = finishShaderReload();
+            if (reload.pipeline)
+            {
+                mRegistry.replaceShader(mShaderHandle, std::move(reload.source), reload.shaderModule);
+                mRegistry.replaceRenderPipeline(mPipelineHandle, reload.pipeline);
+                refreshResourceHandles();
+                // The bundles still use the old pipeline.
+                mSceneBundles.invalidate();
+                std::cout << "Reloaded " << kTriangleShaderFile << " in " << reload.compileMs << " ms" << std::endl;
+            }
+            else
+            {
+                std::cout << "Shader error in " << kTriangleShaderFile << ", keeping the previous pipeline:" << std::endl
+                          << reload.error << std::endl;
+            }
+        }
+
+        // Saving again while a compilation runs only queues one more compilation.
+        if (mShaderReloadPending && !mShaderReload.valid())
+        {
+            mShaderReloadPending = false;
+            startShaderReload();
+        }
+    }
+
+    // A compilation still running when the device goes away is of no use anymore,
+    // the file is compiled again on the next frame. Dawn only calls back from pollDevice,
+    // a lost device calls back with an error.
+    void Application::discardShaderReload()
+    {
+        if (!mShaderReload.valid())
+        {
+            return;
+        }
+        while (mShaderReload.wait_for(std::chrono::seconds(0)) == std::future_status::timeout)
+        {
+            processDeviceEvents(mDevice, true);
+        }
+        ShaderReload reload = finishShaderReload();
+        if (reload.pipeline)
+        {
+            reload.pipeline.release();
+            reload.shaderModule.release();
+        }
+        mShaderReloadPending = true;
     }
 
     bool Application::isRunning()
@@ -347,7 +1254,13 @@ namespace learn::webgpu
 
     void Application::mainLoop()
     {
-     
+            // Nothing presents in headless mode, polling is what lets the device
+            // clean up the frames that are done.
+            if (mOptions.headless)
+            {
+                pollDevice();
+                return;
+            }
 
             // Poll events and handle them.
             // (contrary to GLFW, close event is not automatically managed, and there
@@ -359,6 +1272,17 @@ namespace learn::webgpu
                     case SDL_QUIT:
                         mShouldCloseWindow = true;
                         break;
+                    case SDL_KEYDOWN:
+                        // P reports how the current present mode did and moves on to the next.
+                        if (event.key.keysym.sym == SDLK_p && !mPresentModes.empty())
+                        {
+                            mPresentTimer.report(mPresentMode, std::cout);
+                            auto current = std::find(mPresentModes.begin(), mPresentModes.end(), mPresentMode);
+                            size_t next = current == mPresentModes.end() ? 0 : (current - mPresentModes.begin() + 1) % mPresentModes.size();
+                            setPresentMode(mPresentModes[next]);
+                            std::cout << "present mode: " << presentModeName(mPresentMode) << std::endl;
+                        }
+                        break;
                     default:
                         std::cout << event.type << std::endl;
                         break;
@@ -368,15 +1292,22 @@ namespace learn::webgpu
 
     wgpu::TextureView Application::getNextSurfaceTextureView()
     {
-        wgpu::SurfaceTexture surfaceTexture;
-        // Get the next SurfaceTexture that we should write into.
-        mSurface.getCurrentTexture(&surfaceTexture);
-        // The actual Texture on which we draw.
-        wgpu::Texture texture = surfaceTexture.texture;
-        // Make sure the texture can be used for the drawing.
-        if (surfaceTexture.status != wgpu::SurfaceGetCurrentTextureStatus::Success)
+        wgpu::Texture texture = mOffscreenTexture;
+        if (!mOptions.headless)
         {
-            return nullptr;
+            wgpu::SurfaceTexture surfaceTexture;
+            // Get the next SurfaceTexture that we should write into. Depending on the present
+            // mode this waits for the display to give one back.
+            mPresentTimer.beginAcquire();
+            mSurface.getCurrentTexture(&surfaceTexture);
+            mPresentTimer.acquired();
+            // The actual Texture on which we draw.
+            texture = surfaceTexture.texture;
+            // Make sure the texture can be used for the drawing.
+            if (surfaceTexture.status != wgpu::SurfaceGetCurrentTextureStatus::Success)
+            {
+                return nullptr;
+            }
         }
 
         // Configure the TextureView out of a texture that we have. 
@@ -395,8 +1326,80 @@ namespace learn::webgpu
         return targetView;
     }
 
+    // One draw per streamed part of the mesh, or per index chunk.
+    uint32_t Application::sceneDrawCount() const
+    {
+        if (mMeshStream.isOpen())
+        {
+            return static_cast<uint32_t>(mMeshStream.readyDraws().size());
+        }
+        return static_cast<uint32_t>(mIndexChunks.size());
+    }
+
+    // The draws [first, last) of the mesh, into the render pass or into a render bundle, both
+    // encoders have the same commands. Runs on the recording threads with --record-threads,
+    // so it only reads the scene.
+    template <typename Encoder>
+    void Application::recordScene(Encoder encoder, uint32_t uniformOffset, uint32_t first, uint32_t last)
+    {
+        // It's our time to setup our rendering pipeline that we created on it.
+        // This way before drawing we link our pipeline to the GPU.
+        encoder.setPipeline(mTrianglePipeline);
+        encoder.setBindGroup(0, mBindGroup, 1, &uniformOffset);
+
+        // Now instruct the GPU to draw, we want 3 vertices to be drawn for our triangle that's why 3.
+        // And we want them to be rendered exactly once, that's why second param is 1.
+        // Another way to say this is 1 instance of 3 vertices.
+        if (mMeshStream.isOpen())
+        {
+            // Only the parts of the file that arrived so far.
+            for (uint32_t i = first; i < last; ++i)
+            {
+                const MeshStream::Draw &draw = mMeshStream.readyDraws()[i];
+                encoder.setVertexBuffer(0, draw.buffer, draw.vertexOffset, draw.vertexSize);
+                encoder.setIndexBuffer(draw.buffer, mMeshStream.indexFormat(), draw.indexOffset, draw.indexSize);
+                encoder.drawIndexed(draw.indexCount, 1, 0, 0, 0);
+            }
+            return;
+        }
+        for (uint32_t slot = 0; slot < mVertexStreams.size(); ++slot)
+        {
+            const VertexStream &stream = mVertexStreams[slot];
+            encoder.setVertexBuffer(slot, stream.buffer, stream.allocation.offset, stream.allocation.size);
+        }
+        for (uint32_t i = first; i < last; ++i)
+        {
+            const IndexChunk &chunk = mIndexChunks[i];
+            encoder.setIndexBuffer(chunk.buffer, mPackedIndices.format, chunk.allocation.offset, chunk.allocation.size);
+            encoder.drawIndexed(chunk.indexCount, 1, 0, chunk.baseVertex, 0);
+        }
+    }
+
     bool Application::render()
     {
+        if (mDeviceLost)
+        {
+            if (!recoverFromDeviceLoss())
+            {
+                // The driver may still be resetting, the next frames try again. After that
+                // there is no device to draw with, the run stops.
+                if (++mFailedRecoveries >= kMaxRecoveryAttempts)
+                {
+                    std::cout << "giving up after " << mFailedRecoveries << " failed device recoveries" << std::endl;
+                    mShouldCloseWindow = true;
+                }
+                return false;
+            }
+            mFailedRecoveries = 0;
+        }
+        pollShaderReload();
+
+        // Nothing throttles a headless run, and a window only once the swap chain is full,
+        // so the CPU could queue up frames much faster than the GPU draws them. We wait
+        // until the frame that used this slot framesInFlight frames ago is done instead,
+        // then everything the slot owns can be written again.
+        const uint32_t frameSlot = mFrames.beginFrame();
+
         auto textureView = getNextSurfaceTextureView();
         if (!textureView)
         {
@@ -406,6 +1409,13 @@ namespace learn::webgpu
         wgpu::CommandEncoderDescriptor encoderDesc = {};
         encoderDesc.label = "encoder";
         wgpu::CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+        // The next pieces of a streamed mesh are copied before the render pass draws them.
+        mMeshStream.pump(encoder, kMeshStreamBudget);
+        // The culling pass writes the draw arguments the render pass reads.
+        if (mCulling.valid())
+        {
+            mCulling.cull(encoder);
+        }
 
         wgpu::RenderPassColorAttachment renderPassColorAttachment = {};
         // Setup the textureView where we will draw our content.
@@ -426,29 +1436,90 @@ namespace learn::webgpu
         // We begin our render pass here, by calling beginRenderPass.
         wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
 
-        // One we have have our render pass by executing encoder.beingRenderPass
-        // It's our time to setup our rendering pipeline that we created on it. 
-        // This way before drawing we link our pipeline to the GPU.
-        renderPass.setPipeline(mTrianglePipeline);
-        renderPass.setVertexBuffer(0, mPointBuffer, 0, mPointBuffer.getSize());
-        renderPass.setVertexBuffer(1, mColorBuffer, 0, mColorBuffer.getSize());
-        renderPass.setIndexBuffer(mIndexBuffer, wgpu::IndexFormat::Uint16, 0, mIndexBuffer.getSize());
-
-        renderPass.setBindGroup(0, mBindGroup, 0, nullptr);      
+        if (mOptions.headless)
+        {
+            // Batch runs go as fast as they can, so the animation follows the frame number
+            // as if it ran at 60 fps. This also makes every run draw the same frames.
+            mCurrentTime = static_cast<float>(mFrameIndex) / 60.0f;
+        }
+        else
+        {
+            mCurrentTime =  static_cast<float>(SDL_GetTicks() * 0.001); // milliseconds to second
+            std::cout << mCurrentTime << std::endl;
+        }
+        ++mFrameIndex;
 
-        mCurrentTime =  static_cast<float>(SDL_GetTicks() * 0.001); // milliseconds to second
-        std::cout << mCurrentTime << std::endl;
-        mQueue.writeBuffer(mUniformBuffer, 0, &mCurrentTime, sizeof(float));
+        // Every uniform block of the frame goes into the ring, and all of them are uploaded
+        // with one writeBuffer. Each draw then binds its own block with a dynamic offset.
+        mUniformRing.beginFrame(frameSlot);
+        uint32_t uniformOffset = 0;
+        if (!mUniformRing.push(&mCurrentTime, sizeof(float), uniformOffset))
+        {
+            std::cout << "uniform ring region is full" << std::endl;
+        }
+        mUniformRing.flush(mQueue, mUniformBuffer, mUniformAllocation.offset);
 
-        // Now instruct the GPU to draw, we want 3 vertices to be drawn for our triangle that's why 3.
-        // And we want them to be rendered exactly once, that's why second param is 1.
-        // Another way to say this is 1 instance of 3 vertices.
-        renderPass.drawIndexed(mIndexCount, 1, 0, 0, 0);
+        // Recorded again every frame with --record-threads, released once the pass ended.
+        std::vector<wgpu::RenderBundle> partitionBundles;
+        if (mCulling.valid())
+        {
+            // However many copies there are, the CPU records the same few commands.
+            mCulling.drawIndirect(renderPass, mCurrentTime);
+        }
+        else if (mInstancing.valid())
+        {
+            // One draw, the instance count says how many copies.
+            mInstancing.draw(renderPass, mCurrentTime);
+        }
+        else if (mOptions.staticScene)
+        {
+            // A part of the mesh that arrived is new geometry, the bundles are out of date.
+            if (mMeshStream.readyDraws().size() != mBundledStreamDraws)
+            {
+                mBundledStreamDraws = mMeshStream.readyDraws().size();
+                mSceneBundles.invalidate();
+            }
+            // Only the uniform block changes from one frame to the next, and there are only
+            // as many of those as regions in the ring: one bundle for each.
+            wgpu::RenderBundle bundle = mSceneBundles.bundle(uniformOffset, [&](wgpu::RenderBundleEncoder bundleEncoder)
+                                                             { recordScene(bundleEncoder, uniformOffset, 0, sceneDrawCount()); });
+            renderPass.executeBundles(1, (WGPURenderBundle *)&bundle);
+        }
+        else if (mRecorder && mConcurrentRecording)
+        {
+            // The draws are cut in partitions recorded on the workers, the bundles come back
+            // in partition order so the frame is the same as recorded by this thread.
+            partitionBundles = mRecorder->recordBundles(mDevice, mTextureFormat, sceneDrawCount(), kMinDrawsPerPartition,
+                                                        [&](wgpu::RenderBundleEncoder bundleEncoder, const RecordPartition &partition)
+                                                        { recordScene(bundleEncoder, uniformOffset, partition.first, partition.last); });
+            renderPass.executeBundles(partitionBundles.size(), (WGPURenderBundle *)partitionBundles.data());
+        }
+        else
+        {
+            recordScene(renderPass, uniformOffset, 0, sceneDrawCount());
+        }
         // End the rendering pass because we are done drawing.
         renderPass.end();
         // Release the render pass so that GPU can release the resource when it's done.
         // Otherwise we end up leaking memory here.
         renderPass.release();
+        for (wgpu::RenderBundle &bundle : partitionBundles)
+        {
+            bundle.release();
+        }
+
+        // Copy the frame into the readback ring, its hash comes back a few frames later.
+        // If the GPU is so far behind that the ring is full, this frame is simply skipped.
+        if (mOptions.readbackFrames && mOffscreenTexture)
+        {
+            uint64_t frameIndex = mFrameIndex;
+            mFrameReadback.readTexture(encoder, mOffscreenTexture, static_cast<uint32_t>(kWindowWidth), static_cast<uint32_t>(kWindowHieght), 4,
+                                       [this, frameIndex](const void *data, uint64_t size)
+                                       {
+                                           mLastFrameHash = hashBytes(data, static_cast<size_t>(size));
+                                           mLastReadbackFrame = frameIndex;
+                                       });
+        }
 
         // Render pass is linked to the encoder, but sending these values
         // just by calling end and release. 
@@ -458,18 +1529,26 @@ namespace learn::webgpu
         cmdBufferDescriptor.label = "Command buffer";
         // Finish configuring the encoder and get the final command that we will
         // submit to the command queue.
+        mMeshStream.finish();
         wgpu::CommandBuffer command = encoder.finish(cmdBufferDescriptor);
         encoder.release();
 
-        // Submitting command.
-        mQueue.submit(command);
+        // Submitting command, the fence tells us when the GPU is done with it.
+        mFrames.endFrame(mTimeline.submit(command));
+        mMeshStream.submitted();
         // Release command that we created
         command.release();
         textureView.release();
+        mFrameReadback.submitted();
+        mFrameReadback.poll();
 
         // Present the surface
         #ifndef __EMSCRIPTEN__
-            mSurface.present();
+            if (!mOptions.headless)
+            {
+                mSurface.present();
+                mPresentTimer.presented();
+            }
         #endif
 
         return true;
@@ -477,20 +1556,65 @@ namespace learn::webgpu
 
     void Application::terminate()
     {
-        mPointBuffer.destroy();
-        mPointBuffer.release();
-        mColorBuffer.destroy();
-        mColorBuffer.release();
-        mIndexBuffer.destroy();
-        mIndexBuffer.release();
-        mUniformBuffer.destroy();
-        mUniformBuffer.release();
-        mTrianglePipeline.release();
-        mQueue.release();
-        mDevice.release();
-        mSurface.unconfigure();
-        mSurface.release();
-        SDL_DestroyWindow(mWindow);
-        SDL_Quit();
-    }
-} // namespace learn::webgpu
\ No newline at end of file
+        discardShaderReload();
+        mShaderWatcher.reset();
+        mRecorder.reset();
+        // Let the background shader translations finish so the next launch finds them.
+        mPipelineCache.flush();
+        mPipelineCache.report(std::cout);
+        mRenderPipelineCache.report(std::cout);
+        mBufferAllocator.report(std::cout);
+        if (!mOptions.headless)
+        {
+            mPresentTimer.report(mPresentMode, std::cout);
+        }
+        if (mOptions.readbackFrames)
+        {
+            mFrameReadback.wait();
+            mFrameReadback.report(std::cout);
+            std::cout << "frame " << mLastReadbackFrame << " hash: " << std::hex << mLastFrameHash << std::dec << std::endl;
+        }
+        mFrameReadback.release();
+        mFrames.report(std::cout);
+        mFrames.reset();
+        if (mMeshStream.isOpen())
+        {
+            mMeshStream.report(std::cout);
+        }
+        mMeshStream.close();
+        mCulling.release();
+        mInstancing.release();
+        if (mOptions.staticScene)
+        {
+            mSceneBundles.report(std::cout);
+        }
+        mSceneBundles.release();
+        mRenderPipelineCache.clear();
+        mRegistry.releaseAll();
+        mIndexChunks.clear();
+        if (mOffscreenTexture)
+        {
+            mOffscreenTexture.destroy();
+            mOffscreenTexture.release();
+        }
+        if (mQueue)
+        {
+            mQueue.release();
+        }
+        if (mDevice)
+        {
+            mDevice.release();
+        }
+        if (mSurface)
+        {
+            mSurface.unconfigure();
+            mSurface.release();
+        }
+        mInstance.release();
+        if (mWindow)
+        {
+            SDL_DestroyWindow(mWindow);
+            SDL_Quit();
+        }
+    }
+} // namespace learn::webgpu
@@ -5,9 +5,37 @@
 #include <sdl2webgpu.h>
 #include <SDL2/SDL.h>
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <ostream>
 #include <vector>
+#include <string>
 #include <cassert>
 
+#include "AdapterSelector.h"
+#include "BufferSuballocator.h"
+#include "FrameRing.h"
+#include "GpuCulling.h"
+#include "GpuTimeline.h"
+#include "IndexPacking.h"
+#include "InstancedRenderer.h"
+#include "LimitsNegotiator.h"
+#include "MeshStream.h"
+#include "ParallelRecorder.h"
+#include "PipelineCache.h"
+#include "PresentModes.h"
+#include "ReadbackRing.h"
+#include "RenderBundleCache.h"
+#include "RenderPipelineCache.h"
+#include "ResourceRegistry.h"
+#include "ShaderWatcher.h"
+#include "StartupTimeline.h"
+#include "UniformRing.h"
+#include "VertexLayout.h"
+
 #ifdef __EMSCRIPTEN__
 #  include <emscripten.h>
 #endif // __EMSCRIPTEN__
@@ -17,12 +45,66 @@
 namespace learn::webgpu
 {
 
+    struct ApplicationOptions
+    {
+        // Run window creation, adapter/device acquisition, shader compilation and buffer
+        // uploads on separate threads. Turning it off waits for every phase before starting
+        // the next one, which is handy to compare startup times.
+        bool overlappedInit = true;
+        // Only consider the fallback (software) adapter, so we can run without a GPU.
+        bool forceFallbackAdapter = false;
+        // Where AdapterSelector remembers the best adapter, empty to probe on every launch.
+        std::string adapterCachePath = "adapter_cache.txt";
+        // Render into an offscreen texture instead of a window, no SDL and no surface.
+        // Together with forceFallbackAdapter this runs on machines without a display or GPU.
+        bool headless = false;
+        // Translated shaders and compiled pipelines are kept here between launches.
+        PipelineCacheOptions pipelineCache;
+        // Start from an empty pipeline cache, to measure a cold start.
+        bool clearPipelineCache = false;
+        // Load the shaders from this directory and rebuild the pipeline whenever one of them
+        // is saved. Empty uses the shaders embedded at build time, without hot reload.
+        std::string shaderDirectory;
+        // Interleaved or split vertex buffers, compressed formats or plain floats.
+        VertexLayoutOptions vertexLayout;
+        // How the index format is chosen, see IndexPacking.
+        IndexPacking indexPacking = IndexPacking::SplitToUint16;
+        // Replaces the rectangle by a grid of meshGridSize x meshGridSize quads, 0 keeps it.
+        uint32_t meshGridSize = 0;
+        // Writes the processed mesh to this file, see MeshFile.
+        std::string writeMeshPath;
+        // Draws the mesh of this file instead, streamed in over the first frames.
+        std::string meshPath;
+        // Draws that many copies of the mesh instead of one, culled by a compute pass and
+        // drawn with indirect draws, see GpuCulling. 0 draws the mesh once.
+        uint32_t cullObjects = 0;
+        // Draws that many copies of the mesh with a single instanced draw, every one animated
+        // on its own, see InstancedRenderer. 0 draws the mesh once.
+        uint32_t instances = 0;
+        // Record the draws of the mesh once into render bundles and replay them every frame.
+        bool staticScene = false;
+        // Headless only: read every frame back and hash it, the hash of the last one is
+        // printed at exit so two runs can be compared.
+        bool readbackFrames = false;
+        // With a window: how frames are handed to the display. Fifo waits for vertical blank,
+        // FifoRelaxed tears when a frame is late, Mailbox replaces the waiting frame and
+        // Immediate shows it right away and tears. Falls back when the surface lacks it.
+        wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+        // How many frames the CPU records ahead of the GPU, 1 to 3, see FrameRing.
+        uint32_t framesInFlight = 3;
+        // Threads recording the draws of the mesh into render bundles every frame, 1 records
+        // them on the render thread and 0 uses a thread per core. See ParallelRecorder.
+        uint32_t recordThreads = 1;
+    };
+
     class Application
     {
     public:
-        Application() : mDevice(nullptr), mSurface(nullptr), mQueue(nullptr),
+        Application() : Application(ApplicationOptions{}) {}
+        explicit Application(const ApplicationOptions &options) : mOptions(options),
+        mPipelineCache(options.pipelineCache),
+        mDevice(nullptr), mSurface(nullptr), mQueue(nullptr),
         mTrianglePipeline(nullptr), mTextureFormat(wgpu::TextureFormat::Undefined),
-         mColorBuffer(nullptr),mPointBuffer(nullptr), mIndexBuffer(nullptr),
          mUniformBuffer(nullptr), mBindGroup(nullptr) {}
         
         bool init();
@@ -30,83 +112,226 @@ namespace learn::webgpu
         void mainLoop();
         void setupPipeline();
         void setupBuffers();
+        void setupBindGroup();
         bool render();
         void terminate();
 
+        StartupTimeline &startupTimeline() { return mStartupTimeline; }
+
+        // Destroys the device as a driver reset would, the next render() recovers.
+        void simulateDeviceLoss();
+        int recoveryCount() const { return mRecoveryCount; }
+        // Still true when the run stopped because the device couldn't be recovered.
+        bool deviceLost() const { return mDeviceLost; }
+        double lastRecoveryMs() const { return mLastRecoveryMs; }
+
+        // Blocks until the GPU has executed everything submitted so far, so a batch
+        // of headless frames can be timed from start to end.
+        void waitForGpu();
+
+        // Compares the mappedAtCreation and writeBuffer upload paths on this device.
+        void benchmarkUploads(std::ostream &out);
+        // Compares spinning, blocking and ring readbacks on this device.
+        void benchmarkReadbacks(std::ostream &out);
+        // Compares creating scratch buffers every frame with the transient buffer pool.
+        void benchmarkTransientBuffers(std::ostream &out);
+        // Compares CPU-issued draws with GPU culling and indirect draws.
+        void benchmarkIndirectDraws(std::ostream &out);
+        // Draws millions of instances and prints how many per second.
+        void benchmarkInstancing(std::ostream &out);
+        // Compares encoding the draws every frame with replaying render bundles.
+        void benchmarkRenderBundles(std::ostream &out);
+        // Renders framesPerMode frames in each present mode of the surface and prints their
+        // frame time and latency. Needs a window.
+        void benchmarkPresentModes(std::ostream &out, int framesPerMode);
+        // Compares recording many draws on one thread with recording them on recordThreads.
+        void benchmarkParallelRecording(std::ostream &out);
+
+        // Reconfigures the surface with mode, or the closest one it supports. The timing of
+        // the frames starts over. Press P in the window to go through the supported modes.
+        void setPresentMode(wgpu::PresentMode mode);
+        wgpu::PresentMode presentMode() const { return mPresentMode; }
+
     private:
-        SDL_Window *mWindow;
+        ApplicationOptions mOptions;
+        StartupTimeline mStartupTimeline;
+        PipelineCache mPipelineCache;
+        // AdapterInfo::identity() of the adapter the device came from, part of the cache keys.
+        uint64_t mAdapterIdentity = 0;
+        SDL_Window *mWindow = nullptr;
+        wgpu::Instance mInstance = nullptr;
         wgpu::Device mDevice;
         wgpu::Surface mSurface;
         wgpu::Queue mQueue;
         wgpu::RenderPipeline mTrianglePipeline;
         wgpu::TextureFormat mTextureFormat;
-     
+        // What the surface supports, the one in use and how its frames are doing.
+        std::vector<wgpu::PresentMode> mPresentModes;
+        wgpu::PresentMode mPresentMode = wgpu::PresentMode::Fifo;
+        PresentTimer mPresentTimer;
+        // Used in place of the surface texture in headless mode.
+        wgpu::Texture mOffscreenTexture = nullptr;
+        const wgpu::TextureFormat kOffscreenFormat = wgpu::TextureFormat::RGBA8Unorm;
+        uint64_t mFrameIndex = 0;
+        // Every submit goes through the timeline, so we know when the GPU finished it.
+        GpuTimeline mTimeline;
+        // The fence of every frame in flight.
+        FrameRing mFrames{mTimeline, mOptions.framesInFlight};
 
         const int kWindowWidth = 600;
         const int kWindowHieght = 600;
         bool mShouldCloseWindow = false;
 
+        // Three frames of RGBA8 pixels can be on their way back at once.
+        static constexpr uint32_t kFrameReadbackSlots = 3;
+        ReadbackRing mFrameReadback{kFrameReadbackSlots, uint64_t(ReadbackRing::rowPitch(static_cast<uint32_t>(kWindowWidth) * 4)) * static_cast<uint32_t>(kWindowHieght)};
+        uint64_t mLastFrameHash = 0;
+        uint64_t mLastReadbackFrame = 0;
+
         wgpu::TextureView getNextSurfaceTextureView();
         wgpu::RequiredLimits getRequiredLimits(wgpu::Adapter adapter);
+        void processMesh();
+        void saveMesh(const std::string &path);
+        void setupResourceLayouts();
+        std::string describePipeline() const;
+        void describeResources(LimitsNegotiator &negotiator) const;
+        AdapterSelectorOptions adapterSelectorOptions() const;
+        wgpu::Adapter selectAdapter();
+        wgpu::Device createDevice(wgpu::Adapter adapter);
+        void configureSurface();
+        void createOffscreenTarget();
+        void configureRenderTarget();
+        void configureUniformRing();
+        CulledMesh meshRanges() const;
+        float meshRadius() const;
+        void setupCulling();
+        void setupInstancing();
+        uint32_t sceneDrawCount() const;
+        template <typename Encoder>
+        void recordScene(Encoder encoder, uint32_t uniformOffset, uint32_t first, uint32_t last);
+        wgpu::ShaderModule createShaderModule(wgpu::Device device, const std::string &label, const std::string &source);
+        // Creates the pipeline from the descriptor, through the render pipeline cache by default.
+        using PipelineBuilder = std::function<wgpu::RenderPipeline(const wgpu::RenderPipelineDescriptor &descriptor)>;
+        wgpu::RenderPipeline createTrianglePipeline(wgpu::Device device, wgpu::ShaderModule shaderModule, wgpu::BindGroupLayout bindGroupLayout,
+                                                    const PipelineBuilder &build = nullptr);
+        void refreshResourceHandles();
+        bool recoverFromDeviceLoss();
+        void pollDevice();
+        void startShaderReload();
+        void pollShaderReload();
+        struct ShaderReload;
+        ShaderReload finishShaderReload();
+        void discardShaderReload();
+
+        // Shared pipelines, so the same state is never compiled twice on a device.
+        RenderPipelineCache mRenderPipelineCache;
+        // Owns every GPU resource below, the wgpu handles members are shortcuts into it.
+        ResourceRegistry mRegistry;
+        ResourceRegistry::Handle mShaderHandle = ResourceRegistry::kInvalidHandle;
+        ResourceRegistry::Handle mBindGroupLayoutHandle = ResourceRegistry::kInvalidHandle;
+        ResourceRegistry::Handle mPipelineHandle = ResourceRegistry::kInvalidHandle;
+        ResourceRegistry::Handle mBindGroupHandle = ResourceRegistry::kInvalidHandle;
+        // Vertices, indices and uniforms are ranges of a few registry buffers.
+        BufferSuballocator mBufferAllocator{mRegistry};
+        BufferSuballocator::Allocation mUniformAllocation;
+        std::atomic<bool> mDeviceLost{false};
+        int mRecoveryCount = 0;
+        double mLastRecoveryMs = 0.0;
+        // Recoveries that failed in a row, render() stops the run after kMaxRecoveryAttempts.
+        int mFailedRecoveries = 0;
+        static constexpr int kMaxRecoveryAttempts = 3;
+
+        VertexLayout mVertexLayout;
+        std::vector<wgpu::BindGroupLayoutEntry> mBindGroupLayoutEntries;
+        NegotiatedLimits mNegotiatedLimits;
         
+        // The rectangle as a modeler or a loader hands it to us: two triangles of three
+        // vertices each, the shared corners are simply repeated. processMesh() welds them
+        // into an indexed mesh and fills mPackedIndices.
         std::vector<float> mPointData = {
-            -0.4f, -0.6f, // Point 0
-            +0.4f, -0.6f, // Point 1
-            +0.4f, +0.6f, // Point 2
-            -0.4f, +0.6f // Point 3
+            -0.4f, -0.6f, // Triangle 1
+            +0.4f, -0.6f,
+            +0.4f, +0.6f,
+            -0.4f, -0.6f, // Triangle 2
+            +0.4f, +0.6f,
+            -0.4f, +0.6f
         };
 
-        std::vector<uint16_t> mIndexData = {
-            0, 1, 2, // Triangle 1
-            0, 2, 3 // Triangle 2
-        };
+        PackedIndices mPackedIndices;
 
         std::vector<float> mColorData = {
             1.0f, 0.0f, 0.0f,
-
             0.0f, 1.0f, 0.0f,
-            
             0.0f, 0.0f, 1.0f,
 
+            1.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,
             1.0f, 0.0f, 1.0f
-
         };
 
-        wgpu::Buffer mColorBuffer;
-        wgpu::Buffer mPointBuffer;
-        wgpu::Buffer mIndexBuffer;
+        uint32_t vertexCount() const { return static_cast<uint32_t>(mPointData.size() / 2); }
+        // One per vertex buffer slot of mVertexLayout, packed from mPointData and mColorData.
+        struct VertexStream
+        {
+            BufferSuballocator::Allocation allocation;
+            wgpu::Buffer buffer = nullptr;
+        };
+        std::vector<VertexStream> mVertexStreams;
+        // One entry per piece of the index buffer, see setupBuffers.
+        struct IndexChunk
+        {
+            BufferSuballocator::Allocation allocation;
+            wgpu::Buffer buffer = nullptr;
+            uint32_t indexCount = 0;
+            int32_t baseVertex = 0;
+        };
+        std::vector<IndexChunk> mIndexChunks;
+        // Set when the mesh comes from ApplicationOptions::meshPath.
+        MeshStream mMeshStream;
+        // ApplicationOptions::staticScene, one bundle per uniform ring region.
+        RenderBundleCache mSceneBundles;
+        // The streamed parts the bundles were recorded with.
+        size_t mBundledStreamDraws = 0;
+        // Set when ApplicationOptions::cullObjects asks for copies of the mesh.
+        GpuCulling mCulling;
+        // Set when ApplicationOptions::instances asks for instanced copies of the mesh.
+        InstancedRenderer mInstancing;
+        // What a frame may upload of it, the staging belt holds as much.
+        static constexpr uint64_t kMeshStreamBudget = MeshStream::kChunkSize * MeshStream::kChunkCount;
+        // Room for the uniform blocks of one frame, a multiple of any offset alignment.
+        static constexpr uint64_t kUniformRingRegionSize = 64 * 1024;
+        // A region for each frame in flight.
+        UniformRing mUniformRing{kUniformRingRegionSize, mFrames.framesInFlight()};
         wgpu::Buffer mUniformBuffer;
         wgpu::BindGroup mBindGroup;
         wgpu::BindGroupLayout mBindGroupLayout = nullptr;
-        uint32_t mIndexCount = static_cast<uint32_t>(mIndexData.size());
         float mCurrentTime = 0.0f;
+        // The WGSL lives in shaders/triangle.wgsl, the build embeds it (and its SPIR-V
+        // translation) in TriangleShader.h. With hot reload it is read from the file.
+        const char *kTriangleShaderFile = "triangle.wgsl";
+        std::string mTriangleShaderSource;
 
-         
-        const char* shaderSource = R"(
-            @group(0) @binding(0) var<uniform> uTime: f32;
-
-            struct VertexInput {
-                @location(0) position: vec2f,
-                @location(1) color: vec3f,
-            };
-
-            struct VertexOutput {
-                @builtin(position) position: vec4f,
-                @location(0) color: vec3f
-            };
-
-            @vertex
-            fn vs_main(in: VertexInput) -> VertexOutput {
-                var out: VertexOutput;
-                out.position = vec4f(in.position, 0.0, 1.0);
-                out.color = vec3f(sin(in.color[0] + uTime), cos(in.color[1]), sin(in.color[2] * uTime));
-                return out;
-            }
-
-            @fragment
-            fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-                return vec4f(in.color, 1.0f);
-            }
-        )";
+        // Hot reload: a new pipeline is built in the background (see startShaderReload) while
+        // we keep rendering with the old one, and swapped in at the start of a frame once it
+        // is ready.
+        struct ShaderReload
+        {
+            std::string source;
+            wgpu::ShaderModule shaderModule = nullptr;
+            wgpu::RenderPipeline pipeline = nullptr;
+            std::string error;
+            double compileMs = 0.0;
+        };
+        std::unique_ptr<ShaderWatcher> mShaderWatcher;
+        // Set when ApplicationOptions::recordThreads asks for more than the render thread.
+        std::unique_ptr<ParallelRecorder> mRecorder;
+        // The device may be used by several threads at once, see createDevice.
+        bool mConcurrentRecording = true;
+        // Fewer draws than this are not worth a thread of their own.
+        static constexpr uint32_t kMinDrawsPerPartition = 16;
+        std::future<ShaderReload> mShaderReload;
+        bool mShaderReloadPending = false;
+        // wgpu-native: the error scope around the worker building the pipeline is open.
+        bool mShaderReloadScope = false;
     };
 } // namespace learn::webgpu
@@ -0,0 +1,159 @@
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "AsyncRequests.h"
+#include "GpuTimeline.h"
+
+#ifdef __EMSCRIPTEN__
+#  include <emscripten.h>
+#endif // __EMSCRIPTEN__
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // Keep the instance busy until the request callback is done.
+        void waitForRequest(wgpu::Instance instance, const std::atomic<bool> &requestEnded)
+        {
+            while (!requestEnded.load())
+            {
+#if defined(WEBGPU_BACKEND_DAWN)
+                wgpuInstanceProcessEvents(instance);
+#elif defined(__EMSCRIPTEN__)
+                (void)instance;
+                emscripten_sleep(10);
+#else
+                (void)instance;
+#endif
+                std::this_thread::yield();
+            }
+        }
+    } // namespace
+
+    wgpu::Adapter requestAdapter(wgpu::Instance instance, const wgpu::RequestAdapterOptions &options)
+    {
+        struct UserData
+        {
+            WGPUAdapter adapter = nullptr;
+            std::atomic<bool> requestEnded{false};
+        };
+        UserData userData;
+
+        auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, char const *message, void *pUserData)
+        {
+            UserData &userData = *reinterpret_cast<UserData *>(pUserData);
+            if (status == WGPURequestAdapterStatus_Success)
+            {
+                userData.adapter = adapter;
+            }
+            else
+            {
+                std::cout << "Adapter request failed";
+                if (message)
+                    std::cout << " (" << message << ")";
+                std::cout << std::endl;
+            }
+            userData.requestEnded = true;
+        };
+
+        wgpuInstanceRequestAdapter(instance, &options, onAdapterRequestEnded, (void *)&userData);
+        waitForRequest(instance, userData.requestEnded);
+        return userData.adapter;
+    }
+
+    wgpu::Device requestDevice(wgpu::Instance instance, wgpu::Adapter adapter, const wgpu::DeviceDescriptor &descriptor)
+    {
+        struct UserData
+        {
+            WGPUDevice device = nullptr;
+            std::atomic<bool> requestEnded{false};
+        };
+        UserData userData;
+
+        auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, char const *message, void *pUserData)
+        {
+            UserData &userData = *reinterpret_cast<UserData *>(pUserData);
+            if (status == WGPURequestDeviceStatus_Success)
+            {
+                userData.device = device;
+            }
+            else
+            {
+                std::cout << "Device request failed";
+                if (message)
+                    std::cout << " (" << message << ")";
+                std::cout << std::endl;
+            }
+            userData.requestEnded = true;
+        };
+
+        wgpuAdapterRequestDevice(adapter, &descriptor, onDeviceRequestEnded, (void *)&userData);
+        waitForRequest(instance, userData.requestEnded);
+        return userData.device;
+    }
+
+    void waitForSubmittedWork(wgpu::Device device, wgpu::Queue queue)
+    {
+        GpuTimeline timeline(device, queue);
+        timeline.wait(timeline.signal());
+    }
+
+    void processDeviceEvents(wgpu::Device device, bool wait)
+    {
+#if defined(WEBGPU_BACKEND_DAWN)
+        wgpuDeviceTick(device);
+        if (wait)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+#elif defined(WEBGPU_BACKEND_WGPU)
+        wgpuDevicePoll(device, wait, nullptr);
+#elif defined(__EMSCRIPTEN__)
+        (void)device;
+        if (wait)
+        {
+            emscripten_sleep(1);
+        }
+#endif
+    }
+
+    bool popErrorScope(wgpu::Device device, std::string &message)
+    {
+        struct UserData
+        {
+            WGPUErrorType type = WGPUErrorType_NoError;
+            std::string message;
+            std::atomic<bool> popEnded{false};
+        };
+        UserData userData;
+
+        auto onErrorScopePopped = [](WGPUErrorType type, char const *message, void *pUserData)
+        {
+            UserData &userData = *reinterpret_cast<UserData *>(pUserData);
+            userData.type = type;
+            userData.message = message ? message : "";
+            userData.popEnded = true;
+        };
+        wgpuDevicePopErrorScope(device, onErrorScopePopped, (void *)&userData);
+
+        while (!userData.popEnded.load())
+        {
+#if defined(WEBGPU_BACKEND_DAWN)
+            wgpuDeviceTick(device);
+#elif defined(WEBGPU_BACKEND_WGPU)
+            wgpuDevicePoll(device, false, nullptr);
+#elif defined(__EMSCRIPTEN__)
+            emscripten_sleep(1);
+#endif
+            std::this_thread::yield();
+        }
+
+        message = userData.message;
+        return userData.type != WGPUErrorType_NoError;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <future>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace learn::webgpu
+{
+
+    // Requesting an adapter or a device is asynchronous in WebGPU. wgpu-native happens to
+    // call the callback before returning, but Dawn and the browser only call it once the
+    // instance processes its events. These helpers keep pumping the instance until the
+    // callback actually fired, so they are safe to call on any backend and from any thread.
+    wgpu::Adapter requestAdapter(wgpu::Instance instance, const wgpu::RequestAdapterOptions &options);
+    wgpu::Device requestDevice(wgpu::Instance instance, wgpu::Adapter adapter, const wgpu::DeviceDescriptor &descriptor);
+
+    // Blocks until everything submitted to the queue so far has finished on the GPU.
+    void waitForSubmittedWork(wgpu::Device device, wgpu::Queue queue);
+
+    // Lets the device fire its callbacks (buffer maps, work done...). With wait, wgpu blocks
+    // until the last submit is done. Dawn has no such wait, there we give the core away for
+    // a moment instead, so a loop around it never spins.
+    void processDeviceEvents(wgpu::Device device, bool wait);
+
+    // Pops the error scope pushed with device.pushErrorScope() and waits for its result.
+    // Returns true if an error was caught in the scope, message then says what went wrong.
+    bool popErrorScope(wgpu::Device device, std::string &message);
+
+    // Runs a task on a worker thread and hands back a future for its result.
+    // Emscripten builds have no threads by default, there the task runs when the
+    // future is waited on, so the init just becomes serial again.
+    template <typename Function>
+    std::future<std::invoke_result_t<std::decay_t<Function>>> launchAsync(Function &&function)
+    {
+#ifdef __EMSCRIPTEN__
+        return std::async(std::launch::deferred, std::forward<Function>(function));
+#else
+        return std::async(std::launch::async, std::forward<Function>(function));
+#endif
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,258 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+#include "BufferSuballocator.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        uint64_t alignUp(uint64_t value, uint64_t alignment)
+        {
+            return (value + alignment - 1) & ~(alignment - 1);
+        }
+
+        // Best fit candidates looked at before settling for a range that fits whatever the padding.
+        constexpr int kBestFitCandidates = 8;
+    } // namespace
+
+    RangeAllocator::RangeAllocator(uint64_t size) : mSize(size), mFreeBytes(0)
+    {
+        insertFree(0, size);
+    }
+
+    uint64_t RangeAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t &rangeStart, uint64_t &rangeSize)
+    {
+        // The smallest ranges of at least size bytes, one of them usually fits with its
+        // alignment padding. A range of size + alignment - 1 bytes always does.
+        auto candidate = mFreeBySize.lower_bound(size);
+        for (int i = 0; i < kBestFitCandidates && candidate != mFreeBySize.end(); ++i, ++candidate)
+        {
+            if (alignUp(candidate->second, alignment) + size <= candidate->second + candidate->first)
+                break;
+        }
+        if (candidate == mFreeBySize.end() || alignUp(candidate->second, alignment) + size > candidate->second + candidate->first)
+        {
+            candidate = mFreeBySize.lower_bound(size + alignment - 1);
+            if (candidate == mFreeBySize.end())
+                return kInvalidOffset;
+        }
+
+        uint64_t freeStart = candidate->second;
+        uint64_t freeEnd = freeStart + candidate->first;
+        uint64_t offset = alignUp(freeStart, alignment);
+        eraseFree(mFreeByOffset.find(freeStart));
+
+        // The alignment padding and the end of the range go back to the free list.
+        rangeStart = offset;
+        if (offset != freeStart)
+            insertFree(freeStart, offset - freeStart);
+        if (offset + size < freeEnd)
+            insertFree(offset + size, freeEnd - offset - size);
+        rangeSize = offset + size - rangeStart;
+        return offset;
+    }
+
+    void RangeAllocator::free(uint64_t rangeStart, uint64_t rangeSize)
+    {
+        uint64_t start = rangeStart;
+        uint64_t end = rangeStart + rangeSize;
+        // Merge with the free ranges right before and right after.
+        auto next = mFreeByOffset.lower_bound(start);
+        if (next != mFreeByOffset.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == start)
+            {
+                start = previous->first;
+                eraseFree(previous);
+            }
+        }
+        if (next != mFreeByOffset.end() && next->first == end)
+        {
+            end += next->second;
+            eraseFree(next);
+        }
+        insertFree(start, end - start);
+    }
+
+    uint64_t RangeAllocator::largestFreeRange() const
+    {
+        return mFreeBySize.empty() ? 0 : mFreeBySize.rbegin()->first;
+    }
+
+    void RangeAllocator::insertFree(uint64_t offset, uint64_t size)
+    {
+        mFreeByOffset.emplace(offset, size);
+        mFreeBySize.emplace(size, offset);
+        mFreeBytes += size;
+    }
+
+    void RangeAllocator::eraseFree(std::map<uint64_t, uint64_t>::iterator range)
+    {
+        auto sized = mFreeBySize.equal_range(range->second);
+        for (auto it = sized.first; it != sized.second; ++it)
+        {
+            if (it->second == range->first)
+            {
+                mFreeBySize.erase(it);
+                break;
+            }
+        }
+        mFreeBytes -= range->second;
+        mFreeByOffset.erase(range);
+    }
+
+    double BufferSuballocator::Statistics::occupancy() const
+    {
+        return reservedBytes == 0 ? 0.0 : static_cast<double>(usedBytes) / static_cast<double>(reservedBytes);
+    }
+
+    double BufferSuballocator::Statistics::fragmentation() const
+    {
+        uint64_t freeBytes = reservedBytes - usedBytes;
+        return freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(contiguousFreeBytes) / static_cast<double>(freeBytes);
+    }
+
+    BufferSuballocator::BufferSuballocator(ResourceRegistry &registry, uint64_t blockSize)
+        : mRegistry(registry), mBlockSize(blockSize)
+    {
+    }
+
+    void BufferSuballocator::setBlockSize(uint64_t blockSize)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBlockSize = blockSize & ~uint64_t(3);
+    }
+
+    BufferSuballocator::Allocation BufferSuballocator::allocate(WGPUBufferUsageFlags usage, uint64_t size, uint64_t alignment)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Allocation allocation;
+        allocation.size = alignUp(size, 4);
+        alignment = std::max<uint64_t>(alignment, 4);
+
+        for (size_t i = 0; i < mBlocks.size(); ++i)
+        {
+            Block &block = mBlocks[i];
+            if (block.usage != usage || block.ranges.freeBytes() < allocation.size)
+                continue;
+            uint64_t offset = block.ranges.allocate(allocation.size, alignment, allocation.rangeStart, allocation.rangeSize);
+            if (offset != RangeAllocator::kInvalidOffset)
+            {
+                ++block.allocations;
+                allocation.buffer = block.buffer;
+                allocation.block = static_cast<uint32_t>(i);
+                allocation.offset = offset;
+                return allocation;
+            }
+        }
+
+        // No room left, start a new block. A new block starts at offset 0 so any alignment fits.
+        uint64_t blockSize = std::max(mBlockSize, allocation.size);
+        ResourceRegistry::Handle buffer = mRegistry.addBuffer("Suballocator block", usage, nullptr, blockSize);
+        mBlocks.push_back(Block{usage, buffer, RangeAllocator(blockSize)});
+        Block &block = mBlocks.back();
+        allocation.offset = block.ranges.allocate(allocation.size, alignment, allocation.rangeStart, allocation.rangeSize);
+        ++block.allocations;
+        allocation.buffer = buffer;
+        allocation.block = static_cast<uint32_t>(mBlocks.size() - 1);
+        return allocation;
+    }
+
+    BufferSuballocator::Allocation BufferSuballocator::upload(WGPUBufferUsageFlags usage, const void *data, uint64_t size, uint64_t alignment)
+    {
+        Allocation allocation = allocate(usage, size, alignment);
+        write(allocation, 0, data, size);
+        return allocation;
+    }
+
+    void BufferSuballocator::write(const Allocation &allocation, uint64_t offset, const void *data, uint64_t size)
+    {
+        // writeBuffer wants a multiple of 4 bytes, the allocation has room for the padding.
+        if (size % 4 == 0)
+        {
+            mRegistry.writeBuffer(allocation.buffer, allocation.offset + offset, data, size);
+            return;
+        }
+        std::vector<uint8_t> padded(alignUp(size, 4), 0);
+        std::memcpy(padded.data(), data, size);
+        mRegistry.writeBuffer(allocation.buffer, allocation.offset + offset, padded.data(), padded.size());
+    }
+
+    void BufferSuballocator::free(const Allocation &allocation)
+    {
+        if (!allocation.valid())
+            return;
+        std::lock_guard<std::mutex> lock(mMutex);
+        Block &block = mBlocks[allocation.block];
+        block.ranges.free(allocation.rangeStart, allocation.rangeSize);
+        --block.allocations;
+    }
+
+    wgpu::Buffer BufferSuballocator::buffer(const Allocation &allocation) const
+    {
+        return mRegistry.buffer(allocation.buffer);
+    }
+
+    void BufferSuballocator::accumulate(const Block &block, Statistics &statistics) const
+    {
+        ++statistics.blocks;
+        statistics.allocations += block.allocations;
+        statistics.reservedBytes += block.ranges.size();
+        statistics.usedBytes += block.ranges.size() - block.ranges.freeBytes();
+        statistics.largestFreeRange = std::max(statistics.largestFreeRange, block.ranges.largestFreeRange());
+        statistics.contiguousFreeBytes += block.ranges.largestFreeRange();
+        statistics.freeRanges += block.ranges.freeRangeCount();
+    }
+
+    BufferSuballocator::Statistics BufferSuballocator::statistics(WGPUBufferUsageFlags usage) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Statistics statistics;
+        for (const Block &block : mBlocks)
+        {
+            if (block.usage == usage)
+                accumulate(block, statistics);
+        }
+        return statistics;
+    }
+
+    BufferSuballocator::Statistics BufferSuballocator::statistics() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Statistics statistics;
+        for (const Block &block : mBlocks)
+        {
+            accumulate(block, statistics);
+        }
+        return statistics;
+    }
+
+    void BufferSuballocator::report(std::ostream &out) const
+    {
+        std::vector<WGPUBufferUsageFlags> usages;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (const Block &block : mBlocks)
+            {
+                if (std::find(usages.begin(), usages.end(), block.usage) == usages.end())
+                    usages.push_back(block.usage);
+            }
+        }
+        out << "buffer suballocator:" << std::endl;
+        for (WGPUBufferUsageFlags usage : usages)
+        {
+            Statistics statistics = this->statistics(usage);
+            out << "  usage 0x" << std::hex << usage << std::dec << ": " << statistics.allocations << " allocations in "
+                << statistics.blocks << " blocks, " << statistics.usedBytes << "/" << statistics.reservedBytes << " bytes ("
+                << std::fixed << std::setprecision(1) << statistics.occupancy() * 100.0 << "% occupied, "
+                << statistics.fragmentation() * 100.0 << "% fragmented, " << statistics.freeRanges << " free ranges)"
+                << std::defaultfloat << std::endl;
+        }
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "ResourceRegistry.h"
+
+namespace learn::webgpu
+{
+
+    // Free ranges of one block, handed out best fit. Ranges are indexed by offset, to merge
+    // a freed range with its neighbours, and by size, to find the smallest one that fits.
+    class RangeAllocator
+    {
+    public:
+        static constexpr uint64_t kInvalidOffset = ~uint64_t(0);
+
+        explicit RangeAllocator(uint64_t size);
+
+        // Returns the aligned offset, or kInvalidOffset. rangeStart and rangeSize receive the
+        // range actually taken, that is what free() wants back.
+        uint64_t allocate(uint64_t size, uint64_t alignment, uint64_t &rangeStart, uint64_t &rangeSize);
+        void free(uint64_t rangeStart, uint64_t rangeSize);
+
+        uint64_t size() const { return mSize; }
+        uint64_t freeBytes() const { return mFreeBytes; }
+        uint64_t largestFreeRange() const;
+        size_t freeRangeCount() const { return mFreeByOffset.size(); }
+
+    private:
+        void insertFree(uint64_t offset, uint64_t size);
+        void eraseFree(std::map<uint64_t, uint64_t>::iterator range);
+
+        uint64_t mSize;
+        uint64_t mFreeBytes;
+        std::map<uint64_t, uint64_t> mFreeByOffset;
+        std::multimap<uint64_t, uint64_t> mFreeBySize;
+    };
+
+    // Carves the small buffers of a scene (vertices, indices, uniforms...) out of a few big
+    // ones. Every mesh getting its own wgpu::Buffer means one driver allocation each, tens of
+    // thousands of them for a big scene, here they share blocks of a few megabytes instead.
+    //
+    // Blocks only hold allocations of one usage, e.g. Vertex | CopyDst, as a buffer's usage
+    // is fixed at creation. Blocks are registry buffers so they come back, with their
+    // content, after a device loss. An allocation bigger than a block gets a block of its own.
+    class BufferSuballocator
+    {
+    public:
+        struct Allocation
+        {
+            ResourceRegistry::Handle buffer = ResourceRegistry::kInvalidHandle;
+            uint32_t block = 0;
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            uint64_t rangeStart = 0;
+            uint64_t rangeSize = 0;
+
+            bool valid() const { return buffer != ResourceRegistry::kInvalidHandle; }
+        };
+
+        struct Statistics
+        {
+            uint32_t blocks = 0;
+            uint32_t allocations = 0;
+            uint64_t reservedBytes = 0;
+            uint64_t usedBytes = 0;
+            uint64_t largestFreeRange = 0;
+            // Sum of the largest free range of every block.
+            uint64_t contiguousFreeBytes = 0;
+            size_t freeRanges = 0;
+
+            // Share of the reserved bytes that are allocated.
+            double occupancy() const;
+            // 0 when each block's free space is in one range, close to 1 when it is scattered.
+            double fragmentation() const;
+        };
+
+        static constexpr uint64_t kDefaultBlockSize = 4 * 1024 * 1024;
+
+        explicit BufferSuballocator(ResourceRegistry &registry, uint64_t blockSize = kDefaultBlockSize);
+
+        BufferSuballocator(const BufferSuballocator &) = delete;
+        BufferSuballocator &operator=(const BufferSuballocator &) = delete;
+
+        // Only affects blocks created afterwards, e.g. to stay below the device's maxBufferSize.
+        void setBlockSize(uint64_t blockSize);
+
+        // The size is rounded up to 4 bytes for writeBuffer. alignment must be a power of two:
+        // 4 for vertices and indices, minUniformBufferOffsetAlignment for uniform bindings.
+        Allocation allocate(WGPUBufferUsageFlags usage, uint64_t size, uint64_t alignment = 4);
+        // allocate() and write() in one go.
+        Allocation upload(WGPUBufferUsageFlags usage, const void *data, uint64_t size, uint64_t alignment = 4);
+        void write(const Allocation &allocation, uint64_t offset, const void *data, uint64_t size);
+        // Blocks are kept once created, a freed range is reused by the next allocations.
+        void free(const Allocation &allocation);
+
+        wgpu::Buffer buffer(const Allocation &allocation) const;
+
+        Statistics statistics(WGPUBufferUsageFlags usage) const;
+        Statistics statistics() const;
+        void report(std::ostream &out) const;
+
+    private:
+        struct Block
+        {
+            WGPUBufferUsageFlags usage;
+            ResourceRegistry::Handle buffer;
+            RangeAllocator ranges;
+            uint32_t allocations = 0;
+        };
+
+        void accumulate(const Block &block, Statistics &statistics) const;
+
+        ResourceRegistry &mRegistry;
+        uint64_t mBlockSize;
+        mutable std::mutex mMutex;
+        std::vector<Block> mBlocks;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,47 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "FrameRing.h"
+
+namespace learn::webgpu
+{
+
+    FrameRing::FrameRing(GpuTimeline &timeline, uint32_t framesInFlight)
+        : mTimeline(timeline), mFramesInFlight(std::clamp(framesInFlight, 1u, kMaxFramesInFlight)), mSlot(mFramesInFlight - 1)
+    {
+    }
+
+    uint32_t FrameRing::beginFrame()
+    {
+        mSlot = (mSlot + 1) % mFramesInFlight;
+        ++mStatistics.frames;
+        if (!mTimeline.isComplete(mFences[mSlot]))
+        {
+            auto start = std::chrono::steady_clock::now();
+            mTimeline.wait(mFences[mSlot]);
+            ++mStatistics.waits;
+            mStatistics.waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        return mSlot;
+    }
+
+    void FrameRing::endFrame(GpuFence fence)
+    {
+        mFences[mSlot] = fence;
+    }
+
+    void FrameRing::reset()
+    {
+        mFences.fill(GpuFence{});
+    }
+
+    void FrameRing::report(std::ostream &out) const
+    {
+        out << "frames in flight: " << mFramesInFlight << ", " << mStatistics.waits << " of " << mStatistics.frames
+            << " frames waited for their slot, " << std::fixed << std::setprecision(2) << mStatistics.waitMs << " ms in total"
+            << std::defaultfloat << std::endl;
+    }
+} // namespace learn::webgpu
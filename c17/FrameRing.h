@@ -0,0 +1,63 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#include "GpuTimeline.h"
+
+namespace learn::webgpu
+{
+
+    // The frames the CPU may record while the GPU still executes the earlier ones. Each of
+    // them gets a slot holding the fence of its submit, and by its index a region of the
+    // uniform ring. A slot is only reused once its fence completed, so recording frame N+1
+    // never rewrites the uniforms frame N is still reading. The other per-frame data goes
+    // through queue.writeBuffer, which the queue already orders with the submits.
+    //
+    // With 2 frames in flight the CPU records one frame while the GPU draws the previous one,
+    // 3 also hides a frame that takes the GPU longer than usual, at the cost of a frame more
+    // of latency. 1 waits for every frame, nothing overlaps.
+    class FrameRing
+    {
+    public:
+        static constexpr uint32_t kMaxFramesInFlight = 3;
+
+        FrameRing(GpuTimeline &timeline, uint32_t framesInFlight);
+        FrameRing(const FrameRing &) = delete;
+        FrameRing &operator=(const FrameRing &) = delete;
+
+        // framesInFlight clamped to [1, kMaxFramesInFlight].
+        uint32_t framesInFlight() const { return mFramesInFlight; }
+
+        // Waits until the GPU is done with the frame that last used the next slot, then makes
+        // it the current one. Returns its index, below framesInFlight().
+        uint32_t beginFrame();
+        uint32_t slot() const { return mSlot; }
+        // fence is the submit of the current frame.
+        void endFrame(GpuFence fence);
+        // After a device loss: the fences are complete.
+        void reset();
+
+        struct Statistics
+        {
+            uint64_t frames = 0;
+            // Frames that found their slot still in use by the GPU.
+            uint64_t waits = 0;
+            double waitMs = 0.0;
+        };
+        const Statistics &statistics() const { return mStatistics; }
+        void report(std::ostream &out) const;
+
+    private:
+        GpuTimeline &mTimeline;
+        uint32_t mFramesInFlight = 1;
+        // The fence of each slot's last submit.
+        std::array<GpuFence, kMaxFramesInFlight> mFences{};
+        // Starts on the last slot, the first frame moves to slot 0.
+        uint32_t mSlot = 0;
+        Statistics mStatistics;
+    };
+} // namespace learn::webgpu
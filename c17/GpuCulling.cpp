@@ -0,0 +1,498 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "AsyncRequests.h"
+#include "CullingShader.h"
+#include "GpuCulling.h"
+#include "GpuHelpers.h"
+#include "GpuTimeline.h"
+#include "MappedUpload.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // The viewport in clip space, kViewMin and kViewMax in culling.wgsl.
+        constexpr float kViewMin = -1.0f;
+        constexpr float kViewMax = 1.0f;
+        // indexCount, instanceCount, firstIndex, baseVertex, firstInstance.
+        constexpr uint64_t kDrawArgsSize = 5 * sizeof(uint32_t);
+
+        bool isVisible(const CullObject &object)
+        {
+            return object.offset[0] + object.radius >= kViewMin && object.offset[1] + object.radius >= kViewMin &&
+                   object.offset[0] - object.radius <= kViewMax && object.offset[1] - object.radius <= kViewMax;
+        }
+
+        std::vector<wgpu::BindGroupLayoutEntry> cullLayoutEntries(uint64_t objectBytes)
+        {
+            std::vector<wgpu::BindGroupLayoutEntry> entries(3, wgpu::Default);
+            entries[0].binding = 0;
+            entries[0].visibility = wgpu::ShaderStage::Compute;
+            entries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+            entries[0].buffer.minBindingSize = 2 * sizeof(uint32_t);
+            entries[1].binding = 1;
+            entries[1].visibility = wgpu::ShaderStage::Compute;
+            entries[1].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+            entries[1].buffer.minBindingSize = objectBytes;
+            entries[2].binding = 2;
+            entries[2].visibility = wgpu::ShaderStage::Compute;
+            entries[2].buffer.type = wgpu::BufferBindingType::Storage;
+            // The count and at least one element of the runtime sized array.
+            entries[2].buffer.minBindingSize = 2 * sizeof(uint32_t);
+            return entries;
+        }
+
+        // The same buffers for the vertex stage, the visible list read only this time.
+        std::vector<wgpu::BindGroupLayoutEntry> drawLayoutEntries(uint64_t objectBytes)
+        {
+            std::vector<wgpu::BindGroupLayoutEntry> entries = cullLayoutEntries(objectBytes);
+            for (wgpu::BindGroupLayoutEntry &entry : entries)
+            {
+                entry.visibility = wgpu::ShaderStage::Vertex;
+            }
+            entries[2].binding = 3;
+            entries[2].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+            return entries;
+        }
+
+        wgpu::BindGroupLayout createLayout(wgpu::Device device, const char *label, const std::vector<wgpu::BindGroupLayoutEntry> &entries)
+        {
+            wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+            bindGroupLayoutDesc.label = label;
+            bindGroupLayoutDesc.entryCount = static_cast<uint32_t>(entries.size());
+            bindGroupLayoutDesc.entries = entries.data();
+            return device.createBindGroupLayout(bindGroupLayoutDesc);
+        }
+
+        wgpu::BindGroup createBindGroup(wgpu::Device device, const char *label, wgpu::BindGroupLayout layout,
+                                        const std::vector<wgpu::BindGroupLayoutEntry> &layoutEntries, const std::vector<wgpu::Buffer> &buffers)
+        {
+            std::vector<wgpu::BindGroupEntry> entries(layoutEntries.size(), wgpu::Default);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                entries[i].binding = layoutEntries[i].binding;
+                entries[i].buffer = buffers[i];
+                entries[i].offset = 0;
+                entries[i].size = buffers[i].getSize();
+            }
+            wgpu::BindGroupDescriptor bindGroupDesc;
+            bindGroupDesc.label = label;
+            bindGroupDesc.layout = layout;
+            bindGroupDesc.entryCount = static_cast<uint32_t>(entries.size());
+            bindGroupDesc.entries = entries.data();
+            return device.createBindGroup(bindGroupDesc);
+        }
+    } // namespace
+
+    std::vector<CullObject> scatterObjects(uint32_t count, float meshRadius)
+    {
+        // Drawn from a fixed seed with our own conversion to float, the standard
+        // distributions are not the same from one library to the next.
+        std::mt19937 random(1234);
+        auto unit = [&random]()
+        {
+            return static_cast<float>(random() >> 8) / 16777216.0f;
+        };
+        // Spread out so the objects cover about a quarter of the area.
+        float radius = 0.75f / std::sqrt(static_cast<float>(std::max(count, 1u)));
+        std::vector<CullObject> objects(count);
+        for (CullObject &object : objects)
+        {
+            object.offset[0] = -1.5f + 3.0f * unit();
+            object.offset[1] = -1.5f + 3.0f * unit();
+            object.radius = radius * (0.5f + 0.5f * unit());
+            object.scale = object.radius / std::max(meshRadius, 1e-6f);
+        }
+        return objects;
+    }
+
+    void GpuCulling::describeResources(LimitsNegotiator &negotiator, uint32_t objectCount)
+    {
+        uint64_t objectBytes = uint64_t(objectCount) * sizeof(CullObject);
+        negotiator.addBindGroupLayout(cullLayoutEntries(objectBytes));
+        negotiator.addBindGroupLayout(drawLayoutEntries(objectBytes));
+        negotiator.addBuffer(objectBytes);
+    }
+
+    bool GpuCulling::create(wgpu::Device device, wgpu::Queue queue, const std::string &shaderSource, const VertexLayout &vertexLayout,
+                            wgpu::TextureFormat targetFormat, const CulledMesh &mesh, const std::vector<CullObject> &objects)
+    {
+        release();
+        if (objects.empty() || mesh.indexChunks.empty())
+        {
+            return false;
+        }
+        mQueue = queue;
+        mMesh = mesh;
+        mObjects = objects;
+        const uint64_t objectBytes = mObjects.size() * sizeof(CullObject);
+
+        // time and objectCount, padded to the 16 bytes of a uniform block.
+        uint32_t params[4] = {0, objectCount(), 0, 0};
+        mParamsBuffer = createMappedBuffer(device, "Culling params", wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst, sizeof(params),
+                                           [&](void *data, uint64_t size)
+                                           { std::memcpy(data, params, size); });
+        mObjectBuffer = createMappedBuffer(device, "Culling objects", wgpu::BufferUsage::Storage, objectBytes,
+                                           [&](void *data, uint64_t size)
+                                           { std::memcpy(data, mObjects.data(), size); });
+        wgpu::BufferDescriptor visibleDesc;
+        visibleDesc.label = "Visible objects";
+        visibleDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst;
+        visibleDesc.size = sizeof(uint32_t) * (1 + mObjects.size());
+        visibleDesc.mappedAtCreation = false;
+        mVisibleBuffer = device.createBuffer(visibleDesc);
+        // The instance counts are copied in by cull(), the rest never changes.
+        mArgsBuffer = createMappedBuffer(device, "Indirect draw arguments", wgpu::BufferUsage::Indirect | wgpu::BufferUsage::CopyDst,
+                                         kDrawArgsSize * mMesh.indexChunks.size(),
+                                         [&](void *data, uint64_t /* size */)
+                                         {
+                                             uint32_t *args = static_cast<uint32_t *>(data);
+                                             for (const CulledMesh::Chunk &chunk : mMesh.indexChunks)
+                                             {
+                                                 args[0] = chunk.indexCount;
+                                                 args[1] = 0;
+                                                 args[2] = 0;
+                                                 args[3] = static_cast<uint32_t>(chunk.baseVertex);
+                                                 args[4] = 0;
+                                                 args += 5;
+                                             }
+                                         });
+
+        std::vector<wgpu::BindGroupLayoutEntry> cullEntries = cullLayoutEntries(objectBytes);
+        std::vector<wgpu::BindGroupLayoutEntry> drawEntries = drawLayoutEntries(objectBytes);
+        mCullLayout = createLayout(device, "Culling layout", cullEntries);
+        mDrawLayout = createLayout(device, "Culled draw layout", drawEntries);
+        mCullBindGroup = createBindGroup(device, "Culling bind group", mCullLayout, cullEntries, {mParamsBuffer, mObjectBuffer, mVisibleBuffer});
+        mDrawBindGroup = createBindGroup(device, "Culled draw bind group", mDrawLayout, drawEntries, {mParamsBuffer, mObjectBuffer, mVisibleBuffer});
+
+        // A layout the shader doesn't agree with gives error pipelines, not null ones, so
+        // the scope is what tells us setup failed.
+        device.pushErrorScope(wgpu::ErrorFilter::Validation);
+        wgpu::ShaderModule shaderModule = createWgslModule(device, "culling shader module", shaderSource);
+
+        wgpu::PipelineLayoutDescriptor layoutDesc{};
+        layoutDesc.bindGroupLayoutCount = 1;
+        layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&mCullLayout;
+        wgpu::PipelineLayout cullLayout = device.createPipelineLayout(layoutDesc);
+        wgpu::ComputePipelineDescriptor computeDesc;
+        computeDesc.label = "cs_cull";
+        computeDesc.layout = cullLayout;
+        computeDesc.compute.module = shaderModule;
+        computeDesc.compute.entryPoint = "cs_cull";
+        computeDesc.compute.constantCount = 0;
+        computeDesc.compute.constants = nullptr;
+        mCullPipeline = device.createComputePipeline(computeDesc);
+        cullLayout.release();
+
+        layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&mDrawLayout;
+        wgpu::PipelineLayout drawLayout = device.createPipelineLayout(layoutDesc);
+        mCulledPipeline = createBlendedPipeline(device, "vs_culled", shaderModule, "vs_culled", drawLayout, vertexLayout.bufferLayouts(), targetFormat);
+        mDirectPipeline = createBlendedPipeline(device, "vs_direct", shaderModule, "vs_direct", drawLayout, vertexLayout.bufferLayouts(), targetFormat);
+        drawLayout.release();
+        shaderModule.release();
+        std::string error;
+        if (popErrorScope(device, error))
+        {
+            std::cout << "culling pipelines: " << error << std::endl;
+            release();
+            return false;
+        }
+        return valid();
+    }
+
+    void GpuCulling::release()
+    {
+        releaseObject(mCulledPipeline);
+        releaseObject(mDirectPipeline);
+        releaseObject(mCullPipeline);
+        releaseObject(mCullBindGroup);
+        releaseObject(mDrawBindGroup);
+        releaseObject(mCullLayout);
+        releaseObject(mDrawLayout);
+        releaseBuffer(mParamsBuffer);
+        releaseBuffer(mObjectBuffer);
+        releaseBuffer(mVisibleBuffer);
+        releaseBuffer(mArgsBuffer);
+        mMesh = CulledMesh{};
+        mObjects.clear();
+        mQueue = nullptr;
+    }
+
+    void GpuCulling::cull(wgpu::CommandEncoder encoder)
+    {
+        // The count starts over, the list behind it is simply overwritten.
+        encoder.clearBuffer(mVisibleBuffer, 0, sizeof(uint32_t));
+
+        wgpu::ComputePassDescriptor computePassDesc;
+        computePassDesc.label = "Culling pass";
+        computePassDesc.timestampWrites = nullptr;
+        wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+        computePass.setPipeline(mCullPipeline);
+        computePass.setBindGroup(0, mCullBindGroup, 0, nullptr);
+        // A dimension holds at most 65535 workgroups, a million objects need rows of them.
+        uint32_t groups = (objectCount() + kWorkgroupSize - 1) / kWorkgroupSize;
+        uint32_t groupsX = std::min(groups, 65535u);
+        uint32_t groupsY = (groups + groupsX - 1) / groupsX;
+        computePass.dispatchWorkgroups(groupsX, groupsY, 1);
+        computePass.end();
+        computePass.release();
+
+        // The count becomes the instance count of every chunk's draw.
+        for (size_t i = 0; i < mMesh.indexChunks.size(); ++i)
+        {
+            encoder.copyBufferToBuffer(mVisibleBuffer, 0, mArgsBuffer, i * kDrawArgsSize + sizeof(uint32_t), sizeof(uint32_t));
+        }
+    }
+
+    void GpuCulling::setTime(float time)
+    {
+        // Written before the commands of this frame run, like the triangle's uniform ring.
+        mQueue.writeBuffer(mParamsBuffer, 0, &time, sizeof(float));
+    }
+
+    template <typename Encoder>
+    void GpuCulling::bindMesh(Encoder encoder, wgpu::RenderPipeline pipeline) const
+    {
+        encoder.setPipeline(pipeline);
+        encoder.setBindGroup(0, mDrawBindGroup, 0, nullptr);
+        for (uint32_t slot = 0; slot < mMesh.vertexStreams.size(); ++slot)
+        {
+            const CulledMesh::Stream &stream = mMesh.vertexStreams[slot];
+            encoder.setVertexBuffer(slot, stream.buffer, stream.offset, stream.size);
+        }
+    }
+
+    void GpuCulling::drawIndirect(wgpu::RenderPassEncoder renderPass, float time)
+    {
+        setTime(time);
+        bindMesh(renderPass, mCulledPipeline);
+        for (size_t i = 0; i < mMesh.indexChunks.size(); ++i)
+        {
+            const CulledMesh::Chunk &chunk = mMesh.indexChunks[i];
+            renderPass.setIndexBuffer(chunk.buffer, mMesh.indexFormat, chunk.offset, chunk.size);
+            renderPass.drawIndexedIndirect(mArgsBuffer, i * kDrawArgsSize);
+        }
+    }
+
+    template <typename Encoder>
+    uint32_t GpuCulling::drawDirect(Encoder encoder, float time)
+    {
+        setTime(time);
+        return drawObjects(encoder, 0, objectCount());
+    }
+
+    template <typename Encoder>
+    uint32_t GpuCulling::drawObjects(Encoder encoder, uint32_t first, uint32_t last) const
+    {
+        bindMesh(encoder, mDirectPipeline);
+        uint32_t drawn = 0;
+        for (const CulledMesh::Chunk &chunk : mMesh.indexChunks)
+        {
+            encoder.setIndexBuffer(chunk.buffer, mMesh.indexFormat, chunk.offset, chunk.size);
+            drawn = 0;
+            for (uint32_t i = first; i < std::min(last, objectCount()); ++i)
+            {
+                if (isVisible(mObjects[i]))
+                {
+                    // The instance index is the object, vs_direct reads it from the buffer.
+                    encoder.drawIndexed(chunk.indexCount, 1, 0, chunk.baseVertex, i);
+                    ++drawn;
+                }
+            }
+        }
+        return drawn;
+    }
+
+    template uint32_t GpuCulling::drawDirect(wgpu::RenderPassEncoder encoder, float time);
+    template uint32_t GpuCulling::drawDirect(wgpu::RenderBundleEncoder encoder, float time);
+    template uint32_t GpuCulling::drawObjects(wgpu::RenderPassEncoder encoder, uint32_t first, uint32_t last) const;
+    template uint32_t GpuCulling::drawObjects(wgpu::RenderBundleEncoder encoder, uint32_t first, uint32_t last) const;
+
+    BenchmarkScene createBenchmarkScene(wgpu::Device device)
+    {
+        BenchmarkScene scene;
+        // A quad with the attributes of the triangle shader, packed the way the App does.
+        const std::vector<float> positions = {-1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f};
+        const std::vector<float> colors = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+        const uint16_t indices[6] = {0, 1, 2, 0, 2, 3};
+        VertexAttributeDesc position;
+        position.name = "position";
+        position.location = 0;
+        position.components = 2;
+        position.measure(positions.data(), positions.size());
+        position.tolerance = 1e-4f;
+        VertexAttributeDesc color;
+        color.name = "color";
+        color.location = 1;
+        color.components = 3;
+        color.measure(colors.data(), colors.size());
+        color.tolerance = 1.0f / 255.0f;
+        scene.vertexLayout = VertexLayout({position, color}, VertexLayoutOptions{});
+        scene.meshRadius = std::sqrt(2.0f);
+        std::vector<std::vector<uint8_t>> streams = scene.vertexLayout.pack({positions.data(), colors.data()}, 4);
+
+        for (const std::vector<uint8_t> &stream : streams)
+        {
+            CulledMesh::Stream meshStream;
+            // Mapped ranges are multiples of 4 bytes.
+            meshStream.size = (stream.size() + 3) & ~uint64_t(3);
+            meshStream.buffer = createMappedBuffer(device, "Quad vertices", wgpu::BufferUsage::Vertex, meshStream.size,
+                                                   [&](void *data, uint64_t size)
+                                                   {
+                                                       std::memset(data, 0, size);
+                                                       std::memcpy(data, stream.data(), stream.size());
+                                                   });
+            scene.mesh.vertexStreams.push_back(meshStream);
+        }
+        CulledMesh::Chunk chunk;
+        chunk.size = sizeof(indices);
+        chunk.indexCount = 6;
+        chunk.buffer = createMappedBuffer(device, "Quad indices", wgpu::BufferUsage::Index, chunk.size,
+                                          [&](void *data, uint64_t size)
+                                          { std::memcpy(data, indices, size); });
+        scene.mesh.indexChunks.push_back(chunk);
+        scene.mesh.indexFormat = wgpu::IndexFormat::Uint16;
+
+        wgpu::TextureDescriptor textureDesc;
+        textureDesc.label = "Benchmark target";
+        textureDesc.dimension = wgpu::TextureDimension::_2D;
+        textureDesc.size.width = 512;
+        textureDesc.size.height = 512;
+        textureDesc.size.depthOrArrayLayers = 1;
+        textureDesc.format = scene.targetFormat;
+        textureDesc.usage = wgpu::TextureUsage::RenderAttachment;
+        textureDesc.mipLevelCount = 1;
+        textureDesc.sampleCount = 1;
+        textureDesc.viewFormatCount = 0;
+        textureDesc.viewFormats = nullptr;
+        scene.target = device.createTexture(textureDesc);
+        wgpu::TextureViewDescriptor viewDesc;
+        viewDesc.label = "Benchmark target view";
+        viewDesc.format = scene.targetFormat;
+        viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+        viewDesc.baseMipLevel = 0;
+        viewDesc.mipLevelCount = 1;
+        viewDesc.baseArrayLayer = 0;
+        viewDesc.arrayLayerCount = 1;
+        viewDesc.aspect = wgpu::TextureAspect::All;
+        scene.targetView = scene.target.createView(viewDesc);
+        return scene;
+    }
+
+    wgpu::RenderPassEncoder BenchmarkScene::beginPass(wgpu::CommandEncoder encoder, wgpu::LoadOp loadOp) const
+    {
+        wgpu::RenderPassColorAttachment colorAttachment = {};
+        colorAttachment.view = targetView;
+        colorAttachment.resolveTarget = nullptr;
+        colorAttachment.loadOp = loadOp;
+        colorAttachment.storeOp = wgpu::StoreOp::Store;
+        colorAttachment.clearValue = wgpu::Color{0.05, 0.05, 0.05, 1.0};
+        wgpu::RenderPassDescriptor renderPassDesc = {};
+        renderPassDesc.colorAttachmentCount = 1;
+        renderPassDesc.colorAttachments = &colorAttachment;
+        renderPassDesc.depthStencilAttachment = nullptr;
+        renderPassDesc.timestampWrites = nullptr;
+        return encoder.beginRenderPass(renderPassDesc);
+    }
+
+    void BenchmarkScene::release()
+    {
+        if (targetView)
+        {
+            targetView.release();
+            target.destroy();
+            target.release();
+            targetView = nullptr;
+            target = nullptr;
+        }
+        for (CulledMesh::Stream &stream : mesh.vertexStreams)
+        {
+            releaseBuffer(stream.buffer);
+        }
+        for (CulledMesh::Chunk &chunk : mesh.indexChunks)
+        {
+            releaseBuffer(chunk.buffer);
+        }
+    }
+
+    void benchmarkIndirectDraws(wgpu::Device device, wgpu::Queue queue, std::ostream &out)
+    {
+        BenchmarkScene scene = createBenchmarkScene(device);
+        const std::string shaderSource = scene.vertexLayout.applyToWgsl(shaders::kCullingWgsl);
+        GpuTimeline timeline(device, queue);
+        out << "objects   path        visible   encode ms/frame   wall ms/frame" << std::endl;
+        for (uint32_t count : {1000u, 100000u, 1000000u})
+        {
+            GpuCulling culling;
+            if (!culling.create(device, queue, shaderSource, scene.vertexLayout, scene.targetFormat, scene.mesh, scatterObjects(count, scene.meshRadius)))
+            {
+                out << "culling setup failed" << std::endl;
+                break;
+            }
+            // Fewer frames for a million CPU draws, they take a while.
+            const int frames = count >= 1000000 ? 10 : 100;
+            for (int path = 0; path < 2; ++path)
+            {
+                const bool gpuDriven = path == 1;
+                uint32_t visible = 0;
+                double encodeMs = 0.0;
+                GpuFence fence;
+                // One frame more than timed, the first one pays for the pipeline warm up.
+                auto start = std::chrono::steady_clock::now();
+                for (int frame = -1; frame < frames; ++frame)
+                {
+                    if (frame == 0)
+                    {
+                        timeline.wait(fence);
+                        encodeMs = 0.0;
+                        start = std::chrono::steady_clock::now();
+                    }
+                    auto encodeStart = std::chrono::steady_clock::now();
+                    wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                    if (gpuDriven)
+                    {
+                        culling.cull(encoder);
+                    }
+                    wgpu::RenderPassEncoder renderPass = scene.beginPass(encoder);
+                    float time = static_cast<float>(frame) / 60.0f;
+                    if (gpuDriven)
+                    {
+                        culling.drawIndirect(renderPass, time);
+                    }
+                    else
+                    {
+                        visible = culling.drawDirect(renderPass, time);
+                    }
+                    renderPass.end();
+                    renderPass.release();
+                    wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                    encoder.release();
+                    fence = timeline.submit(command);
+                    command.release();
+                    encodeMs += elapsedMs(encodeStart);
+                }
+                timeline.wait(fence);
+                double wallMs = elapsedMs(start);
+                out << std::left << std::setw(10) << count << std::setw(12) << (gpuDriven ? "gpu culled" : "cpu draws") << std::right
+                    << std::setw(7);
+                if (gpuDriven)
+                    out << "-";
+                else
+                    out << visible;
+                out << std::fixed << std::setprecision(3) << std::setw(18) << encodeMs / frames << std::setw(16) << wallMs / frames
+                    << std::defaultfloat << std::endl;
+            }
+        }
+        out << "(encode is the CPU time to record and submit a frame, wall includes the GPU)" << std::endl;
+        scene.release();
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "LimitsNegotiator.h"
+#include "VertexLayout.h"
+
+namespace learn::webgpu
+{
+
+    // One copy of the mesh in the scene, moved by offset and scaled by scale. radius is the
+    // bounding circle of the copy around offset, the culling only looks at that.
+    struct CullObject
+    {
+        float offset[2];
+        float scale;
+        float radius;
+    };
+    static_assert(sizeof(CullObject) == 16, "matches struct CullObject in culling.wgsl");
+
+    // count objects scattered over [-1.5, 1.5], so more than half of them are off screen.
+    // meshRadius is the bounding radius of the mesh. The same count gives the same scene.
+    std::vector<CullObject> scatterObjects(uint32_t count, float meshRadius);
+
+    // The mesh every object draws, ranges of buffers owned by someone else.
+    struct CulledMesh
+    {
+        struct Stream
+        {
+            wgpu::Buffer buffer = nullptr;
+            uint64_t offset = 0;
+            uint64_t size = 0;
+        };
+        struct Chunk
+        {
+            wgpu::Buffer buffer = nullptr;
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            uint32_t indexCount = 0;
+            int32_t baseVertex = 0;
+        };
+        // One per vertex buffer slot.
+        std::vector<Stream> vertexStreams;
+        std::vector<Chunk> indexChunks;
+        wgpu::IndexFormat indexFormat = wgpu::IndexFormat::Uint16;
+    };
+
+    // Draws a scene of many objects without the CPU looking at them. The objects are in a
+    // storage buffer, a compute pass tests them against the viewport and appends the visible
+    // ones to a list, then its length becomes the instance count of one drawIndexedIndirect
+    // per index chunk. The vertex shader finds the object of an instance in that list.
+    //
+    // Recording a frame is the same handful of commands for a thousand or a million objects.
+    // drawDirect() is the usual alternative for comparison: a test and a drawIndexed per
+    // object on the CPU.
+    //
+    // The order of the visible list depends on the GPU scheduling, so overlapping objects
+    // may not be drawn in the same order from one frame to the next.
+    class GpuCulling
+    {
+    public:
+        static constexpr uint32_t kWorkgroupSize = 64;
+
+        GpuCulling() = default;
+        ~GpuCulling() { release(); }
+        GpuCulling(const GpuCulling &) = delete;
+        GpuCulling &operator=(const GpuCulling &) = delete;
+
+        // The bind group of the culling pass and of the draws, for objectCount objects.
+        static void describeResources(LimitsNegotiator &negotiator, uint32_t objectCount);
+
+        // shaderSource is shaders/culling.wgsl with the VertexInput of vertexLayout, see
+        // VertexLayout::applyToWgsl. Call again after a device loss.
+        bool create(wgpu::Device device, wgpu::Queue queue, const std::string &shaderSource, const VertexLayout &vertexLayout,
+                    wgpu::TextureFormat targetFormat, const CulledMesh &mesh, const std::vector<CullObject> &objects);
+        void release();
+        bool valid() const { return mCullPipeline != nullptr; }
+        uint32_t objectCount() const { return static_cast<uint32_t>(mObjects.size()); }
+
+        // Records the culling compute pass, before the render pass that draws.
+        void cull(wgpu::CommandEncoder encoder);
+        // One indirect draw per index chunk, whatever the number of objects.
+        void drawIndirect(wgpu::RenderPassEncoder renderPass, float time);
+        // Tests every object on the CPU and draws the visible ones one by one. Returns how
+        // many objects were drawn. Encoder is a RenderPassEncoder or a RenderBundleEncoder.
+        template <typename Encoder>
+        uint32_t drawDirect(Encoder encoder, float time);
+        // drawDirect() in pieces: setTime() once, then drawObjects() for ranges of objects
+        // [first, last). Only drawObjects() may run on several threads at once.
+        void setTime(float time);
+        template <typename Encoder>
+        uint32_t drawObjects(Encoder encoder, uint32_t first, uint32_t last) const;
+
+    private:
+        template <typename Encoder>
+        void bindMesh(Encoder encoder, wgpu::RenderPipeline pipeline) const;
+
+        wgpu::Queue mQueue = nullptr;
+        CulledMesh mMesh;
+        std::vector<CullObject> mObjects;
+        wgpu::Buffer mParamsBuffer = nullptr;
+        wgpu::Buffer mObjectBuffer = nullptr;
+        // The count of visible objects, then their indices.
+        wgpu::Buffer mVisibleBuffer = nullptr;
+        // DrawIndexedIndirect arguments, one set per index chunk.
+        wgpu::Buffer mArgsBuffer = nullptr;
+        wgpu::BindGroupLayout mCullLayout = nullptr;
+        wgpu::BindGroupLayout mDrawLayout = nullptr;
+        wgpu::BindGroup mCullBindGroup = nullptr;
+        wgpu::BindGroup mDrawBindGroup = nullptr;
+        wgpu::ComputePipeline mCullPipeline = nullptr;
+        wgpu::RenderPipeline mCulledPipeline = nullptr;
+        wgpu::RenderPipeline mDirectPipeline = nullptr;
+    };
+
+    // What the draw benchmarks render: a quad with the attributes of the triangle shader, and
+    // an offscreen target to draw it on.
+    struct BenchmarkScene
+    {
+        VertexLayout vertexLayout;
+        CulledMesh mesh;
+        float meshRadius = 0.0f;
+        wgpu::TextureFormat targetFormat = wgpu::TextureFormat::RGBA8Unorm;
+        wgpu::Texture target = nullptr;
+        wgpu::TextureView targetView = nullptr;
+
+        // A render pass that clears the target, or draws over it with LoadOp::Load.
+        wgpu::RenderPassEncoder beginPass(wgpu::CommandEncoder encoder, wgpu::LoadOp loadOp = wgpu::LoadOp::Clear) const;
+        void release();
+    };
+    BenchmarkScene createBenchmarkScene(wgpu::Device device);
+
+    // Draws 1k, 100k and 1M objects with CPU-issued draws and with the GPU culling, and
+    // prints the CPU time spent recording and submitting a frame next to the frame time.
+    void benchmarkIndirectDraws(wgpu::Device device, wgpu::Queue queue, std::ostream &out);
+} // namespace learn::webgpu
@@ -0,0 +1,78 @@
+#include <webgpu/webgpu.hpp>
+
+#include "GpuHelpers.h"
+
+namespace learn::webgpu
+{
+
+    wgpu::ShaderModule createWgslModule(wgpu::Device device, const char *label, const std::string &wgsl)
+    {
+        wgpu::ShaderModuleDescriptor shaderModuleDesc = {};
+        shaderModuleDesc.label = label;
+#ifdef WEBGPU_BACKEND_WGPU
+        shaderModuleDesc.hintCount = 0;
+        shaderModuleDesc.hints = nullptr;
+#endif
+        wgpu::ShaderModuleWGSLDescriptor shaderCodeDesc;
+        shaderCodeDesc.chain.next = nullptr;
+        shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
+        shaderCodeDesc.code = wgsl.c_str();
+        shaderModuleDesc.nextInChain = &shaderCodeDesc.chain;
+        return device.createShaderModule(shaderModuleDesc);
+    }
+
+    wgpu::RenderPipeline createBlendedPipeline(wgpu::Device device, const char *label, wgpu::ShaderModule shaderModule, const char *vertexEntryPoint,
+                                               wgpu::PipelineLayout layout, const std::vector<wgpu::VertexBufferLayout> &vertexBuffers,
+                                               wgpu::TextureFormat targetFormat)
+    {
+        wgpu::RenderPipelineDescriptor pipelineDesc;
+        pipelineDesc.label = label;
+        pipelineDesc.layout = layout;
+        pipelineDesc.vertex.bufferCount = static_cast<uint32_t>(vertexBuffers.size());
+        pipelineDesc.vertex.buffers = vertexBuffers.data();
+        pipelineDesc.vertex.module = shaderModule;
+        pipelineDesc.vertex.entryPoint = vertexEntryPoint;
+        pipelineDesc.vertex.constantCount = 0;
+        pipelineDesc.vertex.constants = nullptr;
+        pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+        pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+        pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+        pipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+
+        wgpu::BlendState blendState;
+        blendState.color.srcFactor = wgpu::BlendFactor::SrcAlpha;
+        blendState.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+        blendState.color.operation = wgpu::BlendOperation::Add;
+        blendState.alpha.srcFactor = wgpu::BlendFactor::Zero;
+        blendState.alpha.dstFactor = wgpu::BlendFactor::One;
+        blendState.alpha.operation = wgpu::BlendOperation::Add;
+        wgpu::ColorTargetState colorTargetState;
+        colorTargetState.format = targetFormat;
+        colorTargetState.blend = &blendState;
+        colorTargetState.writeMask = wgpu::ColorWriteMask::All;
+        wgpu::FragmentState fragmentState;
+        fragmentState.module = shaderModule;
+        fragmentState.entryPoint = "fs_main";
+        fragmentState.constantCount = 0;
+        fragmentState.constants = nullptr;
+        fragmentState.targetCount = 1;
+        fragmentState.targets = &colorTargetState;
+
+        pipelineDesc.fragment = &fragmentState;
+        pipelineDesc.multisample.count = 1;
+        pipelineDesc.multisample.mask = ~0u;
+        pipelineDesc.multisample.alphaToCoverageEnabled = false;
+        pipelineDesc.depthStencil = nullptr;
+        return device.createRenderPipeline(pipelineDesc);
+    }
+
+    void releaseBuffer(wgpu::Buffer &buffer)
+    {
+        if (buffer)
+        {
+            buffer.destroy();
+            buffer.release();
+            buffer = nullptr;
+        }
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Small pieces the modules that own their GPU objects (culling, instancing, the
+    // benchmarks) would otherwise each write again.
+
+    // A shader module straight from WGSL, without the pipeline cache of the application.
+    wgpu::ShaderModule createWgslModule(wgpu::Device device, const char *label, const std::string &wgsl);
+
+    // The state of the triangle pipeline for another vertex entry point and vertex buffers:
+    // a triangle list without culling, fs_main alpha blended into one targetFormat target.
+    wgpu::RenderPipeline createBlendedPipeline(wgpu::Device device, const char *label, wgpu::ShaderModule shaderModule, const char *vertexEntryPoint,
+                                               wgpu::PipelineLayout layout, const std::vector<wgpu::VertexBufferLayout> &vertexBuffers,
+                                               wgpu::TextureFormat targetFormat);
+
+    // Destroys and releases the buffer if there is one, it is null afterwards.
+    void releaseBuffer(wgpu::Buffer &buffer);
+
+    // Releases any other handle if there is one, it is null afterwards.
+    template <typename T>
+    void releaseObject(T &object)
+    {
+        if (object)
+        {
+            object.release();
+            object = nullptr;
+        }
+    }
+
+    // Milliseconds of wall clock since start.
+    inline double elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace learn::webgpu
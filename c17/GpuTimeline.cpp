@@ -0,0 +1,145 @@
+#include <webgpu/webgpu.hpp>
+#ifdef WEBGPU_BACKEND_WGPU
+#  include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+#include <algorithm>
+#include <thread>
+
+#include "AsyncRequests.h"
+#include "GpuTimeline.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        struct Signal
+        {
+            std::shared_ptr<std::atomic<uint64_t>> completed;
+            uint64_t serial = 0;
+        };
+
+        // Also called when the device is lost: the work won't ever run, and nobody should
+        // wait for it, so the fence counts as complete anyway.
+        void onWorkDone(WGPUQueueWorkDoneStatus /* status */, void *pUserData)
+        {
+            Signal *signal = reinterpret_cast<Signal *>(pUserData);
+            uint64_t completed = signal->completed->load();
+            // The queue finishes in order, but let's never move backwards.
+            while (completed < signal->serial && !signal->completed->compare_exchange_weak(completed, signal->serial))
+            {
+            }
+            delete signal;
+        }
+    } // namespace
+
+    void GpuTimeline::reset(wgpu::Device device, wgpu::Queue queue)
+    {
+        mDevice = device;
+        mQueue = queue;
+        mCompleted = std::make_shared<std::atomic<uint64_t>>(mSubmitted);
+#if defined(WEBGPU_BACKEND_WGPU)
+        mSubmissions.clear();
+#endif // WEBGPU_BACKEND_WGPU
+    }
+
+    GpuFence GpuTimeline::enqueueSignal()
+    {
+        Signal *signal = new Signal{mCompleted, ++mSubmitted};
+        wgpuQueueOnSubmittedWorkDone(mQueue, onWorkDone, signal);
+        return GpuFence{signal->serial};
+    }
+
+    GpuFence GpuTimeline::submit(wgpu::CommandBuffer command)
+    {
+        return submitCommands(1, &command);
+    }
+
+    GpuFence GpuTimeline::submit(const std::vector<wgpu::CommandBuffer> &commands)
+    {
+        return submitCommands(commands.size(), commands.data());
+    }
+
+    GpuFence GpuTimeline::submitCommands(size_t count, const wgpu::CommandBuffer *commands)
+    {
+        // The wrappers hold nothing but the handle, an array of them is an array of handles.
+#if defined(WEBGPU_BACKEND_WGPU)
+        WGPUSubmissionIndex index = wgpuQueueSubmitForIndex(mQueue, count, (const WGPUCommandBuffer *)commands);
+        GpuFence fence = enqueueSignal();
+        mSubmissions.push_back(Submission{fence.serial, index});
+        return fence;
+#else
+        wgpuQueueSubmit(mQueue, count, (const WGPUCommandBuffer *)commands);
+        return enqueueSignal();
+#endif
+    }
+
+    GpuFence GpuTimeline::signal()
+    {
+        return enqueueSignal();
+    }
+
+    void GpuTimeline::processEvents(GpuFence fence, bool wait)
+    {
+#if defined(WEBGPU_BACKEND_WGPU)
+        uint64_t completed = mCompleted->load();
+        while (!mSubmissions.empty() && mSubmissions.front().serial <= completed)
+        {
+            mSubmissions.pop_front();
+        }
+        // The first submit at or after the fence, a signal() fence may fall between two.
+        auto submission = std::find_if(mSubmissions.begin(), mSubmissions.end(), [fence](const Submission &s)
+                                       { return s.serial >= fence.serial; });
+        if (wait && submission != mSubmissions.end() && submission->serial == fence.serial)
+        {
+            WGPUWrappedSubmissionIndex wrappedIndex = {mQueue, submission->index};
+            wgpuDevicePoll(mDevice, true, &wrappedIndex);
+        }
+        else
+        {
+            wgpuDevicePoll(mDevice, wait, nullptr);
+        }
+#else
+        (void)fence;
+        processDeviceEvents(mDevice, wait);
+#endif
+    }
+
+    bool GpuTimeline::isComplete(GpuFence fence)
+    {
+        if (!mCompleted || fence.serial <= mCompleted->load())
+        {
+            return true;
+        }
+        processEvents(fence, false);
+        return fence.serial <= mCompleted->load();
+    }
+
+    bool GpuTimeline::wait(GpuFence fence, std::chrono::microseconds timeout)
+    {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        [[maybe_unused]] std::chrono::microseconds pause(50);
+        while (!isComplete(fence))
+        {
+            if (timeout == kForever)
+            {
+                processEvents(fence, true);
+                continue;
+            }
+            auto waited = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+            if (waited >= timeout)
+            {
+                return false;
+            }
+#if defined(__EMSCRIPTEN__)
+            processEvents(fence, true);
+#else
+            std::this_thread::sleep_for(std::min(pause, timeout - waited));
+            pause = std::min(pause * 2, std::chrono::microseconds(1000));
+#endif
+        }
+        return true;
+    }
+} // namespace learn::webgpu
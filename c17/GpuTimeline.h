@@ -0,0 +1,82 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Stands for a point on the queue: it completes once the GPU has executed everything
+    // submitted up to the submit that returned it.
+    struct GpuFence
+    {
+        uint64_t serial = 0;
+
+        // A default fence stands for nothing and is always complete.
+        bool valid() const { return serial != 0; }
+    };
+
+    // Numbers every submit and learns when the GPU is done with it through
+    // onSubmittedWorkDone, the one completion signal every backend has. Instead of polling
+    // the device and sleeping for a while, code that recycles resources or paces frames asks
+    // whether a fence completed, or waits for it.
+    //
+    // The callbacks only fire while the device processes its events, isComplete() and
+    // wait() take care of that. They are meant for the thread that submits.
+    class GpuTimeline
+    {
+    public:
+        static constexpr std::chrono::microseconds kForever = std::chrono::microseconds::max();
+
+        GpuTimeline() = default;
+        GpuTimeline(wgpu::Device device, wgpu::Queue queue) { reset(device, queue); }
+
+        // Starts over on a new device, after a device loss. Fences of the old device count as
+        // complete: whatever they were guarding went away with it.
+        void reset(wgpu::Device device, wgpu::Queue queue);
+
+        // Submits command and returns its fence.
+        GpuFence submit(wgpu::CommandBuffer command);
+        // Submits commands in their order with a single submit, one fence for all of them.
+        GpuFence submit(const std::vector<wgpu::CommandBuffer> &commands);
+        // A fence for everything queued so far, queue.writeBuffer included, without submitting.
+        GpuFence signal();
+
+        // Doesn't block: lets the device fire its callbacks and checks.
+        bool isComplete(GpuFence fence);
+        // Blocks until fence completes or timeout runs out, returns false on timeout.
+        // Without a timeout wgpu waits inside the driver for exactly that submit, otherwise
+        // we poll with sleeps that grow up to a millisecond.
+        bool wait(GpuFence fence, std::chrono::microseconds timeout = kForever);
+
+        GpuFence lastSubmitted() const { return GpuFence{mSubmitted}; }
+        GpuFence lastCompleted() const { return GpuFence{mCompleted ? mCompleted->load() : mSubmitted}; }
+
+    private:
+        GpuFence enqueueSignal();
+        GpuFence submitCommands(size_t count, const wgpu::CommandBuffer *commands);
+        void processEvents(GpuFence fence, bool wait);
+
+        wgpu::Device mDevice = nullptr;
+        wgpu::Queue mQueue = nullptr;
+        // Serial of the last completed submit. Shared with the callbacks still in flight, so
+        // a reset (or our destruction) doesn't leave them pointing at freed memory.
+        std::shared_ptr<std::atomic<uint64_t>> mCompleted;
+        uint64_t mSubmitted = 0;
+#if defined(WEBGPU_BACKEND_WGPU)
+        // wgpu's own index of every submit not known to be complete, to wait for one of them.
+        struct Submission
+        {
+            uint64_t serial = 0;
+            uint64_t index = 0;
+        };
+        std::deque<Submission> mSubmissions;
+#endif // WEBGPU_BACKEND_WGPU
+    };
+} // namespace learn::webgpu
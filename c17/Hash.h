@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace learn::webgpu
+{
+
+    // FNV-1a, 64 bit. Not cryptographic, just a cheap and stable hash so keys written
+    // to disk by one launch still match on the next one (std::hash gives no such promise).
+    constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+    constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+    inline uint64_t hashBytes(const void *data, size_t size, uint64_t seed = kFnvOffsetBasis)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= kFnvPrime;
+        }
+        return hash;
+    }
+
+    inline uint64_t hashString(std::string_view text, uint64_t seed = kFnvOffsetBasis)
+    {
+        // Hash the length too, so "ab" + "c" and "a" + "bc" don't collide when chained.
+        uint64_t size = text.size();
+        seed = hashBytes(&size, sizeof(size), seed);
+        return hashBytes(text.data(), text.size(), seed);
+    }
+
+    template <typename T>
+    inline uint64_t hashValue(const T &value, uint64_t seed = kFnvOffsetBasis)
+    {
+        return hashBytes(&value, sizeof(T), seed);
+    }
+
+    inline std::string hashToHex(uint64_t hash)
+    {
+        std::ostringstream out;
+        out << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return out.str();
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,130 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#include "IndexPacking.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // Vertices one 16 bit draw can address, from its base vertex.
+        constexpr uint32_t kUint16Vertices = 0x10000;
+
+        template <typename T>
+        void appendIndex(std::vector<uint8_t> &bytes, uint32_t index)
+        {
+            T value = static_cast<T>(index);
+            size_t size = bytes.size();
+            bytes.resize(size + sizeof(T));
+            std::memcpy(bytes.data() + size, &value, sizeof(T));
+        }
+
+        PackedIndices packUint32(const std::vector<uint32_t> &indices)
+        {
+            PackedIndices packed;
+            packed.format = wgpu::IndexFormat::Uint32;
+            packed.bytes.resize(indices.size() * sizeof(uint32_t));
+            std::memcpy(packed.bytes.data(), indices.data(), packed.bytes.size());
+            packed.draws.push_back(IndexedDraw{0, static_cast<uint32_t>(indices.size()), 0});
+            return packed;
+        }
+
+        // Greedy: triangles go into the current draw until it would use more than 65536
+        // distinct vertices. Each draw gets its own copy of the vertices it uses, so only the
+        // vertices shared with an earlier draw are duplicated.
+        PackedIndices splitToUint16(const std::vector<uint32_t> &indices, uint32_t vertexCount)
+        {
+            PackedIndices packed;
+            packed.format = wgpu::IndexFormat::Uint16;
+            packed.bytes.reserve(indices.size() * sizeof(uint16_t));
+            packed.vertexRemap.reserve(vertexCount);
+
+            // Which draw a vertex was last copied into, and where in that draw.
+            constexpr uint32_t kNoDraw = ~uint32_t(0);
+            std::vector<uint32_t> drawOf(vertexCount, kNoDraw);
+            std::vector<uint32_t> localIndex(vertexCount, 0);
+            IndexedDraw draw;
+            uint32_t drawId = 0;
+            for (size_t t = 0; t + 2 < indices.size(); t += 3)
+            {
+                uint32_t newVertices = 0;
+                for (size_t c = 0; c < 3; ++c)
+                {
+                    uint32_t v = indices[t + c];
+                    bool repeated = (c > 0 && indices[t] == v) || (c > 1 && indices[t + 1] == v);
+                    if (drawOf[v] != drawId && !repeated)
+                        ++newVertices;
+                }
+                uint64_t drawVertices = packed.vertexRemap.size() - static_cast<uint64_t>(draw.baseVertex);
+                if (drawVertices + newVertices > kUint16Vertices)
+                {
+                    packed.draws.push_back(draw);
+                    ++drawId;
+                    // Draws start at multiples of 4 bytes, index buffer offsets have to be aligned.
+                    if (packed.bytes.size() % 4 != 0)
+                        appendIndex<uint16_t>(packed.bytes, 0);
+                    draw = IndexedDraw{packed.bytes.size(), 0, static_cast<int32_t>(packed.vertexRemap.size())};
+                }
+                for (size_t c = 0; c < 3; ++c)
+                {
+                    uint32_t v = indices[t + c];
+                    if (drawOf[v] != drawId)
+                    {
+                        drawOf[v] = drawId;
+                        localIndex[v] = static_cast<uint32_t>(packed.vertexRemap.size()) - static_cast<uint32_t>(draw.baseVertex);
+                        packed.vertexRemap.push_back(v);
+                    }
+                    appendIndex<uint16_t>(packed.bytes, localIndex[v]);
+                }
+                draw.indexCount += 3;
+            }
+            packed.draws.push_back(draw);
+            return packed;
+        }
+    } // namespace
+
+    PackedIndices packIndices(const std::vector<uint32_t> &indices, uint32_t vertexCount, IndexPacking packing)
+    {
+        if (packing == IndexPacking::Uint32)
+            return packUint32(indices);
+
+        if (vertexCount <= kUint16Vertices)
+        {
+            PackedIndices packed;
+            packed.format = wgpu::IndexFormat::Uint16;
+            packed.bytes.reserve(indices.size() * sizeof(uint16_t));
+            for (uint32_t index : indices)
+                appendIndex<uint16_t>(packed.bytes, index);
+            packed.draws.push_back(IndexedDraw{0, static_cast<uint32_t>(indices.size()), 0});
+            return packed;
+        }
+
+        if (packing == IndexPacking::SplitToUint16)
+            return splitToUint16(indices, vertexCount);
+        return packUint32(indices);
+    }
+
+    std::vector<float> remapVertices(const std::vector<float> &vertices, uint32_t components, const std::vector<uint32_t> &vertexRemap)
+    {
+        std::vector<float> remapped;
+        remapped.reserve(vertexRemap.size() * components);
+        for (uint32_t v : vertexRemap)
+        {
+            auto vertex = vertices.begin() + static_cast<size_t>(v) * components;
+            remapped.insert(remapped.end(), vertex, vertex + components);
+        }
+        return remapped;
+    }
+
+    void PackedIndices::report(std::ostream &out) const
+    {
+        out << "indices: " << (format == wgpu::IndexFormat::Uint16 ? "uint16" : "uint32") << ", " << bytes.size() << " bytes in "
+            << draws.size() << " draw(s)";
+        if (!vertexRemap.empty())
+            out << ", " << vertexRemap.size() << " vertices after splitting";
+        out << std::endl;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // A range of the packed index bytes drawn with one drawIndexed.
+    struct IndexedDraw
+    {
+        uint64_t byteOffset = 0;
+        uint32_t indexCount = 0;
+        // Added to every index of the draw, lets 16 bit indices address vertices past 65535.
+        int32_t baseVertex = 0;
+    };
+
+    struct PackedIndices
+    {
+        wgpu::IndexFormat format = wgpu::IndexFormat::Uint16;
+        std::vector<uint8_t> bytes;
+        std::vector<IndexedDraw> draws;
+        // Empty unless the mesh was split: then the draws index a new vertex array whose
+        // vertex i is vertex vertexRemap[i] of the mesh, see remapVertices().
+        std::vector<uint32_t> vertexRemap;
+
+        uint32_t indexSize() const { return format == wgpu::IndexFormat::Uint16 ? 2 : 4; }
+        void report(std::ostream &out) const;
+    };
+
+    enum class IndexPacking
+    {
+        // Uint16 when the mesh has at most 65536 vertices, Uint32 otherwise.
+        Narrowest,
+        // Like Narrowest, but a big mesh is cut into draws of at most 65536 vertices, each
+        // with 16 bit indices and its own base vertex. Vertices used by several draws are
+        // duplicated, a few percent of them for a mesh in vertex cache order.
+        SplitToUint16,
+        Uint32
+    };
+
+    // Chooses the index format for a triangle list and writes the indices in it.
+    PackedIndices packIndices(const std::vector<uint32_t> &indices, uint32_t vertexCount, IndexPacking packing = IndexPacking::SplitToUint16);
+
+    // Applies PackedIndices::vertexRemap to components floats per vertex.
+    std::vector<float> remapVertices(const std::vector<float> &vertices, uint32_t components, const std::vector<uint32_t> &vertexRemap);
+} // namespace learn::webgpu
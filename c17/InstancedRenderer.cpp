@@ -0,0 +1,258 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iomanip>
+#include <random>
+
+#include "GpuHelpers.h"
+#include "GpuTimeline.h"
+#include "InstancedRenderer.h"
+#include "InstancedShader.h"
+#include "MappedUpload.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // InstanceInput in instanced.wgsl, the locations after the mesh's position and color.
+        const std::vector<wgpu::VertexAttribute> &instanceAttributes()
+        {
+            static const std::vector<wgpu::VertexAttribute> attributes = []()
+            {
+                struct Field
+                {
+                    uint32_t location;
+                    wgpu::VertexFormat format;
+                    uint64_t offset;
+                };
+                const Field fields[] = {
+                    {2, wgpu::VertexFormat::Float32x2, offsetof(Instance, offset)},
+                    {3, wgpu::VertexFormat::Float32, offsetof(Instance, scale)},
+                    {4, wgpu::VertexFormat::Float32, offsetof(Instance, phase)},
+                    {5, wgpu::VertexFormat::Unorm8x4, offsetof(Instance, tint)},
+                };
+                std::vector<wgpu::VertexAttribute> result;
+                for (const Field &field : fields)
+                {
+                    wgpu::VertexAttribute attribute;
+                    attribute.shaderLocation = field.location;
+                    attribute.format = field.format;
+                    attribute.offset = field.offset;
+                    result.push_back(attribute);
+                }
+                return result;
+            }();
+            return attributes;
+        }
+
+        // The layouts of the mesh, then the instance buffer that advances once per instance.
+        std::vector<wgpu::VertexBufferLayout> bufferLayouts(const VertexLayout &vertexLayout)
+        {
+            std::vector<wgpu::VertexBufferLayout> layouts = vertexLayout.bufferLayouts();
+            wgpu::VertexBufferLayout instanceLayout;
+            instanceLayout.arrayStride = sizeof(Instance);
+            instanceLayout.stepMode = wgpu::VertexStepMode::Instance;
+            instanceLayout.attributeCount = instanceAttributes().size();
+            instanceLayout.attributes = instanceAttributes().data();
+            layouts.push_back(instanceLayout);
+            return layouts;
+        }
+
+        std::vector<wgpu::BindGroupLayoutEntry> layoutEntries()
+        {
+            std::vector<wgpu::BindGroupLayoutEntry> entries(1, wgpu::Default);
+            entries[0].binding = 0;
+            entries[0].visibility = wgpu::ShaderStage::Vertex;
+            entries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+            entries[0].buffer.minBindingSize = sizeof(float);
+            return entries;
+        }
+    } // namespace
+
+    std::vector<Instance> gridInstances(uint32_t count, float meshRadius)
+    {
+        // Same fixed seed and float conversion as scatterObjects.
+        std::mt19937 random(1234);
+        auto unit = [&random]()
+        {
+            return static_cast<float>(random() >> 8) / 16777216.0f;
+        };
+        const uint32_t side = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count)))));
+        const float cell = 2.0f / static_cast<float>(side);
+        // A little gap between neighbours, even at the largest point of the animation.
+        const float scale = 0.4f * cell / std::max(meshRadius, 1e-6f);
+        std::vector<Instance> instances(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Instance &instance = instances[i];
+            instance.offset[0] = -1.0f + cell * (static_cast<float>(i % side) + 0.5f);
+            instance.offset[1] = -1.0f + cell * (static_cast<float>(i / side) + 0.5f);
+            instance.scale = scale;
+            instance.phase = 6.2831853f * unit();
+            for (int c = 0; c < 3; ++c)
+            {
+                instance.tint[c] = static_cast<uint8_t>(255.0f * unit());
+            }
+            instance.tint[3] = 255;
+        }
+        return instances;
+    }
+
+    void InstancedRenderer::describeResources(LimitsNegotiator &negotiator, const VertexLayout &vertexLayout, uint32_t instanceCount)
+    {
+        negotiator.addVertexBufferLayouts(bufferLayouts(vertexLayout));
+        negotiator.addBindGroupLayout(layoutEntries());
+        negotiator.addBuffer(uint64_t(instanceCount) * sizeof(Instance));
+    }
+
+    bool InstancedRenderer::create(wgpu::Device device, wgpu::Queue queue, const std::string &shaderSource, const VertexLayout &vertexLayout,
+                                   wgpu::TextureFormat targetFormat, const CulledMesh &mesh, const std::vector<Instance> &instances)
+    {
+        release();
+        if (instances.empty() || mesh.indexChunks.empty())
+        {
+            return false;
+        }
+        mQueue = queue;
+        mMesh = mesh;
+        mInstanceCount = static_cast<uint32_t>(instances.size());
+        mInstanceSlot = static_cast<uint32_t>(vertexLayout.streamCount());
+
+        // A float, padded to the 16 bytes of a uniform block.
+        float time[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        mTimeBuffer = createMappedBuffer(device, "Instancing time", wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst, sizeof(time),
+                                         [&](void *data, uint64_t size)
+                                         { std::memcpy(data, time, size); });
+        // 20 bytes do not always make a multiple of 4, mapped ranges have to.
+        const uint64_t instanceBytes = instances.size() * sizeof(Instance);
+        mInstanceBuffer = createMappedBuffer(device, "Instances", wgpu::BufferUsage::Vertex, (instanceBytes + 3) & ~uint64_t(3),
+                                             [&](void *data, uint64_t /* size */)
+                                             { std::memcpy(data, instances.data(), instanceBytes); });
+
+        std::vector<wgpu::BindGroupLayoutEntry> entries = layoutEntries();
+        wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+        bindGroupLayoutDesc.label = "Instancing layout";
+        bindGroupLayoutDesc.entryCount = static_cast<uint32_t>(entries.size());
+        bindGroupLayoutDesc.entries = entries.data();
+        mLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+        wgpu::BindGroupEntry binding = wgpu::Default;
+        binding.binding = 0;
+        binding.buffer = mTimeBuffer;
+        binding.offset = 0;
+        binding.size = sizeof(float);
+        wgpu::BindGroupDescriptor bindGroupDesc;
+        bindGroupDesc.label = "Instancing bind group";
+        bindGroupDesc.layout = mLayout;
+        bindGroupDesc.entryCount = 1;
+        bindGroupDesc.entries = &binding;
+        mBindGroup = device.createBindGroup(bindGroupDesc);
+
+        wgpu::ShaderModule shaderModule = createWgslModule(device, "instanced shader module", shaderSource);
+        wgpu::PipelineLayoutDescriptor layoutDesc{};
+        layoutDesc.bindGroupLayoutCount = 1;
+        layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&mLayout;
+        wgpu::PipelineLayout pipelineLayout = device.createPipelineLayout(layoutDesc);
+
+        // The state of the triangle pipeline with one more vertex buffer.
+        mPipeline = createBlendedPipeline(device, "Instanced pipeline", shaderModule, "vs_main", pipelineLayout, bufferLayouts(vertexLayout), targetFormat);
+
+        pipelineLayout.release();
+        shaderModule.release();
+        return valid();
+    }
+
+    void InstancedRenderer::release()
+    {
+        releaseObject(mPipeline);
+        releaseObject(mBindGroup);
+        releaseObject(mLayout);
+        releaseBuffer(mTimeBuffer);
+        releaseBuffer(mInstanceBuffer);
+        mMesh = CulledMesh{};
+        mInstanceCount = 0;
+        mQueue = nullptr;
+    }
+
+    void InstancedRenderer::draw(wgpu::RenderPassEncoder renderPass, float time)
+    {
+        // Written before the commands of this frame run, like the triangle's uniform ring.
+        mQueue.writeBuffer(mTimeBuffer, 0, &time, sizeof(float));
+        renderPass.setPipeline(mPipeline);
+        renderPass.setBindGroup(0, mBindGroup, 0, nullptr);
+        for (uint32_t slot = 0; slot < mMesh.vertexStreams.size(); ++slot)
+        {
+            const CulledMesh::Stream &stream = mMesh.vertexStreams[slot];
+            renderPass.setVertexBuffer(slot, stream.buffer, stream.offset, stream.size);
+        }
+        renderPass.setVertexBuffer(mInstanceSlot, mInstanceBuffer, 0, uint64_t(mInstanceCount) * sizeof(Instance));
+        for (const CulledMesh::Chunk &chunk : mMesh.indexChunks)
+        {
+            renderPass.setIndexBuffer(chunk.buffer, mMesh.indexFormat, chunk.offset, chunk.size);
+            // Every instance of the chunk, the instance index picks the Instance to fetch.
+            renderPass.drawIndexed(chunk.indexCount, mInstanceCount, 0, chunk.baseVertex, 0);
+        }
+    }
+
+    void benchmarkInstancing(wgpu::Device device, wgpu::Queue queue, uint64_t maxBufferSize, std::ostream &out)
+    {
+        BenchmarkScene scene = createBenchmarkScene(device);
+        const std::string shaderSource = scene.vertexLayout.applyToWgsl(shaders::kInstancedWgsl);
+        GpuTimeline timeline(device, queue);
+        out << "instances   draws   encode ms/frame   wall ms/frame   M instances/s" << std::endl;
+        for (uint32_t count : {10000u, 100000u, 1000000u, 4000000u})
+        {
+            if (uint64_t(count) * sizeof(Instance) > maxBufferSize)
+            {
+                out << std::left << std::setw(12) << count << "skipped, the instance buffer is larger than maxBufferSize" << std::endl;
+                continue;
+            }
+            InstancedRenderer renderer;
+            if (!renderer.create(device, queue, shaderSource, scene.vertexLayout, scene.targetFormat, scene.mesh,
+                                 gridInstances(count, scene.meshRadius)))
+            {
+                out << "instancing setup failed" << std::endl;
+                break;
+            }
+            // Fewer frames for millions of instances on slow adapters.
+            const int frames = count >= 1000000 ? 20 : 100;
+            double encodeMs = 0.0;
+            GpuFence fence;
+            // One frame more than timed, the first one pays for the pipeline warm up.
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = -1; frame < frames; ++frame)
+            {
+                if (frame == 0)
+                {
+                    timeline.wait(fence);
+                    encodeMs = 0.0;
+                    start = std::chrono::steady_clock::now();
+                }
+                auto encodeStart = std::chrono::steady_clock::now();
+                wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                wgpu::RenderPassEncoder renderPass = scene.beginPass(encoder);
+                renderer.draw(renderPass, static_cast<float>(frame) / 60.0f);
+                renderPass.end();
+                renderPass.release();
+                wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                encoder.release();
+                fence = timeline.submit(command);
+                command.release();
+                encodeMs += elapsedMs(encodeStart);
+            }
+            timeline.wait(fence);
+            double wallMs = elapsedMs(start);
+            double instancesPerSecond = double(count) * frames / (wallMs / 1000.0);
+            out << std::left << std::setw(12) << count << std::right << std::setw(5) << renderer.drawCount() << std::fixed
+                << std::setprecision(3) << std::setw(18) << encodeMs / frames << std::setw(16) << wallMs / frames << std::setprecision(1)
+                << std::setw(16) << instancesPerSecond / 1e6 << std::defaultfloat << std::endl;
+        }
+        out << "(wall includes the GPU, instances/s is instances drawn per second of wall time)" << std::endl;
+        scene.release();
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "GpuCulling.h"
+#include "LimitsNegotiator.h"
+#include "VertexLayout.h"
+
+namespace learn::webgpu
+{
+
+    // One copy of the mesh: moved by offset, scaled by scale, tinted by tint (Unorm8x4) and
+    // phase seconds ahead in the animation. InstanceInput in instanced.wgsl.
+    struct Instance
+    {
+        float offset[2];
+        float scale;
+        float phase;
+        uint8_t tint[4];
+    };
+    static_assert(sizeof(Instance) == 20, "matches the instance buffer layout of InstancedRenderer");
+
+    // count instances on a grid that covers the viewport, meshRadius is the bounding radius
+    // of the mesh. The same count gives the same instances.
+    std::vector<Instance> gridInstances(uint32_t count, float meshRadius);
+
+    // Draws every instance of the mesh with one drawIndexed per index chunk. The instance
+    // data is one more vertex buffer after the mesh's, stepped per instance: the GPU fetches
+    // an Instance for each copy, the CPU records the same commands for one or a million.
+    //
+    // Unlike GpuCulling every instance is drawn, on screen or not, there is no compute pass.
+    class InstancedRenderer
+    {
+    public:
+        InstancedRenderer() = default;
+        ~InstancedRenderer() { release(); }
+        InstancedRenderer(const InstancedRenderer &) = delete;
+        InstancedRenderer &operator=(const InstancedRenderer &) = delete;
+
+        // The vertex buffers of vertexLayout plus the instance buffer, for instanceCount instances.
+        static void describeResources(LimitsNegotiator &negotiator, const VertexLayout &vertexLayout, uint32_t instanceCount);
+
+        // shaderSource is shaders/instanced.wgsl with the VertexInput of vertexLayout, see
+        // VertexLayout::applyToWgsl. Call again after a device loss.
+        bool create(wgpu::Device device, wgpu::Queue queue, const std::string &shaderSource, const VertexLayout &vertexLayout,
+                    wgpu::TextureFormat targetFormat, const CulledMesh &mesh, const std::vector<Instance> &instances);
+        void release();
+        bool valid() const { return mPipeline != nullptr; }
+        uint32_t instanceCount() const { return mInstanceCount; }
+        // The draws recorded by draw(), one per index chunk.
+        uint32_t drawCount() const { return static_cast<uint32_t>(mMesh.indexChunks.size()); }
+
+        void draw(wgpu::RenderPassEncoder renderPass, float time);
+
+    private:
+        wgpu::Queue mQueue = nullptr;
+        CulledMesh mMesh;
+        uint32_t mInstanceCount = 0;
+        // The slot of the instance buffer, after the mesh's vertex buffers.
+        uint32_t mInstanceSlot = 0;
+        wgpu::Buffer mTimeBuffer = nullptr;
+        wgpu::Buffer mInstanceBuffer = nullptr;
+        wgpu::BindGroupLayout mLayout = nullptr;
+        wgpu::BindGroup mBindGroup = nullptr;
+        wgpu::RenderPipeline mPipeline = nullptr;
+    };
+
+    // Draws 10k to 4M instances of a quad and prints the frame time and the instances per
+    // second. Counts whose instance buffer is larger than maxBufferSize are skipped.
+    void benchmarkInstancing(wgpu::Device device, wgpu::Queue queue, uint64_t maxBufferSize, std::ostream &out);
+} // namespace learn::webgpu
@@ -0,0 +1,204 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
+#include "LimitsNegotiator.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // Default limits from the WebGPU spec, what any conformant adapter has to support.
+        // Old GL or software adapters sometimes don't, which is why we still clamp them below.
+        constexpr uint32_t kDefaultTextureDimension1D = 8192;
+        constexpr uint32_t kDefaultTextureDimension2D = 8192;
+        constexpr uint32_t kDefaultTextureDimension3D = 2048;
+        constexpr uint32_t kDefaultTextureArrayLayers = 256;
+        constexpr uint32_t kDefaultBindGroups = 4;
+        constexpr uint32_t kDefaultDynamicUniformBuffers = 8;
+        constexpr uint32_t kDefaultDynamicStorageBuffers = 4;
+        constexpr uint32_t kDefaultSampledTextures = 16;
+        constexpr uint32_t kDefaultSamplers = 16;
+        constexpr uint32_t kDefaultStorageBuffers = 8;
+        constexpr uint32_t kDefaultStorageTextures = 4;
+        constexpr uint32_t kDefaultUniformBuffers = 12;
+        constexpr uint64_t kDefaultUniformBindingSize = 64 * 1024;
+        constexpr uint64_t kDefaultStorageBindingSize = 128 * 1024 * 1024;
+        constexpr uint32_t kDefaultVertexBuffers = 8;
+        constexpr uint64_t kDefaultBufferSize = 256 * 1024 * 1024;
+        constexpr uint32_t kDefaultVertexAttributes = 16;
+        constexpr uint32_t kDefaultVertexBufferArrayStride = 2048;
+        constexpr uint32_t kDefaultInterStageComponents = 60;
+        constexpr uint32_t kDefaultInterStageVariables = 16;
+        constexpr uint32_t kDefaultColorAttachments = 8;
+        constexpr uint32_t kDefaultColorAttachmentBytesPerSample = 32;
+        constexpr uint32_t kDefaultWorkgroupStorageSize = 16384;
+        constexpr uint32_t kDefaultInvocationsPerWorkgroup = 256;
+        constexpr uint32_t kDefaultWorkgroupSizeX = 256;
+        constexpr uint32_t kDefaultWorkgroupSizeY = 256;
+        constexpr uint32_t kDefaultWorkgroupSizeZ = 64;
+        constexpr uint32_t kDefaultWorkgroupsPerDimension = 65535;
+
+        // Picks max(needed, default) but never more than what the adapter has.
+        template <typename T>
+        T fitLimit(uint64_t needed, uint64_t defaultValue, T available, const char *name, NegotiatedLimits &result)
+        {
+            uint64_t wanted = std::max(needed, std::min<uint64_t>(defaultValue, available));
+            if (wanted > available)
+            {
+                std::ostringstream note;
+                note << name << ": need " << needed << " but the adapter only supports " << available;
+                result.notes.push_back(note.str());
+                result.satisfiable = false;
+                return available;
+            }
+            return static_cast<T>(wanted);
+        }
+    } // namespace
+
+    void LimitsNegotiator::addVertexBufferLayouts(const std::vector<wgpu::VertexBufferLayout> &layouts)
+    {
+        mVertexBuffers = std::max(mVertexBuffers, static_cast<uint32_t>(layouts.size()));
+        uint32_t attributes = 0;
+        for (const wgpu::VertexBufferLayout &layout : layouts)
+        {
+            attributes += static_cast<uint32_t>(layout.attributeCount);
+            mVertexBufferArrayStride = std::max(mVertexBufferArrayStride, layout.arrayStride);
+        }
+        mVertexAttributes = std::max(mVertexAttributes, attributes);
+    }
+
+    void LimitsNegotiator::addBuffer(uint64_t size)
+    {
+        mLargestBuffer = std::max(mLargestBuffer, size);
+    }
+
+    void LimitsNegotiator::addBindGroupLayout(const std::vector<wgpu::BindGroupLayoutEntry> &entries)
+    {
+        ++mBindGroups;
+        uint32_t uniformBuffers = 0;
+        uint32_t storageBuffers = 0;
+        uint32_t sampledTextures = 0;
+        uint32_t samplers = 0;
+        for (const wgpu::BindGroupLayoutEntry &entry : entries)
+        {
+            if (entry.buffer.type == wgpu::BufferBindingType::Uniform)
+            {
+                ++uniformBuffers;
+                mUniformBindingSize = std::max(mUniformBindingSize, entry.buffer.minBindingSize);
+                if (entry.buffer.hasDynamicOffset)
+                    ++mDynamicUniformBuffers;
+            }
+            else if (entry.buffer.type == wgpu::BufferBindingType::Storage ||
+                     entry.buffer.type == wgpu::BufferBindingType::ReadOnlyStorage)
+            {
+                ++storageBuffers;
+                mStorageBindingSize = std::max(mStorageBindingSize, entry.buffer.minBindingSize);
+                if (entry.buffer.hasDynamicOffset)
+                    ++mDynamicStorageBuffers;
+            }
+            if (entry.texture.sampleType != wgpu::TextureSampleType::Undefined)
+                ++sampledTextures;
+            if (entry.sampler.type != wgpu::SamplerBindingType::Undefined)
+                ++samplers;
+        }
+        // We don't look at the visibility, counting every binding for every stage is
+        // pessimistic but keeps this simple.
+        mUniformBuffersPerStage += uniformBuffers;
+        mStorageBuffersPerStage += storageBuffers;
+        mSampledTexturesPerStage += sampledTextures;
+        mSamplersPerStage += samplers;
+    }
+
+    void LimitsNegotiator::addInterStageComponents(uint32_t components, uint32_t variables)
+    {
+        mInterStageComponents += components;
+        mInterStageVariables += variables;
+    }
+
+    void LimitsNegotiator::addTexture2D(uint32_t width, uint32_t height)
+    {
+        mTextureDimension2D = std::max({mTextureDimension2D, width, height});
+    }
+
+    NegotiatedLimits LimitsNegotiator::negotiate(const wgpu::SupportedLimits &supported) const
+    {
+        NegotiatedLimits result;
+        const WGPULimits &available = supported.limits;
+        WGPULimits &required = result.limits.limits;
+
+        required.maxTextureDimension1D = fitLimit(0, kDefaultTextureDimension1D, available.maxTextureDimension1D, "maxTextureDimension1D", result);
+        required.maxTextureDimension2D = fitLimit(mTextureDimension2D, kDefaultTextureDimension2D, available.maxTextureDimension2D, "maxTextureDimension2D", result);
+        required.maxTextureDimension3D = fitLimit(0, kDefaultTextureDimension3D, available.maxTextureDimension3D, "maxTextureDimension3D", result);
+        required.maxTextureArrayLayers = fitLimit(0, kDefaultTextureArrayLayers, available.maxTextureArrayLayers, "maxTextureArrayLayers", result);
+        required.maxBindGroups = fitLimit(mBindGroups, kDefaultBindGroups, available.maxBindGroups, "maxBindGroups", result);
+        required.maxDynamicUniformBuffersPerPipelineLayout = fitLimit(mDynamicUniformBuffers, kDefaultDynamicUniformBuffers, available.maxDynamicUniformBuffersPerPipelineLayout, "maxDynamicUniformBuffersPerPipelineLayout", result);
+        required.maxDynamicStorageBuffersPerPipelineLayout = fitLimit(mDynamicStorageBuffers, kDefaultDynamicStorageBuffers, available.maxDynamicStorageBuffersPerPipelineLayout, "maxDynamicStorageBuffersPerPipelineLayout", result);
+        required.maxSampledTexturesPerShaderStage = fitLimit(mSampledTexturesPerStage, kDefaultSampledTextures, available.maxSampledTexturesPerShaderStage, "maxSampledTexturesPerShaderStage", result);
+        required.maxSamplersPerShaderStage = fitLimit(mSamplersPerStage, kDefaultSamplers, available.maxSamplersPerShaderStage, "maxSamplersPerShaderStage", result);
+        required.maxStorageBuffersPerShaderStage = fitLimit(mStorageBuffersPerStage, kDefaultStorageBuffers, available.maxStorageBuffersPerShaderStage, "maxStorageBuffersPerShaderStage", result);
+        required.maxStorageTexturesPerShaderStage = fitLimit(0, kDefaultStorageTextures, available.maxStorageTexturesPerShaderStage, "maxStorageTexturesPerShaderStage", result);
+        required.maxUniformBuffersPerShaderStage = fitLimit(mUniformBuffersPerStage, kDefaultUniformBuffers, available.maxUniformBuffersPerShaderStage, "maxUniformBuffersPerShaderStage", result);
+        required.maxUniformBufferBindingSize = fitLimit(mUniformBindingSize, kDefaultUniformBindingSize, available.maxUniformBufferBindingSize, "maxUniformBufferBindingSize", result);
+        required.maxStorageBufferBindingSize = fitLimit(mStorageBindingSize, kDefaultStorageBindingSize, available.maxStorageBufferBindingSize, "maxStorageBufferBindingSize", result);
+        required.maxVertexBuffers = fitLimit(mVertexBuffers, kDefaultVertexBuffers, available.maxVertexBuffers, "maxVertexBuffers", result);
+        required.maxVertexAttributes = fitLimit(mVertexAttributes, kDefaultVertexAttributes, available.maxVertexAttributes, "maxVertexAttributes", result);
+        required.maxVertexBufferArrayStride = fitLimit(mVertexBufferArrayStride, kDefaultVertexBufferArrayStride, available.maxVertexBufferArrayStride, "maxVertexBufferArrayStride", result);
+        required.maxInterStageShaderComponents = fitLimit(mInterStageComponents, kDefaultInterStageComponents, available.maxInterStageShaderComponents, "maxInterStageShaderComponents", result);
+        required.maxInterStageShaderVariables = fitLimit(mInterStageVariables, kDefaultInterStageVariables, available.maxInterStageShaderVariables, "maxInterStageShaderVariables", result);
+        required.maxColorAttachments = fitLimit(1, kDefaultColorAttachments, available.maxColorAttachments, "maxColorAttachments", result);
+        required.maxColorAttachmentBytesPerSample = fitLimit(0, kDefaultColorAttachmentBytesPerSample, available.maxColorAttachmentBytesPerSample, "maxColorAttachmentBytesPerSample", result);
+        required.maxComputeWorkgroupStorageSize = fitLimit(0, kDefaultWorkgroupStorageSize, available.maxComputeWorkgroupStorageSize, "maxComputeWorkgroupStorageSize", result);
+        required.maxComputeInvocationsPerWorkgroup = fitLimit(0, kDefaultInvocationsPerWorkgroup, available.maxComputeInvocationsPerWorkgroup, "maxComputeInvocationsPerWorkgroup", result);
+        required.maxComputeWorkgroupSizeX = fitLimit(0, kDefaultWorkgroupSizeX, available.maxComputeWorkgroupSizeX, "maxComputeWorkgroupSizeX", result);
+        required.maxComputeWorkgroupSizeY = fitLimit(0, kDefaultWorkgroupSizeY, available.maxComputeWorkgroupSizeY, "maxComputeWorkgroupSizeY", result);
+        required.maxComputeWorkgroupSizeZ = fitLimit(0, kDefaultWorkgroupSizeZ, available.maxComputeWorkgroupSizeZ, "maxComputeWorkgroupSizeZ", result);
+        required.maxComputeWorkgroupsPerDimension = fitLimit(0, kDefaultWorkgroupsPerDimension, available.maxComputeWorkgroupsPerDimension, "maxComputeWorkgroupsPerDimension", result);
+
+        // For the alignments lower is better, the adapter value is the best we can get.
+        required.minUniformBufferOffsetAlignment = available.minUniformBufferOffsetAlignment;
+        required.minStorageBufferOffsetAlignment = available.minStorageBufferOffsetAlignment;
+
+        // An oversized buffer is not fatal, it just has to be created in several pieces.
+        required.maxBufferSize = std::max(std::min(kDefaultBufferSize, available.maxBufferSize), std::min(mLargestBuffer, available.maxBufferSize));
+        result.maxBufferChunkSize = required.maxBufferSize;
+        if (mLargestBuffer > available.maxBufferSize)
+        {
+            std::ostringstream note;
+            note << "maxBufferSize: largest buffer is " << mLargestBuffer << " bytes, splitting buffers in chunks of "
+                 << result.maxBufferChunkSize << " bytes";
+            result.notes.push_back(note.str());
+            result.needsChunking = true;
+        }
+        return result;
+    }
+
+    void NegotiatedLimits::report(std::ostream &out) const
+    {
+        out << "Negotiated limits: maxBufferSize " << limits.limits.maxBufferSize
+            << ", maxVertexBuffers " << limits.limits.maxVertexBuffers
+            << ", maxVertexAttributes " << limits.limits.maxVertexAttributes
+            << ", maxTextureDimension2D " << limits.limits.maxTextureDimension2D << std::endl;
+        for (const std::string &note : notes)
+        {
+            out << " - " << note << std::endl;
+        }
+    }
+
+    std::vector<BufferChunk> chunkRanges(uint64_t size, uint64_t elementSize, uint64_t maxChunkSize)
+    {
+        // Every chunk but the last has to hold whole elements and be 4 byte aligned.
+        uint64_t unit = std::lcm(std::max<uint64_t>(elementSize, 1), uint64_t(4));
+        uint64_t chunkSize = std::max(maxChunkSize / unit, uint64_t(1)) * unit;
+
+        std::vector<BufferChunk> chunks;
+        for (uint64_t offset = 0; offset < size; offset += chunkSize)
+        {
+            chunks.push_back({offset, std::min(chunkSize, size - offset)});
+        }
+        return chunks;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // A [offset, offset + size) slice of a buffer that is too big to be created in one piece.
+    struct BufferChunk
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct NegotiatedLimits
+    {
+        wgpu::RequiredLimits limits = wgpu::Default;
+        // Buffers bigger than this have to be split with chunkRanges().
+        uint64_t maxBufferChunkSize = 0;
+        bool needsChunking = false;
+        // False when something that can't be chunked (vertex attributes, inter stage
+        // components...) is beyond what the adapter supports.
+        bool satisfiable = true;
+        std::vector<std::string> notes;
+
+        void report(std::ostream &out) const;
+    };
+
+    // Instead of hardcoding the device limits, the application describes what it is going
+    // to create (vertex layouts, buffers, bind groups) and the negotiator works out the
+    // limits from that. Every limit is at least the WebGPU default, so small demos keep some
+    // headroom, and never more than the adapter supports, so requestDevice does not fail.
+    // Buffers larger than the adapter's maxBufferSize are not an error: the result says the
+    // chunk size to split them with instead.
+    class LimitsNegotiator
+    {
+    public:
+        void addVertexBufferLayouts(const std::vector<wgpu::VertexBufferLayout> &layouts);
+        void addBuffer(uint64_t size);
+        void addBindGroupLayout(const std::vector<wgpu::BindGroupLayoutEntry> &entries);
+        // Number of scalars passed from the vertex to the fragment stage, a vec3f counts 3.
+        void addInterStageComponents(uint32_t components, uint32_t variables = 1);
+        void addTexture2D(uint32_t width, uint32_t height);
+
+        NegotiatedLimits negotiate(const wgpu::SupportedLimits &supported) const;
+
+    private:
+        uint32_t mVertexBuffers = 0;
+        uint32_t mVertexAttributes = 0;
+        uint64_t mVertexBufferArrayStride = 0;
+        uint64_t mLargestBuffer = 0;
+        uint32_t mBindGroups = 0;
+        uint32_t mUniformBuffersPerStage = 0;
+        uint32_t mStorageBuffersPerStage = 0;
+        uint32_t mDynamicUniformBuffers = 0;
+        uint32_t mDynamicStorageBuffers = 0;
+        uint32_t mSampledTexturesPerStage = 0;
+        uint32_t mSamplersPerStage = 0;
+        uint64_t mUniformBindingSize = 0;
+        uint64_t mStorageBindingSize = 0;
+        uint32_t mInterStageComponents = 0;
+        uint32_t mInterStageVariables = 0;
+        uint32_t mTextureDimension2D = 0;
+    };
+
+    // Splits size bytes into chunks of at most maxChunkSize. elementSize is the smallest unit
+    // the data can be cut at (one vertex, one triangle...), every chunk but the last is a whole
+    // number of elements and a multiple of 4 bytes, as writeBuffer requires.
+    std::vector<BufferChunk> chunkRanges(uint64_t size, uint64_t elementSize, uint64_t maxChunkSize);
+} // namespace learn::webgpu
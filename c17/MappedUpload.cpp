@@ -0,0 +1,145 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#include "AsyncRequests.h"
+#include "LimitsNegotiator.h"
+#include "MappedUpload.h"
+
+#ifdef __linux__
+#  include <unistd.h>
+#endif // __linux__
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        // Resident memory of the process in bytes, 0 where we don't know how to read it.
+        uint64_t residentBytes()
+        {
+#ifdef __linux__
+            std::ifstream statm("/proc/self/statm");
+            uint64_t totalPages = 0;
+            uint64_t residentPages = 0;
+            if (statm >> totalPages >> residentPages)
+            {
+                return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+            }
+#endif // __linux__
+            return 0;
+        }
+
+        // Stands for a mesh generator: a strip of vertices, 3 floats each, touching every byte.
+        void generateMesh(void *data, uint64_t size)
+        {
+            float *vertices = static_cast<float *>(data);
+            uint64_t count = size / sizeof(float);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                vertices[i] = static_cast<float>(i / 3) * 0.001f + static_cast<float>(i % 3);
+            }
+        }
+
+        struct UploadResult
+        {
+            double ms = 0.0;
+            uint64_t residentGrowth = 0;
+        };
+
+        // Uploads size bytes, iterations times, in buffers of at most maxBufferSize. The time
+        // runs until the GPU has the data. The resident memory is sampled when the uploaded
+        // data takes the most room, so the growth is an estimate of the peak.
+        UploadResult timeUploads(wgpu::Device device, wgpu::Queue queue, bool mapped, uint64_t size, int iterations, uint64_t maxBufferSize)
+        {
+            UploadResult result;
+            uint64_t baseline = residentBytes();
+            uint64_t peak = baseline;
+            auto sample = [&peak](void *data, uint64_t bytes)
+            {
+                generateMesh(data, bytes);
+                peak = std::max(peak, residentBytes());
+            };
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i)
+            {
+                std::vector<wgpu::Buffer> buffers;
+                for (const BufferChunk &chunk : chunkRanges(size, sizeof(float), maxBufferSize))
+                {
+                    if (mapped)
+                    {
+                        buffers.push_back(createMappedBuffer(device, "Mapped upload", wgpu::BufferUsage::Vertex, chunk.size, sample));
+                    }
+                    else
+                    {
+                        // The usual path: build the data in a vector, then writeBuffer copies
+                        // it into a staging buffer. Both copies are alive at the sample.
+                        std::vector<uint8_t> data(chunk.size);
+                        generateMesh(data.data(), data.size());
+                        wgpu::BufferDescriptor bufferDesc;
+                        bufferDesc.label = "Written upload";
+                        bufferDesc.usage = wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+                        bufferDesc.size = data.size();
+                        bufferDesc.mappedAtCreation = false;
+                        wgpu::Buffer buffer = device.createBuffer(bufferDesc);
+                        queue.writeBuffer(buffer, 0, data.data(), data.size());
+                        peak = std::max(peak, residentBytes());
+                        buffers.push_back(buffer);
+                    }
+                }
+                waitForSubmittedWork(device, queue);
+                for (wgpu::Buffer &buffer : buffers)
+                {
+                    buffer.destroy();
+                    buffer.release();
+                }
+            }
+            result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            result.residentGrowth = peak - baseline;
+            return result;
+        }
+    } // namespace
+
+    wgpu::Buffer createMappedBuffer(wgpu::Device device, const char *label, WGPUBufferUsageFlags usage, uint64_t size, const BufferFiller &fill)
+    {
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = label;
+        bufferDesc.usage = usage;
+        // Mapped ranges have to be multiples of 4 bytes.
+        bufferDesc.size = (size + 3) & ~uint64_t(3);
+        bufferDesc.mappedAtCreation = true;
+        wgpu::Buffer buffer = device.createBuffer(bufferDesc);
+        void *data = buffer.getMappedRange(0, bufferDesc.size);
+        if (data)
+        {
+            fill(data, bufferDesc.size);
+        }
+        buffer.unmap();
+        return buffer;
+    }
+
+    void benchmarkUploads(wgpu::Device device, wgpu::Queue queue, uint64_t maxBufferSize, std::ostream &out)
+    {
+        const char *pathNames[] = {"writeBuffer", "mappedAtCreation"};
+        out << "size        path               MB/s     resident +MB" << std::endl;
+        for (uint64_t size = 1024; size <= 1024ull * 1024 * 1024; size *= 16)
+        {
+            // Small sizes are repeated so there is something to measure.
+            int iterations = static_cast<int>(std::clamp<uint64_t>((64ull * 1024 * 1024) / size, 1, 1000));
+            for (int path = 0; path < 2; ++path)
+            {
+                UploadResult result = timeUploads(device, queue, path == 1, size, iterations, maxBufferSize);
+                double megabytes = static_cast<double>(size) * iterations / (1024.0 * 1024.0);
+                out << std::left << std::setw(12) << size << std::setw(19) << pathNames[path] << std::right
+                    << std::fixed << std::setprecision(1) << std::setw(8) << (result.ms > 0.0 ? megabytes * 1000.0 / result.ms : 0.0)
+                    << std::setw(17) << static_cast<double>(result.residentGrowth) / (1024.0 * 1024.0)
+                    << std::defaultfloat << std::endl;
+            }
+        }
+    }
+} // namespace learn::webgpu
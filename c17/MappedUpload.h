@@ -0,0 +1,26 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+namespace learn::webgpu
+{
+
+    // Writes the content of a buffer, e.g. a mesh generator or a loader reading a file.
+    // size is the buffer size, a multiple of 4 bytes.
+    using BufferFiller = std::function<void(void *data, uint64_t size)>;
+
+    // Creates a buffer with mappedAtCreation, lets fill write straight into the mapped range
+    // and unmaps it. With writeBuffer the data is first built in a std::vector and then
+    // copied into a staging buffer, here it is written once, in place. The buffer doesn't
+    // need CopyDst, nothing is ever copied into it.
+    wgpu::Buffer createMappedBuffer(wgpu::Device device, const char *label, WGPUBufferUsageFlags usage, uint64_t size, const BufferFiller &fill);
+
+    // Uploads generated meshes from 1 KB to 1 GB with createMappedBuffer and with the usual
+    // std::vector + writeBuffer path, and prints the throughput and how much the resident
+    // memory grew. Sizes above maxBufferSize are split in several buffers.
+    void benchmarkUploads(wgpu::Device device, wgpu::Queue queue, uint64_t maxBufferSize, std::ostream &out);
+} // namespace learn::webgpu
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "MeshFile.h"
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif // _WIN32
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        constexpr uint64_t kDataAlignment = 4096;
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        uint64_t pageSize()
+        {
+#ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return info.dwPageSize;
+#else
+            return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif // _WIN32
+        }
+
+        void writePadding(std::ofstream &file, uint64_t size)
+        {
+            static const char kZeros[kDataAlignment] = {};
+            while (size > 0)
+            {
+                uint64_t chunk = std::min<uint64_t>(size, sizeof(kZeros));
+                file.write(kZeros, static_cast<std::streamsize>(chunk));
+                size -= chunk;
+            }
+        }
+    } // namespace
+
+    uint64_t MeshFilePart::end(const MeshFileHeader &header) const
+    {
+        uint64_t verticesEnd = vertexOffset + uint64_t(vertexCount) * header.bytesPerVertex;
+        uint64_t indicesEnd = indexOffset + uint64_t(indexCount) * header.indexSize;
+        return alignUp(std::max(verticesEnd, indicesEnd), 4);
+    }
+
+    bool writeMeshFile(const std::string &path, uint64_t layoutIdentity, uint32_t bytesPerVertex, uint32_t indexSize,
+                       const std::vector<MeshFilePartData> &parts, std::string &error)
+    {
+        MeshFileHeader header{};
+        std::memcpy(header.magic, kMeshFileMagic, sizeof(header.magic));
+        header.version = kMeshFileVersion;
+        header.partCount = static_cast<uint32_t>(parts.size());
+        header.layoutIdentity = layoutIdentity;
+        header.bytesPerVertex = bytesPerVertex;
+        header.indexSize = indexSize;
+        header.partTableOffset = sizeof(MeshFileHeader);
+        header.dataOffset = alignUp(header.partTableOffset + parts.size() * sizeof(MeshFilePart), kDataAlignment);
+
+        std::vector<MeshFilePart> table;
+        table.reserve(parts.size());
+        uint64_t offset = 0;
+        for (const MeshFilePartData &part : parts)
+        {
+            MeshFilePart entry{};
+            entry.vertexOffset = offset;
+            entry.vertexCount = part.vertexCount;
+            entry.indexOffset = alignUp(offset + uint64_t(part.vertexCount) * bytesPerVertex, 4);
+            entry.indexCount = part.indexCount;
+            offset = entry.end(header);
+            table.push_back(entry);
+        }
+        header.dataSize = offset;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            error = "can't create " + path;
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(MeshFilePart)));
+        writePadding(file, header.dataOffset - header.partTableOffset - table.size() * sizeof(MeshFilePart));
+        for (size_t i = 0; i < parts.size(); ++i)
+        {
+            uint64_t vertexBytes = uint64_t(parts[i].vertexCount) * bytesPerVertex;
+            uint64_t indexBytes = uint64_t(parts[i].indexCount) * indexSize;
+            file.write(reinterpret_cast<const char *>(parts[i].vertices), static_cast<std::streamsize>(vertexBytes));
+            writePadding(file, table[i].indexOffset - table[i].vertexOffset - vertexBytes);
+            file.write(reinterpret_cast<const char *>(parts[i].indices), static_cast<std::streamsize>(indexBytes));
+            writePadding(file, table[i].end(header) - table[i].indexOffset - indexBytes);
+        }
+        if (!file)
+        {
+            error = "can't write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool MeshFile::open(const std::string &path, std::string &error)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+        {
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            error = "can't open " + path;
+            return false;
+        }
+        mFile = file;
+        mFileSize = static_cast<uint64_t>(fileSize.QuadPart);
+        mFileMapping = mFileSize ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (mFileMapping)
+        {
+            mMapping = static_cast<const uint8_t *>(MapViewOfFile(mFileMapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (file < 0 || fstat(file, &status) != 0)
+        {
+            if (file >= 0)
+                ::close(file);
+            error = "can't open " + path;
+            return false;
+        }
+        mFileSize = static_cast<uint64_t>(status.st_size);
+        void *mapping = mFileSize ? mmap(nullptr, mFileSize, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+        // The mapping keeps the file alive.
+        ::close(file);
+        if (mapping != MAP_FAILED)
+        {
+            mMapping = static_cast<const uint8_t *>(mapping);
+            // We read it front to back once, the system can read ahead.
+            madvise(mapping, mFileSize, MADV_SEQUENTIAL);
+        }
+#endif // _WIN32
+        if (!mMapping)
+        {
+            close();
+            error = "can't map " + path;
+            return false;
+        }
+
+        if (mFileSize < sizeof(MeshFileHeader))
+        {
+            close();
+            error = path + " is too small to be a mesh file";
+            return false;
+        }
+        std::memcpy(&mHeader, mMapping, sizeof(mHeader));
+        if (std::memcmp(mHeader.magic, kMeshFileMagic, sizeof(kMeshFileMagic)) != 0 || mHeader.version != kMeshFileVersion)
+        {
+            close();
+            error = path + " is not a mesh file of version " + std::to_string(kMeshFileVersion);
+            return false;
+        }
+        // Every check subtracts from a bound that is already known to hold instead of adding
+        // offsets and sizes read from the file, a corrupted file can't wrap them around.
+        bool valid = (mHeader.indexSize == 2 || mHeader.indexSize == 4) && mHeader.bytesPerVertex % 4 == 0 && mHeader.bytesPerVertex > 0 &&
+                     mHeader.dataOffset <= mFileSize && mHeader.dataSize <= mFileSize - mHeader.dataOffset &&
+                     mHeader.partTableOffset <= mHeader.dataOffset &&
+                     mHeader.partCount <= (mHeader.dataOffset - mHeader.partTableOffset) / sizeof(MeshFilePart);
+        if (valid)
+        {
+            mParts.resize(mHeader.partCount);
+            std::memcpy(mParts.data(), mMapping + mHeader.partTableOffset, mParts.size() * sizeof(MeshFilePart));
+            uint64_t previousEnd = 0;
+            for (const MeshFilePart &part : mParts)
+            {
+                // Parts are contiguous and in order, the streaming relies on it. The counts are
+                // 32 bit, so their byte sizes can't overflow.
+                uint64_t vertexBytes = uint64_t(part.vertexCount) * mHeader.bytesPerVertex;
+                uint64_t indexBytes = uint64_t(part.indexCount) * mHeader.indexSize;
+                valid = valid && part.vertexOffset == previousEnd && vertexBytes <= mHeader.dataSize - part.vertexOffset &&
+                        part.indexOffset % 4 == 0 && part.indexOffset >= part.vertexOffset && part.indexOffset <= mHeader.dataSize &&
+                        part.indexOffset - part.vertexOffset >= vertexBytes && indexBytes <= mHeader.dataSize - part.indexOffset &&
+                        part.end(mHeader) <= mHeader.dataSize;
+                if (!valid)
+                {
+                    break;
+                }
+                previousEnd = part.end(mHeader);
+            }
+        }
+        if (!valid)
+        {
+            close();
+            error = path + " is corrupted";
+            return false;
+        }
+        return true;
+    }
+
+    void MeshFile::close()
+    {
+#ifdef _WIN32
+        if (mMapping)
+            UnmapViewOfFile(mMapping);
+        if (mFileMapping)
+            CloseHandle(mFileMapping);
+        if (mFile)
+            CloseHandle(mFile);
+        mFile = nullptr;
+        mFileMapping = nullptr;
+#else
+        if (mMapping)
+            munmap(const_cast<uint8_t *>(mMapping), mFileSize);
+#endif // _WIN32
+        mMapping = nullptr;
+        mFileSize = 0;
+        mHeader = MeshFileHeader{};
+        mParts.clear();
+    }
+
+    void MeshFile::discard(uint64_t offset, uint64_t size)
+    {
+        if (!mMapping)
+            return;
+        // Only whole pages can be dropped, the ones partly outside the range stay.
+        uint64_t page = pageSize();
+        uint64_t begin = alignUp(mHeader.dataOffset + offset, page);
+        uint64_t end = (mHeader.dataOffset + offset + size) / page * page;
+        if (begin >= end)
+            return;
+        void *address = const_cast<uint8_t *>(mMapping + begin);
+#ifdef _WIN32
+        // Not locked, so this takes the pages out of the working set.
+        VirtualUnlock(address, end - begin);
+#else
+        madvise(address, end - begin, MADV_DONTNEED);
+#endif // _WIN32
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // A mesh on disk, ready for the GPU: the vertices are already packed by a VertexLayout
+    // and the indices are in their final format, so loading is only copying bytes.
+    //
+    // The mesh is cut in parts of at most 65536 vertices, each with its own vertices and
+    // 16 bit indices (see IndexPacking), stored one after the other:
+    //
+    //   header | part table | padding to 4096 | part 0 vertices, indices | part 1 ...
+    //
+    // Every section starts at a multiple of 4 bytes, so any run of whole parts can be copied
+    // into a buffer as it is and drawn with the offsets from the part table. Little endian.
+    struct MeshFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t partCount;
+        // VertexLayout::identity() of the layout that packed the vertices.
+        uint64_t layoutIdentity;
+        uint32_t bytesPerVertex;
+        // 2 or 4.
+        uint32_t indexSize;
+        uint64_t partTableOffset;
+        uint64_t dataOffset;
+        uint64_t dataSize;
+        uint64_t reserved;
+    };
+    static_assert(sizeof(MeshFileHeader) == 64, "the header is read straight from the file");
+
+    // Offsets are relative to the data section.
+    struct MeshFilePart
+    {
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+
+        // The part's bytes are [vertexOffset, end()).
+        uint64_t end(const MeshFileHeader &header) const;
+    };
+    static_assert(sizeof(MeshFilePart) == 24, "the part table is read straight from the file");
+
+    constexpr char kMeshFileMagic[8] = {'L', 'W', 'G', 'M', 'E', 'S', 'H', '\0'};
+    constexpr uint32_t kMeshFileVersion = 1;
+
+    struct MeshFilePartData
+    {
+        const uint8_t *vertices = nullptr;
+        uint32_t vertexCount = 0;
+        const uint8_t *indices = nullptr;
+        uint32_t indexCount = 0;
+    };
+
+    bool writeMeshFile(const std::string &path, uint64_t layoutIdentity, uint32_t bytesPerVertex, uint32_t indexSize,
+                       const std::vector<MeshFilePartData> &parts, std::string &error);
+
+    // A mesh file mapped in memory. Nothing is read until the bytes are touched, and
+    // discard() gives pages that were uploaded back to the system, so even a file bigger
+    // than the RAM streams through a bounded amount of it.
+    class MeshFile
+    {
+    public:
+        MeshFile() = default;
+        ~MeshFile() { close(); }
+        MeshFile(const MeshFile &) = delete;
+        MeshFile &operator=(const MeshFile &) = delete;
+
+        // Maps the file and checks its header and part table.
+        bool open(const std::string &path, std::string &error);
+        void close();
+        bool isOpen() const { return mMapping != nullptr; }
+
+        const MeshFileHeader &header() const { return mHeader; }
+        const std::vector<MeshFilePart> &parts() const { return mParts; }
+        // Points into the data section.
+        const uint8_t *data(uint64_t offset) const { return mMapping + mHeader.dataOffset + offset; }
+        // Drops the pages of the data section range from memory, they are read again from
+        // the file if they are ever touched again.
+        void discard(uint64_t offset, uint64_t size);
+
+    private:
+        const uint8_t *mMapping = nullptr;
+        uint64_t mFileSize = 0;
+#ifdef _WIN32
+        void *mFile = nullptr;
+        void *mFileMapping = nullptr;
+#endif // _WIN32
+        MeshFileHeader mHeader{};
+        std::vector<MeshFilePart> mParts;
+    };
+} // namespace learn::webgpu
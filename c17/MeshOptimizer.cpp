@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "Hash.h"
+#include "MeshOptimizer.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        constexpr uint32_t kNoVertex = ~uint32_t(0);
+
+        struct Vec3
+        {
+            float x = 0.0f;
+            float y = 0.0f;
+            float z = 0.0f;
+        };
+
+        Vec3 position(const MeshData &mesh, uint32_t vertex)
+        {
+            const float *data = mesh.vertices.data() + static_cast<size_t>(vertex) * mesh.floatsPerVertex;
+            Vec3 p;
+            p.x = data[0];
+            p.y = mesh.positionComponents > 1 ? data[1] : 0.0f;
+            p.z = mesh.positionComponents > 2 ? data[2] : 0.0f;
+            return p;
+        }
+
+        // Tipsify's fallback when the fanning vertex has nothing left: the most recent vertex
+        // that still has triangles, else the next one in index order.
+        uint32_t skipDeadEnd(const std::vector<uint32_t> &liveTriangles, std::vector<uint32_t> &deadEnds, uint32_t &cursor)
+        {
+            while (!deadEnds.empty())
+            {
+                uint32_t vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex] > 0)
+                    return vertex;
+            }
+            while (cursor < liveTriangles.size())
+            {
+                if (liveTriangles[cursor] > 0)
+                    return cursor;
+                ++cursor;
+            }
+            return kNoVertex;
+        }
+    } // namespace
+
+    VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+    {
+        VertexCacheStatistics statistics;
+        statistics.triangles = static_cast<uint32_t>(indices.size() / 3);
+        statistics.vertices = vertexCount;
+
+        // Cache entry time stamps: a vertex is in the FIFO if it entered less than cacheSize misses ago.
+        std::vector<uint32_t> enteredAt(vertexCount, 0);
+        uint32_t misses = 0;
+        for (uint32_t index : indices)
+        {
+            if (enteredAt[index] == 0 || misses - enteredAt[index] + 1 > cacheSize)
+            {
+                ++misses;
+                enteredAt[index] = misses;
+            }
+        }
+        statistics.transformedVertices = misses;
+        statistics.acmr = statistics.triangles ? static_cast<float>(misses) / statistics.triangles : 0.0f;
+        statistics.atvr = vertexCount ? static_cast<float>(misses) / vertexCount : 0.0f;
+        return statistics;
+    }
+
+    MeshData weldVertices(const std::vector<float> &soup, uint32_t floatsPerVertex, uint32_t positionComponents)
+    {
+        MeshData mesh;
+        mesh.floatsPerVertex = floatsPerVertex;
+        mesh.positionComponents = positionComponents;
+        size_t vertexBytes = floatsPerVertex * sizeof(float);
+        size_t soupCount = soup.size() / floatsPerVertex;
+        mesh.indices.reserve(soupCount);
+
+        // Hash of the vertex bytes to the welded vertices having it, collisions are told
+        // apart by comparing the bytes.
+        std::unordered_multimap<uint64_t, uint32_t> known;
+        known.reserve(soupCount);
+        for (size_t i = 0; i < soupCount; ++i)
+        {
+            const float *vertex = soup.data() + i * floatsPerVertex;
+            uint64_t hash = hashBytes(vertex, vertexBytes);
+            uint32_t index = kNoVertex;
+            auto candidates = known.equal_range(hash);
+            for (auto it = candidates.first; it != candidates.second; ++it)
+            {
+                if (std::memcmp(mesh.vertices.data() + static_cast<size_t>(it->second) * floatsPerVertex, vertex, vertexBytes) == 0)
+                {
+                    index = it->second;
+                    break;
+                }
+            }
+            if (index == kNoVertex)
+            {
+                index = mesh.vertexCount();
+                mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + floatsPerVertex);
+                known.emplace(hash, index);
+            }
+            mesh.indices.push_back(index);
+        }
+        return mesh;
+    }
+
+    std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+    {
+        uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+        std::vector<uint32_t> clusters;
+        if (triangleCount == 0)
+            return clusters;
+
+        // Triangles using each vertex, as offsets into one array.
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (uint32_t index : indices)
+            ++liveTriangles[index];
+        std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+        for (uint32_t v = 0; v < vertexCount; ++v)
+            adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+        std::vector<uint32_t> adjacency(indices.size());
+        std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (uint32_t t = 0; t < triangleCount; ++t)
+        {
+            for (int c = 0; c < 3; ++c)
+                adjacency[fill[indices[3 * t + c]]++] = t;
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+        // Time stamps start past the cache size, so no vertex counts as cached at first.
+        uint32_t time = cacheSize + 1;
+        uint32_t cursor = 0;
+        uint32_t fanning = skipDeadEnd(liveTriangles, deadEnds, cursor);
+        clusters.push_back(0);
+
+        std::vector<uint32_t> candidates;
+        while (fanning != kNoVertex)
+        {
+            candidates.clear();
+            for (uint32_t a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; ++a)
+            {
+                uint32_t t = adjacency[a];
+                if (emitted[t])
+                    continue;
+                for (int c = 0; c < 3; ++c)
+                {
+                    uint32_t v = indices[3 * t + c];
+                    output.push_back(v);
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    --liveTriangles[v];
+                    if (time - cacheTime[v] > cacheSize)
+                        cacheTime[v] = time++;
+                }
+                emitted[t] = true;
+            }
+
+            // Next fanning vertex: the candidate that will still be in the cache after its
+            // remaining triangles are emitted, and has been there the longest.
+            uint32_t next = kNoVertex;
+            int best = -1;
+            for (uint32_t v : candidates)
+            {
+                if (liveTriangles[v] == 0)
+                    continue;
+                int priority = 0;
+                if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                    priority = static_cast<int>(time - cacheTime[v]);
+                if (priority > best)
+                {
+                    best = priority;
+                    next = v;
+                }
+            }
+            if (next == kNoVertex)
+            {
+                next = skipDeadEnd(liveTriangles, deadEnds, cursor);
+                if (next != kNoVertex && output.size() < indices.size())
+                    clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+            }
+            fanning = next;
+        }
+
+        indices = std::move(output);
+        return clusters;
+    }
+
+    void optimizeOverdraw(MeshData &mesh, const std::vector<uint32_t> &clusters, float threshold)
+    {
+        uint32_t triangleCount = mesh.triangleCount();
+        if (clusters.size() < 2)
+            return;
+
+        struct Cluster
+        {
+            uint32_t first;
+            uint32_t end;
+            float sortKey;
+        };
+        std::vector<Cluster> sorted;
+        Vec3 meshCentroid;
+        float meshArea = 0.0f;
+        std::vector<Vec3> centroids(clusters.size());
+        std::vector<Vec3> normals(clusters.size());
+        std::vector<float> areas(clusters.size(), 0.0f);
+        for (size_t c = 0; c < clusters.size(); ++c)
+        {
+            uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            sorted.push_back(Cluster{clusters[c], end, 0.0f});
+            for (uint32_t t = clusters[c]; t < end; ++t)
+            {
+                Vec3 a = position(mesh, mesh.indices[3 * t]);
+                Vec3 b = position(mesh, mesh.indices[3 * t + 1]);
+                Vec3 p = position(mesh, mesh.indices[3 * t + 2]);
+                Vec3 u{b.x - a.x, b.y - a.y, b.z - a.z};
+                Vec3 v{p.x - a.x, p.y - a.y, p.z - a.z};
+                // Twice the area, pointing out of the front face.
+                Vec3 n{u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x};
+                float area = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+                normals[c].x += n.x;
+                normals[c].y += n.y;
+                normals[c].z += n.z;
+                centroids[c].x += (a.x + b.x + p.x) / 3.0f * area;
+                centroids[c].y += (a.y + b.y + p.y) / 3.0f * area;
+                centroids[c].z += (a.z + b.z + p.z) / 3.0f * area;
+                areas[c] += area;
+            }
+            meshCentroid.x += centroids[c].x;
+            meshCentroid.y += centroids[c].y;
+            meshCentroid.z += centroids[c].z;
+            meshArea += areas[c];
+        }
+        if (meshArea <= 0.0f)
+            return;
+        meshCentroid = Vec3{meshCentroid.x / meshArea, meshCentroid.y / meshArea, meshCentroid.z / meshArea};
+
+        // How far out the cluster faces: clusters on the outside of the mesh come first.
+        for (size_t c = 0; c < clusters.size(); ++c)
+        {
+            if (areas[c] <= 0.0f)
+                continue;
+            Vec3 centroid{centroids[c].x / areas[c], centroids[c].y / areas[c], centroids[c].z / areas[c]};
+            sorted[c].sortKey = (centroid.x - meshCentroid.x) * normals[c].x + (centroid.y - meshCentroid.y) * normals[c].y +
+                                (centroid.z - meshCentroid.z) * normals[c].z;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b)
+                         { return a.sortKey > b.sortKey; });
+
+        std::vector<uint32_t> reordered;
+        reordered.reserve(mesh.indices.size());
+        for (const Cluster &cluster : sorted)
+        {
+            reordered.insert(reordered.end(), mesh.indices.begin() + 3 * cluster.first, mesh.indices.begin() + 3 * cluster.end);
+        }
+
+        // Clusters were cut where the cache starts over anyway, but check it.
+        float before = analyzeVertexCache(mesh.indices, mesh.vertexCount()).acmr;
+        float after = analyzeVertexCache(reordered, mesh.vertexCount()).acmr;
+        if (after <= before * threshold)
+            mesh.indices = std::move(reordered);
+    }
+
+    void optimizeVertexFetch(MeshData &mesh)
+    {
+        uint32_t vertexCount = mesh.vertexCount();
+        std::vector<uint32_t> remap(vertexCount, kNoVertex);
+        std::vector<float> vertices;
+        vertices.reserve(mesh.vertices.size());
+        uint32_t next = 0;
+        for (uint32_t &index : mesh.indices)
+        {
+            if (remap[index] == kNoVertex)
+            {
+                remap[index] = next++;
+                const float *vertex = mesh.vertices.data() + static_cast<size_t>(index) * mesh.floatsPerVertex;
+                vertices.insert(vertices.end(), vertex, vertex + mesh.floatsPerVertex);
+            }
+            index = remap[index];
+        }
+        // Vertices no triangle uses are dropped.
+        mesh.vertices = std::move(vertices);
+    }
+
+    void MeshOptimizationReport::report(std::ostream &out, const std::string &name) const
+    {
+        out << name << ": " << after.triangles << " triangles, " << before.vertices << " -> " << after.vertices << " vertices, ACMR "
+            << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    }
+
+    MeshOptimizationReport optimizeMesh(MeshData &mesh)
+    {
+        MeshOptimizationReport report;
+        report.before = analyzeVertexCache(mesh.indices, mesh.vertexCount());
+        std::vector<uint32_t> clusters = optimizeVertexCache(mesh.indices, mesh.vertexCount());
+        optimizeOverdraw(mesh, clusters);
+        optimizeVertexFetch(mesh);
+        report.after = analyzeVertexCache(mesh.indices, mesh.vertexCount());
+        return report;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // A mesh as the optimizer sees it: floatsPerVertex floats per vertex, the position first
+    // (positionComponents of them, 2 or 3), and a triangle list.
+    struct MeshData
+    {
+        std::vector<float> vertices;
+        uint32_t floatsPerVertex = 0;
+        uint32_t positionComponents = 3;
+        std::vector<uint32_t> indices;
+
+        uint32_t vertexCount() const { return floatsPerVertex ? static_cast<uint32_t>(vertices.size() / floatsPerVertex) : 0; }
+        uint32_t triangleCount() const { return static_cast<uint32_t>(indices.size() / 3); }
+    };
+
+    // Post-transform vertex cache of a typical GPU, simulated as a FIFO.
+    constexpr uint32_t kVertexCacheSize = 16;
+
+    struct VertexCacheStatistics
+    {
+        uint32_t triangles = 0;
+        uint32_t vertices = 0;
+        // Vertex shader invocations with a FIFO cache of cacheSize entries.
+        uint32_t transformedVertices = 0;
+        // Average cache miss ratio: invocations per triangle, 0.5 at best for big grids, 3 at worst.
+        float acmr = 0.0f;
+        // Average transform to vertex ratio: invocations per vertex, 1 at best.
+        float atvr = 0.0f;
+    };
+
+    VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = kVertexCacheSize);
+
+    // Turns an unindexed triangle list (every 3 vertices a triangle) into unique vertices and
+    // indices. Vertices are merged when all their floats are bit for bit the same.
+    MeshData weldVertices(const std::vector<float> &soup, uint32_t floatsPerVertex, uint32_t positionComponents);
+
+    // Reorders the triangles so that vertices are reused while they are still in the cache,
+    // with Tipsify (Sander, Nehab, Barczak 2007). Returns the first triangle of every cluster:
+    // the places where the algorithm had to jump elsewhere in the mesh, which is where
+    // optimizeOverdraw may cut without hurting the cache.
+    std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = kVertexCacheSize);
+
+    // Draws the clusters that face outwards first, so they hide the ones behind them and
+    // fewer fragments get shaded twice. The order is kept only if the ACMR stays within
+    // threshold times the one of the cache optimized order.
+    void optimizeOverdraw(MeshData &mesh, const std::vector<uint32_t> &clusters, float threshold = 1.05f);
+
+    // Renumbers the vertices in the order the indices first use them, so the vertex fetch
+    // walks through memory instead of jumping around.
+    void optimizeVertexFetch(MeshData &mesh);
+
+    struct MeshOptimizationReport
+    {
+        VertexCacheStatistics before;
+        VertexCacheStatistics after;
+
+        void report(std::ostream &out, const std::string &name) const;
+    };
+
+    // Runs the cache, overdraw and fetch stages on an indexed mesh.
+    MeshOptimizationReport optimizeMesh(MeshData &mesh);
+} // namespace learn::webgpu
@@ -0,0 +1,194 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+#include "GpuHelpers.h"
+#include "MeshStream.h"
+
+namespace learn::webgpu
+{
+
+    bool MeshStream::open(const std::string &path, uint64_t layoutIdentity, uint64_t bytesPerVertex, uint64_t maxBufferSize, std::string &error)
+    {
+        close();
+        if (!mFile.open(path, error))
+        {
+            return false;
+        }
+        const MeshFileHeader &header = mFile.header();
+        if (header.layoutIdentity != layoutIdentity || header.bytesPerVertex != bytesPerVertex)
+        {
+            error = path + " was written with another vertex layout, write it again with the current options";
+            mFile.close();
+            return false;
+        }
+
+        // Whole parts per page, so every draw reads a single buffer.
+        uint64_t pageLimit = std::min(kMaxPageSize, maxBufferSize) & ~uint64_t(3);
+        const std::vector<MeshFilePart> &parts = mFile.parts();
+        for (uint32_t i = 0; i < parts.size(); ++i)
+        {
+            uint64_t start = parts[i].vertexOffset;
+            uint64_t end = parts[i].end(header);
+            if (end - start > pageLimit)
+            {
+                error = path + " has a part bigger than a buffer can be";
+                close();
+                return false;
+            }
+            if (mPages.empty() || end - mPages.back().start > pageLimit)
+            {
+                Page page;
+                page.start = start;
+                page.firstPart = i;
+                mPages.push_back(page);
+            }
+            mPages.back().end = end;
+            ++mPages.back().partCount;
+        }
+        return true;
+    }
+
+    void MeshStream::close()
+    {
+        stop();
+        mFile.close();
+        mPages.clear();
+        mReadyDraws.clear();
+        mUploaded = 0;
+        mPage = 0;
+    }
+
+    void MeshStream::releaseBuffers()
+    {
+        for (Page &page : mPages)
+        {
+            if (page.buffer)
+            {
+                page.buffer.destroy();
+                page.buffer.release();
+                page.buffer = nullptr;
+            }
+        }
+    }
+
+    void MeshStream::stop()
+    {
+        releaseBuffers();
+        mBelt.release();
+        mReadyDraws.clear();
+    }
+
+    void MeshStream::start(wgpu::Device device)
+    {
+        releaseBuffers();
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Mesh page";
+        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Vertex | wgpu::BufferUsage::Index;
+        bufferDesc.mappedAtCreation = false;
+        for (Page &page : mPages)
+        {
+            bufferDesc.size = page.end - page.start;
+            page.buffer = device.createBuffer(bufferDesc);
+        }
+        mBelt.create(device);
+        mUploaded = 0;
+        mPage = 0;
+        mReadyDraws.clear();
+        mStartTime = std::chrono::steady_clock::now();
+        mFirstDrawMs = -1.0;
+        mCompleteMs = -1.0;
+    }
+
+    void MeshStream::pump(wgpu::CommandEncoder encoder, uint64_t budget)
+    {
+        if (!isOpen() || complete())
+        {
+            return;
+        }
+        // Chunks whose copies are done come back mapped.
+        mBelt.poll();
+
+        uint64_t pumped = 0;
+        while (mPage < mPages.size() && pumped < budget)
+        {
+            Page &page = mPages[mPage];
+            uint64_t size = std::min({page.end - mUploaded, mBelt.chunkSize(), budget - pumped}) & ~uint64_t(3);
+            if (size == 0)
+            {
+                break;
+            }
+            uint64_t source = mUploaded;
+            auto copyFromFile = [this, source](void *data, uint64_t bytes)
+            {
+                std::memcpy(data, mFile.data(source), bytes);
+            };
+            if (!mBelt.upload(encoder, page.buffer, source - page.start, size, copyFromFile))
+            {
+                break;
+            }
+            // Uploaded, the pages of the mapping can go.
+            mFile.discard(source, size);
+            mUploaded += size;
+            pumped += size;
+            if (mUploaded == page.end)
+            {
+                ++mPage;
+            }
+        }
+
+        // The copies come before the render pass in the same encoder, so the parts they
+        // complete can be drawn this very frame.
+        const MeshFileHeader &header = mFile.header();
+        const std::vector<MeshFilePart> &parts = mFile.parts();
+        size_t page = 0;
+        for (size_t i = mReadyDraws.size(); i < parts.size() && parts[i].end(header) <= mUploaded; ++i)
+        {
+            while (mPages[page].firstPart + mPages[page].partCount <= i)
+            {
+                ++page;
+            }
+            Draw draw;
+            draw.buffer = mPages[page].buffer;
+            draw.vertexOffset = parts[i].vertexOffset - mPages[page].start;
+            draw.vertexSize = uint64_t(parts[i].vertexCount) * header.bytesPerVertex;
+            draw.indexOffset = parts[i].indexOffset - mPages[page].start;
+            draw.indexSize = uint64_t(parts[i].indexCount) * header.indexSize;
+            draw.indexCount = parts[i].indexCount;
+            mReadyDraws.push_back(draw);
+        }
+        if (mFirstDrawMs < 0.0 && !mReadyDraws.empty())
+        {
+            mFirstDrawMs = elapsedMs(mStartTime);
+        }
+        if (mCompleteMs < 0.0 && complete())
+        {
+            mCompleteMs = elapsedMs(mStartTime);
+        }
+    }
+
+    wgpu::IndexFormat MeshStream::indexFormat() const
+    {
+        return mFile.header().indexSize == 2 ? wgpu::IndexFormat::Uint16 : wgpu::IndexFormat::Uint32;
+    }
+
+    void MeshStream::report(std::ostream &out) const
+    {
+        const MeshFileHeader &header = mFile.header();
+        out << "mesh stream: " << mUploaded << "/" << header.dataSize << " bytes, " << mReadyDraws.size() << "/" << header.partCount
+            << " parts in " << mPages.size() << " pages";
+        if (mFirstDrawMs >= 0.0)
+        {
+            out << ", first part after " << std::fixed << std::setprecision(1) << mFirstDrawMs << " ms";
+        }
+        if (mCompleteMs > 0.0)
+        {
+            out << ", complete after " << mCompleteMs << " ms ("
+                << static_cast<double>(header.dataSize) / (1024.0 * 1024.0) * 1000.0 / mCompleteMs << " MB/s)";
+        }
+        out << std::defaultfloat << std::endl;
+        mBelt.report(out);
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "MeshFile.h"
+#include "StagingBelt.h"
+
+namespace learn::webgpu
+{
+
+    // Uploads a MeshFile a few chunks per frame while we already draw what has arrived.
+    // The data section is split in pages of whole parts, one GPU buffer each, and copied in
+    // file order through a StagingBelt straight from the mapping. A part can be drawn as
+    // soon as its last byte is copied, so big scenes show up progressively and the memory
+    // used is the belt plus the file pages in flight, whatever the size of the file.
+    class MeshStream
+    {
+    public:
+        static constexpr uint64_t kChunkSize = 4 * 1024 * 1024;
+        static constexpr uint32_t kChunkCount = 4;
+        static constexpr uint64_t kMaxPageSize = 256 * 1024 * 1024;
+
+        MeshStream() = default;
+        ~MeshStream() { close(); }
+        MeshStream(const MeshStream &) = delete;
+        MeshStream &operator=(const MeshStream &) = delete;
+
+        // Opens and checks the file, layoutIdentity and bytesPerVertex are the ones the
+        // pipeline expects. Pages are at most maxBufferSize bytes.
+        bool open(const std::string &path, uint64_t layoutIdentity, uint64_t bytesPerVertex, uint64_t maxBufferSize, std::string &error);
+        bool isOpen() const { return mFile.isOpen(); }
+        void close();
+
+        // Creates the buffers on device and starts from the first byte, also after a device
+        // loss: the file is our copy of the data.
+        void start(wgpu::Device device);
+        // Releases the buffers, before the device goes away. The file stays open.
+        void stop();
+
+        // Records the copies of the next chunks in encoder, before the render pass that draws
+        // them. Uploads up to budget bytes, less when the belt is full.
+        void pump(wgpu::CommandEncoder encoder, uint64_t budget);
+        // Around the submit of the encoder given to pump(), see StagingBelt.
+        void finish() { mBelt.finish(); }
+        void submitted() { mBelt.submitted(); }
+
+        bool complete() const { return mUploaded == mFile.header().dataSize; }
+        wgpu::IndexFormat indexFormat() const;
+
+        // A part whose data is on the GPU, ranges of a page buffer.
+        struct Draw
+        {
+            wgpu::Buffer buffer = nullptr;
+            uint64_t vertexOffset = 0;
+            uint64_t vertexSize = 0;
+            uint64_t indexOffset = 0;
+            uint64_t indexSize = 0;
+            uint32_t indexCount = 0;
+        };
+        const std::vector<Draw> &readyDraws() const { return mReadyDraws; }
+
+        void report(std::ostream &out) const;
+
+    private:
+        struct Page
+        {
+            uint64_t start = 0;
+            uint64_t end = 0;
+            uint32_t firstPart = 0;
+            uint32_t partCount = 0;
+            wgpu::Buffer buffer = nullptr;
+        };
+
+        void releaseBuffers();
+
+        MeshFile mFile;
+        StagingBelt mBelt{kChunkSize, kChunkCount};
+        std::vector<Page> mPages;
+        // Bytes of the data section copied so far, and the page they go to.
+        uint64_t mUploaded = 0;
+        size_t mPage = 0;
+        std::vector<Draw> mReadyDraws;
+
+        std::chrono::steady_clock::time_point mStartTime;
+        double mFirstDrawMs = -1.0;
+        double mCompleteMs = -1.0;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,263 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "CullingShader.h"
+#include "GpuCulling.h"
+#include "GpuHelpers.h"
+#include "GpuTimeline.h"
+#include "ParallelRecorder.h"
+
+namespace learn::webgpu
+{
+
+    ParallelRecorder::ParallelRecorder(uint32_t threadCount)
+    {
+        // Emscripten builds have no threads by default, everything is recorded by the caller.
+#ifndef __EMSCRIPTEN__
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (uint32_t i = 1; i < threadCount; ++i)
+        {
+            mWorkers.emplace_back([this]()
+                                  { workerLoop(); });
+        }
+#else
+        (void)threadCount;
+#endif
+    }
+
+    ParallelRecorder::~ParallelRecorder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_all();
+        for (std::thread &worker : mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+    std::vector<RecordPartition> ParallelRecorder::partition(uint32_t itemCount, uint32_t minItems) const
+    {
+        uint32_t count = std::min(threadCount(), std::max(1u, itemCount / std::max(minItems, 1u)));
+        std::vector<RecordPartition> partitions(count);
+        // The first itemCount % count partitions take one item more.
+        uint32_t first = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t size = itemCount / count + (i < itemCount % count ? 1 : 0);
+            partitions[i] = RecordPartition{i, first, first + size};
+            first += size;
+        }
+        return partitions;
+    }
+
+    std::vector<wgpu::RenderBundle> ParallelRecorder::recordBundles(wgpu::Device device, wgpu::TextureFormat colorFormat, uint32_t itemCount,
+                                                                    uint32_t minItems, const BundleRecorder &record)
+    {
+        const std::vector<RecordPartition> partitions = partition(itemCount, minItems);
+        std::vector<wgpu::RenderBundle> bundles(partitions.size(), nullptr);
+        run(static_cast<uint32_t>(partitions.size()), [&](uint32_t i)
+            {
+                wgpu::RenderBundleEncoderDescriptor encoderDesc;
+                encoderDesc.label = "Partition bundle encoder";
+                encoderDesc.colorFormatCount = 1;
+                encoderDesc.colorFormats = (WGPUTextureFormat *)&colorFormat;
+                encoderDesc.depthStencilFormat = wgpu::TextureFormat::Undefined;
+                encoderDesc.sampleCount = 1;
+                encoderDesc.depthReadOnly = false;
+                encoderDesc.stencilReadOnly = false;
+                wgpu::RenderBundleEncoder encoder = device.createRenderBundleEncoder(encoderDesc);
+                record(encoder, partitions[i]);
+                wgpu::RenderBundleDescriptor bundleDesc;
+                bundleDesc.label = "Partition bundle";
+                // Each task writes its own element, the order is the partitions' whoever ran them.
+                bundles[i] = encoder.finish(bundleDesc);
+                encoder.release(); });
+        return bundles;
+    }
+
+    std::vector<wgpu::CommandBuffer> ParallelRecorder::recordCommandBuffers(wgpu::Device device, uint32_t itemCount, uint32_t minItems,
+                                                                            const CommandRecorder &record)
+    {
+        const std::vector<RecordPartition> partitions = partition(itemCount, minItems);
+        std::vector<wgpu::CommandBuffer> commands(partitions.size(), nullptr);
+        run(static_cast<uint32_t>(partitions.size()), [&](uint32_t i)
+            {
+                wgpu::CommandEncoderDescriptor encoderDesc = {};
+                encoderDesc.label = "Partition encoder";
+                wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+                record(encoder, partitions[i]);
+                wgpu::CommandBufferDescriptor commandDesc = {};
+                commandDesc.label = "Partition command buffer";
+                commands[i] = encoder.finish(commandDesc);
+                encoder.release(); });
+        return commands;
+    }
+
+    void ParallelRecorder::run(uint32_t count, const std::function<void(uint32_t)> &task)
+    {
+        if (mWorkers.empty() || count <= 1)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                task(i);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTask = &task;
+            mTaskCount = count;
+            mNextTask = 0;
+            mFinishedTasks = 0;
+            ++mGeneration;
+        }
+        mWake.notify_all();
+        // The calling thread is one of the recorders, not just waiting for them.
+        drain(task, count);
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this]()
+                   { return mFinishedTasks == mTaskCount && mBusyWorkers == 0; });
+        mTask = nullptr;
+    }
+
+    void ParallelRecorder::workerLoop()
+    {
+        uint64_t generation = 0;
+        for (;;)
+        {
+            const std::function<void(uint32_t)> *task = nullptr;
+            uint32_t count = 0;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [&]()
+                           { return mStopping || (mTask && mGeneration != generation); });
+                if (mStopping)
+                {
+                    return;
+                }
+                generation = mGeneration;
+                task = mTask;
+                count = mTaskCount;
+                ++mBusyWorkers;
+            }
+            drain(*task, count);
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                --mBusyWorkers;
+            }
+            mDone.notify_one();
+        }
+    }
+
+    void ParallelRecorder::drain(const std::function<void(uint32_t)> &task, uint32_t count)
+    {
+        for (uint32_t i = mNextTask++; i < count; i = mNextTask++)
+        {
+            task(i);
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mFinishedTasks;
+        }
+    }
+
+    void benchmarkParallelRecording(wgpu::Device device, wgpu::Queue queue, uint32_t threadCount, std::ostream &out)
+    {
+        BenchmarkScene scene = createBenchmarkScene(device);
+        const std::string shaderSource = scene.vertexLayout.applyToWgsl(shaders::kCullingWgsl);
+        GpuTimeline timeline(device, queue);
+        ParallelRecorder recorder(threadCount);
+        // Below this many objects a partition isn't worth a thread.
+        constexpr uint32_t kMinObjects = 1000;
+        constexpr int kFrames = 50;
+        out << recorder.threadCount() << " recording threads, " << kFrames << " frames per row" << std::endl;
+        out << "objects   path              partitions   encode ms/frame" << std::endl;
+        for (uint32_t count : {20000u, 200000u})
+        {
+            GpuCulling culling;
+            if (!culling.create(device, queue, shaderSource, scene.vertexLayout, scene.targetFormat, scene.mesh, scatterObjects(count, scene.meshRadius)))
+            {
+                out << "scene setup failed" << std::endl;
+                break;
+            }
+            const char *paths[] = {"one thread", "bundles", "command buffers"};
+            for (int path = 0; path < 3; ++path)
+            {
+                size_t partitions = 1;
+                double encodeMs = 0.0;
+                GpuFence fence;
+                // One frame more than timed, the first one pays for the pipeline warm up.
+                for (int frame = -1; frame < kFrames; ++frame)
+                {
+                    auto encodeStart = std::chrono::steady_clock::now();
+                    culling.setTime(static_cast<float>(frame) / 60.0f);
+                    if (path == 2)
+                    {
+                        // Every partition its own pass over the target, the first one clears it.
+                        std::vector<wgpu::CommandBuffer> commands =
+                            recorder.recordCommandBuffers(device, count, kMinObjects, [&](wgpu::CommandEncoder encoder, const RecordPartition &partition)
+                                                          {
+                                                              wgpu::RenderPassEncoder renderPass = scene.beginPass(encoder, partition.index == 0 ? wgpu::LoadOp::Clear : wgpu::LoadOp::Load);
+                                                              culling.drawObjects(renderPass, partition.first, partition.last);
+                                                              renderPass.end();
+                                                              renderPass.release(); });
+                        partitions = commands.size();
+                        fence = timeline.submit(commands);
+                        for (wgpu::CommandBuffer &command : commands)
+                        {
+                            command.release();
+                        }
+                    }
+                    else
+                    {
+                        std::vector<wgpu::RenderBundle> bundles;
+                        if (path == 1)
+                        {
+                            bundles = recorder.recordBundles(device, scene.targetFormat, count, kMinObjects,
+                                                             [&](wgpu::RenderBundleEncoder encoder, const RecordPartition &partition)
+                                                             { culling.drawObjects(encoder, partition.first, partition.last); });
+                            partitions = bundles.size();
+                        }
+                        wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                        wgpu::RenderPassEncoder renderPass = scene.beginPass(encoder);
+                        if (path == 1)
+                        {
+                            renderPass.executeBundles(bundles.size(), (WGPURenderBundle *)bundles.data());
+                        }
+                        else
+                        {
+                            culling.drawObjects(renderPass, 0, count);
+                        }
+                        renderPass.end();
+                        renderPass.release();
+                        wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                        encoder.release();
+                        fence = timeline.submit(command);
+                        command.release();
+                        for (wgpu::RenderBundle &bundle : bundles)
+                        {
+                            bundle.release();
+                        }
+                    }
+                    if (frame >= 0)
+                    {
+                        encodeMs += elapsedMs(encodeStart);
+                    }
+                    // Frames don't pile up on the GPU, only the recording is compared.
+                    timeline.wait(fence);
+                }
+                out << std::left << std::setw(10) << count << std::setw(18) << paths[path] << std::right << std::setw(10) << partitions
+                    << std::fixed << std::setprecision(3) << std::setw(18) << encodeMs / kFrames << std::defaultfloat << std::endl;
+            }
+        }
+        out << "(encode is the CPU time to record and submit a frame, about half of the objects are drawn)" << std::endl;
+        scene.release();
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // A contiguous range [first, last) of the items of a scene, recorded by one thread.
+    struct RecordPartition
+    {
+        uint32_t index = 0;
+        uint32_t first = 0;
+        uint32_t last = 0;
+    };
+
+    // Records the draws of a large scene on several threads. The items of the scene (objects,
+    // draws, index chunks...) are cut into contiguous partitions. Each partition is recorded
+    // on a worker into a render bundle or a command buffer of its own, and the results come
+    // back in partition order. Replayed or submitted in that order, the frame is the same as
+    // if a single thread had recorded it, whichever worker finished first.
+    //
+    // The recording callbacks run at the same time: they may read the scene but must not
+    // change it, and must leave the queue alone. The calling thread records a partition too
+    // and only returns once all of them are done. The workers live as long as the recorder,
+    // a frame doesn't pay for starting threads.
+    //
+    // The workers create encoders on the device, so it must be safe to use from several
+    // threads. wgpu-native devices are. A Dawn device is only with the
+    // ImplicitDeviceSynchronization feature, Application::createDevice requests it and
+    // records on the calling thread alone when the adapter doesn't have it.
+    class ParallelRecorder
+    {
+    public:
+        // 0 uses a thread per core. The count includes the calling thread, 1 records
+        // everything on it.
+        explicit ParallelRecorder(uint32_t threadCount = 0);
+        ~ParallelRecorder();
+        ParallelRecorder(const ParallelRecorder &) = delete;
+        ParallelRecorder &operator=(const ParallelRecorder &) = delete;
+
+        uint32_t threadCount() const { return static_cast<uint32_t>(mWorkers.size()) + 1; }
+
+        // At most one partition per thread, and none smaller than minItems items: below
+        // that the worker costs more than it saves.
+        std::vector<RecordPartition> partition(uint32_t itemCount, uint32_t minItems) const;
+
+        using BundleRecorder = std::function<void(wgpu::RenderBundleEncoder encoder, const RecordPartition &partition)>;
+        // One bundle per partition, for passes with one colorFormat attachment and no depth.
+        // Replay them with a single executeBundles, they are released by the caller.
+        std::vector<wgpu::RenderBundle> recordBundles(wgpu::Device device, wgpu::TextureFormat colorFormat, uint32_t itemCount, uint32_t minItems,
+                                                      const BundleRecorder &record);
+
+        using CommandRecorder = std::function<void(wgpu::CommandEncoder encoder, const RecordPartition &partition)>;
+        // One command buffer per partition, each with the passes record begins in it. The
+        // first partition usually clears the target and the others load it. Submit them
+        // together with GpuTimeline::submit, they are released by the caller.
+        std::vector<wgpu::CommandBuffer> recordCommandBuffers(wgpu::Device device, uint32_t itemCount, uint32_t minItems, const CommandRecorder &record);
+
+        // Runs task(i) for every i in [0, count) on the workers and the calling thread.
+        void run(uint32_t count, const std::function<void(uint32_t)> &task);
+
+    private:
+        void workerLoop();
+        // Takes tasks of the job until none is left.
+        void drain(const std::function<void(uint32_t)> &task, uint32_t count);
+
+        std::vector<std::thread> mWorkers;
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        // The current job, mGeneration tells the workers a new one started. run() returns
+        // once every task finished and no worker is still looking for one, so the next job
+        // never finds a worker holding on to the previous one.
+        const std::function<void(uint32_t)> *mTask = nullptr;
+        uint32_t mTaskCount = 0;
+        std::atomic<uint32_t> mNextTask{0};
+        uint32_t mFinishedTasks = 0;
+        uint32_t mBusyWorkers = 0;
+        uint64_t mGeneration = 0;
+        bool mStopping = false;
+    };
+
+    // Records frames of 20k and 200k CPU-issued draws of the GPU culling benchmark, on one
+    // thread and on threadCount threads (0 for a thread per core), into bundles and into
+    // command buffers. Prints the CPU time to record and submit a frame each way.
+    void benchmarkParallelRecording(wgpu::Device device, wgpu::Queue queue, uint32_t threadCount, std::ostream &out);
+} // namespace learn::webgpu
@@ -0,0 +1,426 @@
+#include <webgpu/webgpu.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "AsyncRequests.h"
+#include "Hash.h"
+#include "PipelineCache.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        constexpr uint32_t kSpirvMagic = 0x07230203;
+
+        std::vector<uint8_t> readFile(const std::string &path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                return {};
+            }
+            return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        // Write next to the final path and rename, so a reader never sees half a file
+        // even when two processes fill the cache at the same time.
+        bool writeFileAtomically(const std::string &path, const std::vector<uint8_t> &data)
+        {
+            std::string temporaryPath = path + ".tmp";
+            {
+                std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+                if (!file)
+                {
+                    return false;
+                }
+                file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+                if (!file)
+                {
+                    return false;
+                }
+            }
+            std::error_code error;
+            std::filesystem::rename(temporaryPath, path, error);
+            return !error;
+        }
+
+        [[maybe_unused]] std::vector<uint32_t> readSpirv(const std::string &path)
+        {
+            std::vector<uint8_t> bytes = readFile(path);
+            // The header alone is 5 words.
+            if (bytes.size() < 5 * sizeof(uint32_t) || bytes.size() % sizeof(uint32_t) != 0)
+            {
+                return {};
+            }
+            std::vector<uint32_t> words(bytes.size() / sizeof(uint32_t));
+            std::memcpy(words.data(), bytes.data(), bytes.size());
+            if (words[0] != kSpirvMagic)
+            {
+                return {};
+            }
+            return words;
+        }
+    } // namespace
+
+    void PipelineCache::setContext(uint64_t adapterIdentity, std::string pipelineDescription)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mContextHash = hashString(pipelineDescription, hashValue(adapterIdentity));
+        // Checked on the previous device.
+        releaseValidated();
+    }
+
+    void PipelineCache::releaseValidated()
+    {
+        for (auto &[hash, validated] : mValidated)
+        {
+            if (validated.module)
+            {
+                validated.module.release();
+            }
+        }
+        mValidated.clear();
+    }
+
+    void PipelineCache::chainDeviceDescriptor(wgpu::DeviceDescriptor &descriptor, uint64_t adapterIdentity)
+    {
+#ifdef WEBGPU_BACKEND_DAWN
+        if (mOptions.directory.empty())
+        {
+            return;
+        }
+        // Dawn adds the isolation key to every blob key, blobs of another adapter never match.
+        mIsolationKey = hashToHex(adapterIdentity);
+        mDawnCacheDesc.chain.next = descriptor.nextInChain;
+        mDawnCacheDesc.chain.sType = WGPUSType_DawnCacheDeviceDescriptor;
+        mDawnCacheDesc.isolationKey = mIsolationKey.c_str();
+        mDawnCacheDesc.loadDataFunction = &PipelineCache::loadBlob;
+        mDawnCacheDesc.storeDataFunction = &PipelineCache::storeBlob;
+        mDawnCacheDesc.functionUserdata = this;
+        descriptor.nextInChain = &mDawnCacheDesc.chain;
+#else
+        (void)descriptor;
+        (void)adapterIdentity;
+#endif // WEBGPU_BACKEND_DAWN
+    }
+
+    void PipelineCache::addPrebuiltSpirv(const std::string &wgsl, const uint32_t *words, size_t wordCount)
+    {
+        if (wordCount == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPrebuilt[hashString(wgsl)] = std::vector<uint32_t>(words, words + wordCount);
+    }
+
+    void PipelineCache::validateSpirv(wgpu::Device device, const std::string &wgsl)
+    {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+        ValidatedSpirv validated;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mPrebuilt.find(hashString(wgsl));
+            if (it != mPrebuilt.end())
+            {
+                validated.words = it->second;
+                validated.prebuilt = true;
+            }
+        }
+        if (!validated.words.empty())
+        {
+            validated.module = createFromSpirv(device, "prebuilt SPIR-V", validated.words);
+        }
+
+        // The build time SPIR-V is for another WGSL or the device rejected it, a previous
+        // launch may have left a translation of its own.
+        std::string spirvPath = mOptions.directory.empty() ? std::string() : entryPath(shaderKey(wgsl), ".spv");
+        if (!validated.module && !spirvPath.empty())
+        {
+            validated.words = readSpirv(spirvPath);
+            validated.prebuilt = false;
+            if (!validated.words.empty())
+            {
+                validated.module = createFromSpirv(device, "cached SPIR-V", validated.words);
+                if (!validated.module)
+                {
+                    std::error_code error;
+                    std::filesystem::remove(spirvPath, error);
+                }
+            }
+        }
+        if (!validated.module)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        ValidatedSpirv &entry = mValidated[hashString(wgsl)];
+        if (entry.module)
+        {
+            entry.module.release();
+        }
+        entry = std::move(validated);
+#else
+        (void)device;
+        (void)wgsl;
+#endif
+    }
+
+    wgpu::ShaderModule PipelineCache::createShaderModule(wgpu::Device device, const std::string &label, const std::string &wgsl)
+    {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+        // Only SPIR-V that validateSpirv() checked, this may run on any thread and an error
+        // scope here would catch the errors of the others.
+        wgpu::ShaderModule shaderModule = nullptr;
+        bool prebuilt = false;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mValidated.find(hashString(wgsl));
+            if (it != mValidated.end())
+            {
+                ValidatedSpirv &validated = it->second;
+                prebuilt = validated.prebuilt;
+                // The module created while validating is handed out once, a recreation
+                // after that builds a new one from the same words.
+                shaderModule = validated.module ? validated.module : createFromSpirv(device, label, validated.words, false);
+                validated.module = nullptr;
+            }
+        }
+        if (shaderModule)
+        {
+            if (prebuilt)
+                ++mPrebuiltHits;
+            else
+                ++mHits;
+            return shaderModule;
+        }
+
+        if (mOptions.directory.empty())
+        {
+            return createFromWgsl(device, label, wgsl);
+        }
+
+        ++mMisses;
+        shaderModule = createFromWgsl(device, label, wgsl);
+        uint64_t key = shaderKey(wgsl);
+        // A translation that wasn't validated on this run is left alone, not made again.
+        if (!std::filesystem::exists(entryPath(key, ".spv")))
+        {
+            translateInBackground(key, wgsl);
+        }
+        return shaderModule;
+#else
+        // Dawn goes through the blob cache by itself, the browser has its own cache.
+        return createFromWgsl(device, label, wgsl);
+#endif
+    }
+
+    void PipelineCache::flush()
+    {
+        std::vector<std::future<void>> translations;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            translations.swap(mTranslations);
+        }
+        for (std::future<void> &translation : translations)
+        {
+            translation.get();
+        }
+    }
+
+    void PipelineCache::clear()
+    {
+        flush();
+        if (mOptions.directory.empty())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::error_code error;
+        std::filesystem::remove_all(mOptions.directory, error);
+    }
+
+    void PipelineCache::report(std::ostream &out) const
+    {
+        if (mOptions.directory.empty())
+        {
+            out << "Pipeline cache: disabled, " << mPrebuiltHits << " shaders from the build time SPIR-V" << std::endl;
+            return;
+        }
+        out << "Pipeline cache: " << mHits << " hits, " << mMisses << " misses in " << mOptions.directory
+            << ", " << mPrebuiltHits << " shaders from the build time SPIR-V" << std::endl;
+    }
+
+    std::string PipelineCache::entryPath(uint64_t key, const char *extension) const
+    {
+        return mOptions.directory + "/" + hashToHex(key) + extension;
+    }
+
+    uint64_t PipelineCache::shaderKey(const std::string &wgsl) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return hashString(wgsl, mContextHash);
+    }
+
+    wgpu::ShaderModule PipelineCache::createFromWgsl(wgpu::Device device, const std::string &label, const std::string &wgsl) const
+    {
+        wgpu::ShaderModuleDescriptor shaderModuleDesc = {};
+        shaderModuleDesc.label = label.c_str();
+#ifdef WEBGPU_BACKEND_WGPU
+        shaderModuleDesc.hintCount = 0;
+        shaderModuleDesc.hints = nullptr;
+#endif
+        wgpu::ShaderModuleWGSLDescriptor shaderCodeDesc;
+        shaderCodeDesc.chain.next = nullptr;
+        shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
+        shaderCodeDesc.code = wgsl.c_str();
+        shaderModuleDesc.nextInChain = &shaderCodeDesc.chain;
+        return device.createShaderModule(shaderModuleDesc);
+    }
+
+    // The SPIR-V could come from a naga version that wgpu does not agree with, so validateSpirv
+    // creates the module in an error scope, and we return nullptr instead of a broken module.
+    wgpu::ShaderModule PipelineCache::createFromSpirv(wgpu::Device device, const std::string &label, const std::vector<uint32_t> &spirv,
+                                                      bool checked) const
+    {
+        wgpu::ShaderModuleDescriptor shaderModuleDesc = {};
+        shaderModuleDesc.label = label.c_str();
+#ifdef WEBGPU_BACKEND_WGPU
+        shaderModuleDesc.hintCount = 0;
+        shaderModuleDesc.hints = nullptr;
+#endif
+        // Same as the WGSL descriptor, only the chained struct changes.
+        wgpu::ShaderModuleSPIRVDescriptor shaderCodeDesc;
+        shaderCodeDesc.chain.next = nullptr;
+        shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleSPIRVDescriptor;
+        shaderCodeDesc.codeSize = static_cast<uint32_t>(spirv.size());
+        shaderCodeDesc.code = spirv.data();
+        shaderModuleDesc.nextInChain = &shaderCodeDesc.chain;
+
+        if (!checked)
+        {
+            return device.createShaderModule(shaderModuleDesc);
+        }
+        device.pushErrorScope(wgpu::ErrorFilter::Validation);
+        wgpu::ShaderModule shaderModule = device.createShaderModule(shaderModuleDesc);
+        std::string message;
+        if (popErrorScope(device, message))
+        {
+            std::cout << "SPIR-V of " << label << " rejected (" << message << "), using the WGSL" << std::endl;
+            shaderModule.release();
+            return nullptr;
+        }
+        return shaderModule;
+    }
+
+    // The translation runs after the WGSL module is created, so the first launch does
+    // not wait for it, only the next ones benefit.
+    void PipelineCache::translateInBackground(uint64_t key, const std::string &wgsl)
+    {
+#if !defined(__EMSCRIPTEN__)
+        if (mOptions.translator.empty())
+        {
+            return;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(mOptions.directory, error);
+        std::string wgslPath = entryPath(key, ".wgsl");
+        if (!writeFileAtomically(wgslPath, std::vector<uint8_t>(wgsl.begin(), wgsl.end())))
+        {
+            std::cout << "could not write " << wgslPath << std::endl;
+            return;
+        }
+
+        std::string spirvPath = entryPath(key, ".spv");
+        // naga picks the output format from the extension, the temporary file has to end in .spv too.
+        std::string temporaryPath = entryPath(key, ".tmp.spv");
+        std::string command = mOptions.translator + " \"" + wgslPath + "\" \"" + temporaryPath + "\"";
+        std::future<void> translation = launchAsync([command, wgslPath, spirvPath, temporaryPath]()
+        {
+            std::error_code error;
+            if (std::system(command.c_str()) == 0 && !readSpirv(temporaryPath).empty())
+            {
+                std::filesystem::rename(temporaryPath, spirvPath, error);
+            }
+            else
+            {
+                std::cout << "could not translate " << wgslPath << " with \"" << command << "\"" << std::endl;
+                std::filesystem::remove(temporaryPath, error);
+            }
+            std::filesystem::remove(wgslPath, error);
+        });
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTranslations.push_back(std::move(translation));
+#else
+        (void)key;
+        (void)wgsl;
+#endif
+    }
+
+    // A blob file starts with the size of Dawn's key and the key itself, so a hash
+    // collision is detected on load instead of handing Dawn the wrong blob.
+    std::string PipelineCache::blobPath(const void *key, size_t keySize) const
+    {
+        return mOptions.directory + "/dawn/" + hashToHex(hashBytes(key, keySize)) + ".bin";
+    }
+
+    size_t PipelineCache::loadBlob(const void *key, size_t keySize, void *value, size_t valueSize, void *userdata)
+    {
+        PipelineCache &cache = *reinterpret_cast<PipelineCache *>(userdata);
+        std::vector<uint8_t> file;
+        {
+            std::lock_guard<std::mutex> lock(cache.mMutex);
+            file = readFile(cache.blobPath(key, keySize));
+        }
+
+        uint64_t storedKeySize = 0;
+        bool found = file.size() >= sizeof(storedKeySize);
+        if (found)
+        {
+            std::memcpy(&storedKeySize, file.data(), sizeof(storedKeySize));
+            found = storedKeySize == keySize && file.size() >= sizeof(storedKeySize) + keySize &&
+                    std::memcmp(file.data() + sizeof(storedKeySize), key, keySize) == 0;
+        }
+        if (!found)
+        {
+            ++cache.mMisses;
+            return 0;
+        }
+
+        // Dawn first asks for the size with no buffer, then for the data.
+        size_t blobSize = file.size() - sizeof(storedKeySize) - keySize;
+        if (value == nullptr)
+        {
+            return blobSize;
+        }
+        if (valueSize < blobSize)
+        {
+            return 0;
+        }
+        std::memcpy(value, file.data() + sizeof(storedKeySize) + keySize, blobSize);
+        ++cache.mHits;
+        return blobSize;
+    }
+
+    void PipelineCache::storeBlob(const void *key, size_t keySize, const void *value, size_t valueSize, void *userdata)
+    {
+        PipelineCache &cache = *reinterpret_cast<PipelineCache *>(userdata);
+        uint64_t storedKeySize = keySize;
+        std::vector<uint8_t> file(sizeof(storedKeySize) + keySize + valueSize);
+        std::memcpy(file.data(), &storedKeySize, sizeof(storedKeySize));
+        std::memcpy(file.data() + sizeof(storedKeySize), key, keySize);
+        std::memcpy(file.data() + sizeof(storedKeySize) + keySize, value, valueSize);
+
+        std::lock_guard<std::mutex> lock(cache.mMutex);
+        std::error_code error;
+        std::filesystem::create_directories(cache.mOptions.directory + "/dawn", error);
+        writeFileAtomically(cache.blobPath(key, keySize), file);
+    }
+} // namespace learn::webgpu
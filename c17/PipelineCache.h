@@ -0,0 +1,123 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    struct PipelineCacheOptions
+    {
+        // Where the cache entries are written, empty disables the cache.
+        std::string directory = "pipeline_cache";
+        // wgpu-native does not hand out its compiled shaders, so we can keep a SPIR-V
+        // translation of the WGSL instead. It is called as "<translator> in.wgsl out.spv", the
+        // naga CLI (cargo install naga-cli) does exactly that. Empty, the default, disables the
+        // runtime translation: the build already translates the shaders it embeds.
+        std::string translator;
+    };
+
+    // Persistent cache for what the backend produces when it compiles shaders and pipelines,
+    // so a warm start does not translate the WGSL again.
+    //
+    // - Dawn has a blob cache of its own: we plug our load/store functions into the device
+    //   descriptor and it stores translated shaders and compiled pipelines through them.
+    // - wgpu-native has no such hook, instead the WGSL is translated to SPIR-V in the
+    //   background after the first launch, and the next launches create the shader module
+    //   from that SPIR-V instead of parsing WGSL.
+    //
+    // Every key contains the adapter/driver identity and a description of the pipelines the
+    // shaders are used with, a driver update or a pipeline change starts from a clean slate.
+    class PipelineCache
+    {
+    public:
+        explicit PipelineCache(PipelineCacheOptions options = {}) : mOptions(std::move(options)) {}
+        ~PipelineCache()
+        {
+            flush();
+            releaseValidated();
+        }
+
+        PipelineCache(const PipelineCache &) = delete;
+        PipelineCache &operator=(const PipelineCache &) = delete;
+
+        // adapterIdentity is AdapterInfo::identity(), pipelineDescription anything that
+        // changes how the shaders get compiled (vertex formats, target format...).
+        void setContext(uint64_t adapterIdentity, std::string pipelineDescription);
+
+        // Adds Dawn's cache descriptor to the device descriptor, nothing on other backends.
+        // The cache must outlive the requestDevice call.
+        void chainDeviceDescriptor(wgpu::DeviceDescriptor &descriptor, uint64_t adapterIdentity);
+
+        // SPIR-V translated from this exact WGSL at build time, see cmake/EmbedShader.cmake.
+        // On wgpu-native it is used instead of the WGSL, whatever is on disk.
+        void addPrebuiltSpirv(const std::string &wgsl, const uint32_t *words, size_t wordCount);
+
+        // Checks that the device accepts the prebuilt or cached SPIR-V of wgsl, in an error
+        // scope. On wgpu-native the scopes are device-wide, so call it on the main thread while
+        // no other thread uses the device: before init starts its worker threads, and before
+        // the registry rebuilds everything after a device loss. setContext() forgets the result.
+        void validateSpirv(wgpu::Device device, const std::string &wgsl);
+
+        // Same as device.createShaderModule with a WGSL source, from the SPIR-V validateSpirv()
+        // accepted when there is one. Safe to call from any thread, it pushes no error scope.
+        wgpu::ShaderModule createShaderModule(wgpu::Device device, const std::string &label, const std::string &wgsl);
+
+        // Waits for the background translations.
+        void flush();
+        // Removes every entry, used to measure cold starts.
+        void clear();
+
+        // Shader modules created from the cache (wgpu-native) or blobs loaded by Dawn.
+        int hits() const { return mHits; }
+        int misses() const { return mMisses; }
+        int prebuiltHits() const { return mPrebuiltHits; }
+        void report(std::ostream &out) const;
+
+    private:
+        std::string entryPath(uint64_t key, const char *extension) const;
+        uint64_t shaderKey(const std::string &wgsl) const;
+        wgpu::ShaderModule createFromWgsl(wgpu::Device device, const std::string &label, const std::string &wgsl) const;
+        // With checked, in an error scope and nullptr if the device rejects it.
+        wgpu::ShaderModule createFromSpirv(wgpu::Device device, const std::string &label, const std::vector<uint32_t> &spirv,
+                                           bool checked = true) const;
+        void releaseValidated();
+        void translateInBackground(uint64_t key, const std::string &wgsl);
+
+        // Dawn blob cache callbacks, keys are arbitrary bytes chosen by Dawn.
+        static size_t loadBlob(const void *key, size_t keySize, void *value, size_t valueSize, void *userdata);
+        static void storeBlob(const void *key, size_t keySize, const void *value, size_t valueSize, void *userdata);
+        std::string blobPath(const void *key, size_t keySize) const;
+
+        PipelineCacheOptions mOptions;
+        uint64_t mContextHash = 0;
+        std::string mIsolationKey;
+        mutable std::mutex mMutex;
+        std::vector<std::future<void>> mTranslations;
+        std::atomic<int> mHits{0};
+        std::atomic<int> mMisses{0};
+        std::atomic<int> mPrebuiltHits{0};
+        // Keyed by the hash of the WGSL source alone.
+        std::unordered_map<uint64_t, std::vector<uint32_t>> mPrebuilt;
+        struct ValidatedSpirv
+        {
+            std::vector<uint32_t> words;
+            bool prebuilt = false;
+            // Created while validating, handed out by the first createShaderModule.
+            wgpu::ShaderModule module = nullptr;
+        };
+        // SPIR-V the current device accepted, keyed like mPrebuilt.
+        std::unordered_map<uint64_t, ValidatedSpirv> mValidated;
+#ifdef WEBGPU_BACKEND_DAWN
+        WGPUDawnCacheDeviceDescriptor mDawnCacheDesc = {};
+#endif // WEBGPU_BACKEND_DAWN
+    };
+} // namespace learn::webgpu
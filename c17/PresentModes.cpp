@@ -0,0 +1,174 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <iomanip>
+
+#include "PresentModes.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        struct NamedMode
+        {
+            wgpu::PresentMode mode;
+            const char *name;
+        };
+
+        const NamedMode kPresentModes[] = {
+            {wgpu::PresentMode::Fifo, "fifo"},
+            {wgpu::PresentMode::FifoRelaxed, "fifo-relaxed"},
+            {wgpu::PresentMode::Mailbox, "mailbox"},
+            {wgpu::PresentMode::Immediate, "immediate"},
+        };
+
+        float elapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+        {
+            return std::chrono::duration<float, std::milli>(to - from).count();
+        }
+
+        // The value below which fraction of the values are, values is reordered.
+        double percentile(std::vector<float> &values, double fraction)
+        {
+            if (values.empty())
+                return 0.0;
+            size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())));
+            std::nth_element(values.begin(), values.begin() + index, values.end());
+            return values[index];
+        }
+    } // namespace
+
+    const char *presentModeName(wgpu::PresentMode mode)
+    {
+        for (const NamedMode &named : kPresentModes)
+        {
+            if (named.mode == mode)
+                return named.name;
+        }
+        return "unknown";
+    }
+
+    bool parsePresentMode(const std::string &name, wgpu::PresentMode &mode)
+    {
+        for (const NamedMode &named : kPresentModes)
+        {
+            if (name == named.name)
+            {
+                mode = named.mode;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<wgpu::PresentMode> supportedPresentModes(wgpu::Surface surface, wgpu::Adapter adapter)
+    {
+        wgpu::SurfaceCapabilities capabilities;
+        surface.getCapabilities(adapter, &capabilities);
+        std::vector<wgpu::PresentMode> modes;
+        for (size_t i = 0; i < capabilities.presentModeCount; ++i)
+        {
+            modes.push_back(static_cast<wgpu::PresentMode>(capabilities.presentModes[i]));
+        }
+        capabilities.freeMembers();
+        // The spec requires Fifo, some drivers just forget to list it.
+        if (std::find(modes.begin(), modes.end(), wgpu::PresentMode::Fifo) == modes.end())
+        {
+            modes.insert(modes.begin(), wgpu::PresentMode::Fifo);
+        }
+        return modes;
+    }
+
+    wgpu::PresentMode choosePresentMode(wgpu::PresentMode requested, const std::vector<wgpu::PresentMode> &supported)
+    {
+        auto isSupported = [&supported](wgpu::PresentMode mode)
+        {
+            return std::find(supported.begin(), supported.end(), mode) != supported.end();
+        };
+        if (isSupported(requested))
+            return requested;
+        // Mailbox and Immediate both present without waiting, only Immediate may tear.
+        if (requested == wgpu::PresentMode::Mailbox && isSupported(wgpu::PresentMode::Immediate))
+            return wgpu::PresentMode::Immediate;
+        if (requested == wgpu::PresentMode::Immediate && isSupported(wgpu::PresentMode::Mailbox))
+            return wgpu::PresentMode::Mailbox;
+        return wgpu::PresentMode::Fifo;
+    }
+
+    void PresentTimer::beginAcquire()
+    {
+        mAcquireStart = Clock::now();
+    }
+
+    void PresentTimer::acquired()
+    {
+        mAcquired = Clock::now();
+    }
+
+    void PresentTimer::presented()
+    {
+        Clock::time_point now = Clock::now();
+        // The first frame has nothing to be compared with.
+        if (mHasLastPresent)
+        {
+            Sample sample;
+            sample.frameMs = elapsedMs(mLastPresent, now);
+            sample.acquireWaitMs = elapsedMs(mAcquireStart, mAcquired);
+            sample.latencyMs = elapsedMs(mAcquired, now);
+            if (mSamples.size() < kMaxSamples)
+            {
+                mSamples.push_back(sample);
+            }
+            else
+            {
+                mSamples[mNextSample] = sample;
+            }
+            mNextSample = (mNextSample + 1) % kMaxSamples;
+        }
+        mLastPresent = now;
+        mHasLastPresent = true;
+    }
+
+    void PresentTimer::reset()
+    {
+        mSamples.clear();
+        mNextSample = 0;
+        mHasLastPresent = false;
+    }
+
+    PresentTimer::Summary PresentTimer::summary() const
+    {
+        Summary summary;
+        summary.frames = mSamples.size();
+        if (mSamples.empty())
+            return summary;
+        std::vector<float> frameMs;
+        std::vector<float> latencyMs;
+        frameMs.reserve(mSamples.size());
+        latencyMs.reserve(mSamples.size());
+        for (const Sample &sample : mSamples)
+        {
+            summary.frameMs += sample.frameMs;
+            summary.acquireWaitMs += sample.acquireWaitMs;
+            summary.latencyMs += sample.latencyMs;
+            frameMs.push_back(sample.frameMs);
+            latencyMs.push_back(sample.latencyMs);
+        }
+        const double count = static_cast<double>(mSamples.size());
+        summary.frameMs /= count;
+        summary.acquireWaitMs /= count;
+        summary.latencyMs /= count;
+        summary.frameP99Ms = percentile(frameMs, 0.99);
+        summary.latencyP99Ms = percentile(latencyMs, 0.99);
+        return summary;
+    }
+
+    void PresentTimer::report(wgpu::PresentMode mode, std::ostream &out) const
+    {
+        Summary s = summary();
+        out << "present mode " << presentModeName(mode) << ": " << s.frames << " frames, " << std::fixed << std::setprecision(2) << s.frameMs
+            << " ms/frame (p99 " << s.frameP99Ms << "), acquire wait " << s.acquireWaitMs << " ms, acquire to present " << s.latencyMs
+            << " ms (p99 " << s.latencyP99Ms << ")" << std::defaultfloat << std::endl;
+    }
+} // namespace learn::webgpu
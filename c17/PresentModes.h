@@ -0,0 +1,74 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // "fifo", "fifo-relaxed", "mailbox" or "immediate".
+    const char *presentModeName(wgpu::PresentMode mode);
+    // The mode of one of the names above, false when name is none of them.
+    bool parsePresentMode(const std::string &name, wgpu::PresentMode &mode);
+
+    // What the surface can present with on this adapter, Fifo is always among them.
+    std::vector<wgpu::PresentMode> supportedPresentModes(wgpu::Surface surface, wgpu::Adapter adapter);
+    // requested when the surface supports it, otherwise the closest supported mode: the
+    // other mode that doesn't wait for vertical blank, or in the end Fifo.
+    wgpu::PresentMode choosePresentMode(wgpu::PresentMode requested, const std::vector<wgpu::PresentMode> &supported);
+
+    // Times the frames of a surface, from the calls around getCurrentTexture and present:
+    //  - frame time, from one present to the next,
+    //  - acquire wait, how long getCurrentTexture blocked. Fifo waits there for a free image,
+    //  - latency, from the texture being acquired to it being handed back with present.
+    // The latency is the part of the input to display delay the application adds itself,
+    // WebGPU doesn't tell us when the compositor actually shows the image.
+    //
+    // Only the last kMaxSamples frames are kept, so long runs don't grow the memory.
+    class PresentTimer
+    {
+    public:
+        static constexpr size_t kMaxSamples = 4096;
+
+        void beginAcquire();
+        void acquired();
+        void presented();
+        // Forgets every frame, for instance when the present mode changes.
+        void reset();
+
+        struct Summary
+        {
+            size_t frames = 0;
+            double frameMs = 0.0;
+            double frameP99Ms = 0.0;
+            double acquireWaitMs = 0.0;
+            double latencyMs = 0.0;
+            double latencyP99Ms = 0.0;
+        };
+        Summary summary() const;
+        void report(wgpu::PresentMode mode, std::ostream &out) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Sample
+        {
+            float frameMs = 0.0f;
+            float acquireWaitMs = 0.0f;
+            float latencyMs = 0.0f;
+        };
+
+        Clock::time_point mAcquireStart;
+        Clock::time_point mAcquired;
+        Clock::time_point mLastPresent;
+        bool mHasLastPresent = false;
+        // A ring of the last kMaxSamples frames, mNextSample is where the next one goes.
+        std::vector<Sample> mSamples;
+        size_t mNextSample = 0;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,349 @@
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <thread>
+
+#include "AsyncRequests.h"
+#include "GpuHelpers.h"
+#include "MappedUpload.h"
+#include "ReadbackRing.h"
+
+namespace learn::webgpu
+{
+
+    ReadbackRing::ReadbackRing(uint32_t slotCount, uint64_t slotSize)
+        : mSlotCount(slotCount), mSlotSize((slotSize + 3) & ~uint64_t(3)), mSlots(new Slot[slotCount])
+    {
+    }
+
+    ReadbackRing::~ReadbackRing()
+    {
+        release();
+    }
+
+    void ReadbackRing::create(wgpu::Device device)
+    {
+        release();
+        mDevice = device;
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Readback slot";
+        bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        bufferDesc.size = mSlotSize;
+        bufferDesc.mappedAtCreation = false;
+        for (uint32_t i = 0; i < mSlotCount; ++i)
+        {
+            mSlots[i].buffer = device.createBuffer(bufferDesc);
+        }
+    }
+
+    void ReadbackRing::release()
+    {
+        for (uint32_t i = 0; i < mSlotCount; ++i)
+        {
+            Slot &slot = mSlots[i];
+            if (slot.buffer)
+            {
+                // Rejects a pending mapping, its callback still fires (with an error).
+                slot.buffer.destroy();
+            }
+        }
+        // Wait for those callbacks while the slots are still ours. One poll isn't always
+        // enough (Dawn calls back on a later tick), and a late callback would mark a slot
+        // that create() handed out again, or one that is already freed.
+        if (mDevice)
+        {
+            while (hasPendingMap())
+            {
+                processDeviceEvents(mDevice, true);
+            }
+        }
+        for (uint32_t i = 0; i < mSlotCount; ++i)
+        {
+            Slot &slot = mSlots[i];
+            if (slot.buffer)
+            {
+                slot.buffer.release();
+                slot.buffer = nullptr;
+            }
+            slot.state = SlotState::Free;
+            slot.callback = nullptr;
+        }
+        mStatistics.failed += mCount;
+        mHead = 0;
+        mCount = 0;
+        mDevice = nullptr;
+    }
+
+    bool ReadbackRing::hasPendingMap() const
+    {
+        for (uint32_t i = 0; i < mSlotCount; ++i)
+        {
+            if (mSlots[i].state == SlotState::Mapping)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ReadbackRing::Slot *ReadbackRing::acquireSlot(uint64_t size, Callback &callback)
+    {
+        ++mStatistics.requested;
+        if (!mDevice || mCount == mSlotCount || size > mSlotSize)
+        {
+            ++mStatistics.dropped;
+            return nullptr;
+        }
+        Slot &slot = mSlots[(mHead + mCount) % mSlotCount];
+        ++mCount;
+        slot.state = SlotState::Recorded;
+        slot.size = size;
+        slot.callback = std::move(callback);
+        return &slot;
+    }
+
+    bool ReadbackRing::readBuffer(wgpu::CommandEncoder encoder, wgpu::Buffer source, uint64_t offset, uint64_t size, Callback callback)
+    {
+        // Copies are made of 4 byte words.
+        uint64_t copySize = (size + 3) & ~uint64_t(3);
+        Slot *slot = acquireSlot(copySize, callback);
+        if (!slot)
+        {
+            return false;
+        }
+        encoder.copyBufferToBuffer(source, offset, slot->buffer, 0, copySize);
+        return true;
+    }
+
+    bool ReadbackRing::readTexture(wgpu::CommandEncoder encoder, wgpu::Texture texture, uint32_t width, uint32_t height, uint32_t bytesPerPixel, Callback callback)
+    {
+        uint32_t bytesPerRow = rowPitch(width * bytesPerPixel);
+        Slot *slot = acquireSlot(static_cast<uint64_t>(bytesPerRow) * height, callback);
+        if (!slot)
+        {
+            return false;
+        }
+
+        wgpu::ImageCopyTexture source;
+        source.texture = texture;
+        source.mipLevel = 0;
+        source.origin = {0, 0, 0};
+        source.aspect = wgpu::TextureAspect::All;
+        wgpu::ImageCopyBuffer destination;
+        destination.buffer = slot->buffer;
+        destination.layout.offset = 0;
+        destination.layout.bytesPerRow = bytesPerRow;
+        destination.layout.rowsPerImage = height;
+        encoder.copyTextureToBuffer(source, destination, {width, height, 1});
+        return true;
+    }
+
+    void ReadbackRing::submitted()
+    {
+        auto onMapped = [](WGPUBufferMapAsyncStatus status, void *pUserData)
+        {
+            Slot &slot = *reinterpret_cast<Slot *>(pUserData);
+            slot.state = status == WGPUBufferMapAsyncStatus_Success ? SlotState::Mapped : SlotState::Failed;
+        };
+        for (uint32_t i = 0; i < mCount; ++i)
+        {
+            Slot &slot = mSlots[(mHead + i) % mSlotCount];
+            if (slot.state == SlotState::Recorded)
+            {
+                slot.state = SlotState::Mapping;
+                wgpuBufferMapAsync(slot.buffer, wgpu::MapMode::Read, 0, slot.size, onMapped, (void *)&slot);
+            }
+        }
+    }
+
+    // The GPU finishes the copies in submit order, so delivering from the head only
+    // costs something when a mapping failed.
+    void ReadbackRing::deliver()
+    {
+        while (mCount > 0)
+        {
+            Slot &slot = mSlots[mHead];
+            SlotState state = slot.state;
+            if (state == SlotState::Mapped)
+            {
+                const void *data = slot.buffer.getConstMappedRange(0, slot.size);
+                if (data && slot.callback)
+                {
+                    slot.callback(data, slot.size);
+                }
+                slot.buffer.unmap();
+                ++mStatistics.delivered;
+            }
+            else if (state == SlotState::Failed)
+            {
+                ++mStatistics.failed;
+            }
+            else
+            {
+                break;
+            }
+            slot.callback = nullptr;
+            slot.state = SlotState::Free;
+            mHead = (mHead + 1) % mSlotCount;
+            --mCount;
+        }
+    }
+
+    void ReadbackRing::processEvents(bool wait)
+    {
+        auto start = std::chrono::steady_clock::now();
+        processDeviceEvents(mDevice, wait);
+        deliver();
+        mStatistics.pollMs += elapsedMs(start);
+    }
+
+    void ReadbackRing::poll()
+    {
+        if (mDevice && mCount > 0)
+        {
+            processEvents(false);
+        }
+    }
+
+    void ReadbackRing::wait()
+    {
+        while (mDevice && mCount > 0)
+        {
+            // A read that was never submitted would wait forever.
+            if (mSlots[mHead].state == SlotState::Recorded)
+            {
+                break;
+            }
+            processEvents(true);
+        }
+    }
+
+    void ReadbackRing::report(std::ostream &out) const
+    {
+        out << "readbacks: " << mStatistics.delivered << " of " << mStatistics.requested << " delivered, "
+            << mStatistics.dropped << " dropped (ring full), " << mStatistics.failed << " failed, "
+            << mStatistics.pollMs << " ms polling";
+        if (mStatistics.delivered > 0)
+        {
+            out << " (" << mStatistics.pollMs * 1000.0 / static_cast<double>(mStatistics.delivered) << " us per readback)";
+        }
+        out << std::endl;
+    }
+
+    namespace
+    {
+        struct ReadbackResult
+        {
+            double wallMs = 0.0;
+            double cpuMs = 0.0;
+        };
+
+        // std::clock() counts the CPU time of every thread of the process, the driver's too.
+        double cpuMsSince(std::clock_t start)
+        {
+            return static_cast<double>(std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+        }
+
+        // One copy, one map and a wait for it, the way a one-off readback usually looks.
+        ReadbackResult timeSynchronousReadbacks(wgpu::Device device, wgpu::Queue queue, wgpu::Buffer source, uint64_t size, int count, bool blocking)
+        {
+            wgpu::BufferDescriptor bufferDesc;
+            bufferDesc.label = "Readback staging";
+            bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+            bufferDesc.size = size;
+            bufferDesc.mappedAtCreation = false;
+            wgpu::Buffer staging = device.createBuffer(bufferDesc);
+
+            std::clock_t cpuStart = std::clock();
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < count; ++i)
+            {
+                wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                encoder.copyBufferToBuffer(source, 0, staging, 0, size);
+                wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                encoder.release();
+                queue.submit(command);
+                command.release();
+
+                std::atomic<bool> mapped{false};
+                auto onMapped = [](WGPUBufferMapAsyncStatus /* status */, void *pUserData)
+                {
+                    reinterpret_cast<std::atomic<bool> *>(pUserData)->store(true);
+                };
+                wgpuBufferMapAsync(staging, wgpu::MapMode::Read, 0, size, onMapped, (void *)&mapped);
+                while (!mapped.load())
+                {
+                    processDeviceEvents(device, blocking);
+                }
+                staging.unmap();
+            }
+            ReadbackResult result{elapsedMs(start), cpuMsSince(cpuStart)};
+            staging.destroy();
+            staging.release();
+            return result;
+        }
+
+        // One read per frame, the frame's other work stood in for by a 1 ms sleep.
+        ReadbackResult timeRingReadbacks(wgpu::Device device, wgpu::Queue queue, wgpu::Buffer source, uint64_t size, int count)
+        {
+            ReadbackRing ring(3, size);
+            ring.create(device);
+            std::clock_t cpuStart = std::clock();
+            auto start = std::chrono::steady_clock::now();
+            int requested = 0;
+            while (ring.statistics().delivered + ring.statistics().failed < static_cast<uint64_t>(count))
+            {
+                if (requested < count)
+                {
+                    wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                    if (ring.readBuffer(encoder, source, 0, size, nullptr))
+                    {
+                        ++requested;
+                    }
+                    wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                    encoder.release();
+                    queue.submit(command);
+                    command.release();
+                    ring.submitted();
+                }
+                ring.poll();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ReadbackResult result{elapsedMs(start), cpuMsSince(cpuStart)};
+            ring.release();
+            return result;
+        }
+    } // namespace
+
+    void benchmarkReadbacks(wgpu::Device device, wgpu::Queue queue, std::ostream &out)
+    {
+        constexpr uint64_t kReadbackSize = 256 * 1024;
+        constexpr int kReadbackCount = 200;
+        wgpu::Buffer source = createMappedBuffer(device, "Readback source", wgpu::BufferUsage::CopySrc, kReadbackSize,
+                                                 [](void *data, uint64_t size)
+                                                 {
+                                                     std::memset(data, 0x5a, size);
+                                                 });
+
+        const char *modeNames[] = {"spin", "blocking wait", "ring"};
+        out << kReadbackCount << " readbacks of " << kReadbackSize << " bytes" << std::endl;
+        out << "mode              wall ms/read   cpu ms/read" << std::endl;
+        for (int mode = 0; mode < 3; ++mode)
+        {
+            ReadbackResult result = mode < 2
+                                        ? timeSynchronousReadbacks(device, queue, source, kReadbackSize, kReadbackCount, mode == 1)
+                                        : timeRingReadbacks(device, queue, source, kReadbackSize, kReadbackCount);
+            out << std::left << std::setw(18) << modeNames[mode] << std::right << std::fixed << std::setprecision(3)
+                << std::setw(12) << result.wallMs / kReadbackCount << std::setw(14) << result.cpuMs / kReadbackCount
+                << std::defaultfloat << std::endl;
+        }
+        out << "(the ring's wall time includes the 1 ms frames it is spread over)" << std::endl;
+
+        waitForSubmittedWork(device, queue);
+        source.destroy();
+        source.release();
+    }
+} // namespace learn::webgpu
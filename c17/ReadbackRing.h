@@ -0,0 +1,113 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+
+namespace learn::webgpu
+{
+
+    // Reads GPU data back without stalling the frame. The ring owns slotCount staging buffers
+    // (MapRead | CopyDst) of slotSize bytes. A read records a copy into the next free slot,
+    // submitted() starts mapping the slots once the copies are on the queue, and poll(),
+    // called once per frame, hands every mapped slot to its callback and frees it.
+    // The data thus arrives a frame or more after it was asked for, in the order it was asked.
+    //
+    // When every slot is still waiting for the GPU the read is dropped (and counted) instead
+    // of waiting, a ring that is too small shows up as dropped reads, never as a stall.
+    class ReadbackRing
+    {
+    public:
+        // data is only valid during the call.
+        using Callback = std::function<void(const void *data, uint64_t size)>;
+
+        ReadbackRing(uint32_t slotCount, uint64_t slotSize);
+        ~ReadbackRing();
+        ReadbackRing(const ReadbackRing &) = delete;
+        ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+        // Creates the staging buffers on device, again after a device loss. Reads still in
+        // flight on the previous device are dropped.
+        void create(wgpu::Device device);
+        // Destroys the staging buffers, reads still in flight never reach their callback.
+        void release();
+
+        uint64_t slotSize() const { return mSlotSize; }
+        // Rows of a texture copy have to be multiples of 256 bytes.
+        static uint32_t rowPitch(uint32_t rowBytes) { return (rowBytes + 255) & ~uint32_t(255); }
+
+        // Records a copy of size bytes of source, from offset, into a free slot.
+        // Returns false if no slot is free or size doesn't fit in a slot.
+        bool readBuffer(wgpu::CommandEncoder encoder, wgpu::Buffer source, uint64_t offset, uint64_t size, Callback callback);
+        // Same with the first mip of a 2D texture. The callback gets the rows rowPitch() apart.
+        bool readTexture(wgpu::CommandEncoder encoder, wgpu::Texture texture, uint32_t width, uint32_t height, uint32_t bytesPerPixel, Callback callback);
+
+        // Call after the encoders passed to the reads were submitted, maps their slots.
+        void submitted();
+        // Lets the device process its events without blocking and delivers what is mapped.
+        void poll();
+        // Blocks until every submitted read is delivered. wgpu sleeps in the driver while it
+        // waits, the other backends yield between short polls, none of them spin.
+        void wait();
+
+        uint32_t inFlight() const { return mCount; }
+
+        struct Statistics
+        {
+            uint64_t requested = 0;
+            uint64_t delivered = 0;
+            // No free slot, the read was skipped.
+            uint64_t dropped = 0;
+            // The mapping failed, e.g. the device was lost.
+            uint64_t failed = 0;
+            // Time spent in poll() and wait(), callbacks included.
+            double pollMs = 0.0;
+        };
+        const Statistics &statistics() const { return mStatistics; }
+        void report(std::ostream &out) const;
+
+    private:
+        enum class SlotState
+        {
+            Free,
+            // The copy is recorded, the encoder isn't submitted yet.
+            Recorded,
+            Mapping,
+            Mapped,
+            Failed
+        };
+
+        struct Slot
+        {
+            wgpu::Buffer buffer = nullptr;
+            std::atomic<SlotState> state{SlotState::Free};
+            uint64_t size = 0;
+            Callback callback;
+        };
+
+        Slot *acquireSlot(uint64_t size, Callback &callback);
+        // A slot waits for its map callback.
+        bool hasPendingMap() const;
+        void processEvents(bool wait);
+        void deliver();
+
+        wgpu::Device mDevice = nullptr;
+        uint32_t mSlotCount = 0;
+        uint64_t mSlotSize = 0;
+        // Never reallocated: the map callbacks point at the slots.
+        std::unique_ptr<Slot[]> mSlots;
+        // Oldest read in flight, and how many there are after it.
+        uint32_t mHead = 0;
+        uint32_t mCount = 0;
+        Statistics mStatistics;
+    };
+
+    // Reads a buffer back readbackCount times, once by spinning on a non blocking poll until
+    // the map callback fired, once with the blocking wait, once through a ReadbackRing with
+    // one read per frame, and prints the wall and CPU time each read costs.
+    void benchmarkReadbacks(wgpu::Device device, wgpu::Queue queue, std::ostream &out);
+} // namespace learn::webgpu
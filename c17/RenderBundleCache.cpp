@@ -0,0 +1,146 @@
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <iomanip>
+
+#include "CullingShader.h"
+#include "GpuCulling.h"
+#include "GpuHelpers.h"
+#include "GpuTimeline.h"
+#include "RenderBundleCache.h"
+
+namespace learn::webgpu
+{
+
+    void RenderBundleCache::configure(wgpu::Device device, wgpu::TextureFormat colorFormat)
+    {
+        release();
+        mDevice = device;
+        mColorFormat = colorFormat;
+    }
+
+    void RenderBundleCache::release()
+    {
+        for (auto &[key, bundle] : mBundles)
+        {
+            bundle.release();
+        }
+        mBundles.clear();
+        mDevice = nullptr;
+    }
+
+    wgpu::RenderBundle RenderBundleCache::bundle(uint64_t key, const Recorder &record)
+    {
+        auto it = mBundles.find(key);
+        if (it != mBundles.end())
+        {
+            ++mStatistics.replayed;
+            return it->second;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        wgpu::RenderBundleEncoderDescriptor encoderDesc;
+        encoderDesc.label = "Render bundle encoder";
+        encoderDesc.colorFormatCount = 1;
+        encoderDesc.colorFormats = (WGPUTextureFormat *)&mColorFormat;
+        encoderDesc.depthStencilFormat = wgpu::TextureFormat::Undefined;
+        encoderDesc.sampleCount = 1;
+        encoderDesc.depthReadOnly = false;
+        encoderDesc.stencilReadOnly = false;
+        wgpu::RenderBundleEncoder encoder = mDevice.createRenderBundleEncoder(encoderDesc);
+        record(encoder);
+        wgpu::RenderBundleDescriptor bundleDesc;
+        bundleDesc.label = "Render bundle";
+        wgpu::RenderBundle bundle = encoder.finish(bundleDesc);
+        encoder.release();
+
+        mBundles.emplace(key, bundle);
+        ++mStatistics.recorded;
+        mStatistics.recordMs += elapsedMs(start);
+        return bundle;
+    }
+
+    void RenderBundleCache::invalidate()
+    {
+        if (mBundles.empty())
+        {
+            return;
+        }
+        for (auto &[key, bundle] : mBundles)
+        {
+            bundle.release();
+        }
+        mBundles.clear();
+        ++mStatistics.invalidations;
+    }
+
+    void RenderBundleCache::report(std::ostream &out) const
+    {
+        out << "render bundles: " << mStatistics.recorded << " recorded in " << std::fixed << std::setprecision(2) << mStatistics.recordMs
+            << std::defaultfloat << " ms, " << mStatistics.replayed << " replays, " << mStatistics.invalidations << " invalidations"
+            << std::endl;
+    }
+
+    void benchmarkRenderBundles(wgpu::Device device, wgpu::Queue queue, std::ostream &out)
+    {
+        // The copies of the GPU culling benchmark, every visible one drawn with its own
+        // drawIndexed. The bundle culls once, when it is recorded: the scene is static.
+        BenchmarkScene scene = createBenchmarkScene(device);
+        const std::string shaderSource = scene.vertexLayout.applyToWgsl(shaders::kCullingWgsl);
+        GpuTimeline timeline(device, queue);
+        constexpr int kFrames = 100;
+        out << kFrames << " frames per draw count" << std::endl;
+        out << "draws     encode ms/frame   bundled ms/frame   record ms" << std::endl;
+        for (uint32_t count : {20u, 200u, 2000u, 20000u, 200000u})
+        {
+            GpuCulling culling;
+            if (!culling.create(device, queue, shaderSource, scene.vertexLayout, scene.targetFormat, scene.mesh, scatterObjects(count, scene.meshRadius)))
+            {
+                out << "scene setup failed" << std::endl;
+                break;
+            }
+            RenderBundleCache bundles;
+            bundles.configure(device, scene.targetFormat);
+            uint32_t draws = 0;
+            double encodeMs[2] = {0.0, 0.0};
+            for (int path = 0; path < 2; ++path)
+            {
+                const bool bundled = path == 1;
+                GpuFence fence;
+                // One frame more than timed, it records the bundle.
+                for (int frame = -1; frame < kFrames; ++frame)
+                {
+                    auto encodeStart = std::chrono::steady_clock::now();
+                    wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                    wgpu::RenderPassEncoder renderPass = scene.beginPass(encoder);
+                    if (bundled)
+                    {
+                        wgpu::RenderBundle bundle = bundles.bundle(0, [&](wgpu::RenderBundleEncoder bundleEncoder)
+                                                                   { culling.drawDirect(bundleEncoder, 0.0f); });
+                        renderPass.executeBundles(1, (WGPURenderBundle *)&bundle);
+                    }
+                    else
+                    {
+                        draws = culling.drawDirect(renderPass, 0.0f);
+                    }
+                    renderPass.end();
+                    renderPass.release();
+                    wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                    encoder.release();
+                    fence = timeline.submit(command);
+                    command.release();
+                    if (frame >= 0)
+                    {
+                        encodeMs[path] += elapsedMs(encodeStart);
+                    }
+                }
+                timeline.wait(fence);
+            }
+            out << std::left << std::setw(10) << draws << std::right << std::fixed << std::setprecision(3) << std::setw(15)
+                << encodeMs[0] / kFrames << std::setw(19) << encodeMs[1] / kFrames << std::setw(12) << bundles.statistics().recordMs
+                << std::defaultfloat << std::endl;
+        }
+        out << "(encode includes the submit, bundled replays a bundle recorded once)" << std::endl;
+        scene.release();
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <unordered_map>
+
+namespace learn::webgpu
+{
+
+    // Draw commands that are the same every frame are recorded once into a render bundle and
+    // replayed with executeBundles, the CPU no longer encodes them one by one.
+    //
+    // What still changes between frames picks the bundle through its key, the dynamic offset
+    // of the uniform block for instance: a bundle holds the offsets it was recorded with. The
+    // bundles only go away with invalidate(), to be called when the geometry or the pipelines
+    // they use change.
+    class RenderBundleCache
+    {
+    public:
+        using Recorder = std::function<void(wgpu::RenderBundleEncoder encoder)>;
+
+        RenderBundleCache() = default;
+        ~RenderBundleCache() { release(); }
+        RenderBundleCache(const RenderBundleCache &) = delete;
+        RenderBundleCache &operator=(const RenderBundleCache &) = delete;
+
+        // Bundles are recorded on device for passes with one colorFormat attachment and no
+        // depth. Again after a device loss.
+        void configure(wgpu::Device device, wgpu::TextureFormat colorFormat);
+        void release();
+
+        // The bundle recorded for key, record is only called when there is none yet.
+        wgpu::RenderBundle bundle(uint64_t key, const Recorder &record);
+        void invalidate();
+
+        struct Statistics
+        {
+            uint64_t recorded = 0;
+            uint64_t replayed = 0;
+            uint64_t invalidations = 0;
+            double recordMs = 0.0;
+        };
+        const Statistics &statistics() const { return mStatistics; }
+        void report(std::ostream &out) const;
+
+    private:
+        wgpu::Device mDevice = nullptr;
+        wgpu::TextureFormat mColorFormat = wgpu::TextureFormat::Undefined;
+        std::unordered_map<uint64_t, wgpu::RenderBundle> mBundles;
+        Statistics mStatistics;
+    };
+
+    // Encodes frames of 10 to 100k draws, every frame and through a bundle, and prints the
+    // CPU time spent encoding a frame both ways.
+    void benchmarkRenderBundles(wgpu::Device device, wgpu::Queue queue, std::ostream &out);
+} // namespace learn::webgpu
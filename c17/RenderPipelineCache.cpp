@@ -0,0 +1,332 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <string_view>
+#include <utility>
+
+#include "Hash.h"
+#include "RenderPipelineCache.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        uint64_t hashStage(uint64_t moduleKey, const char *entryPoint, size_t constantCount, const WGPUConstantEntry *constants, uint64_t hash)
+        {
+            hash = hashValue(moduleKey, hash);
+            hash = hashString(entryPoint ? entryPoint : "", hash);
+
+            // Overrides can be listed in any order, sort them by name first.
+            std::vector<std::pair<std::string_view, double>> sorted;
+            for (size_t i = 0; i < constantCount; ++i)
+            {
+                sorted.emplace_back(constants[i].key ? constants[i].key : "", constants[i].value);
+            }
+            std::sort(sorted.begin(), sorted.end());
+            hash = hashValue(static_cast<uint64_t>(sorted.size()), hash);
+            for (const auto &[key, value] : sorted)
+            {
+                hash = hashString(key, hash);
+                hash = hashValue(value, hash);
+            }
+            return hash;
+        }
+
+        uint64_t hashStencilFace(const WGPUStencilFaceState &face, uint64_t hash)
+        {
+            hash = hashValue(static_cast<uint32_t>(face.compare), hash);
+            hash = hashValue(static_cast<uint32_t>(face.failOp), hash);
+            hash = hashValue(static_cast<uint32_t>(face.depthFailOp), hash);
+            return hashValue(static_cast<uint32_t>(face.passOp), hash);
+        }
+
+        uint64_t hashBlendComponent(const WGPUBlendComponent &component, uint64_t hash)
+        {
+            hash = hashValue(static_cast<uint32_t>(component.operation), hash);
+            hash = hashValue(static_cast<uint32_t>(component.srcFactor), hash);
+            return hashValue(static_cast<uint32_t>(component.dstFactor), hash);
+        }
+    } // namespace
+
+    void RenderPipelineCache::setObjectKey(wgpu::ShaderModule shaderModule, uint64_t key)
+    {
+        shaderModule.reference();
+        keepObject(static_cast<WGPUShaderModule>(shaderModule), key, [shaderModule]() mutable
+                   { shaderModule.release(); });
+    }
+
+    void RenderPipelineCache::setObjectKey(wgpu::BindGroupLayout bindGroupLayout, uint64_t key)
+    {
+        bindGroupLayout.reference();
+        keepObject(static_cast<WGPUBindGroupLayout>(bindGroupLayout), key, [bindGroupLayout]() mutable
+                   { bindGroupLayout.release(); });
+    }
+
+    void RenderPipelineCache::keepObject(const void *handle, uint64_t key, std::function<void()> release)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mObjectKeys.count(handle) > 0)
+        {
+            // Already referenced once, that is enough.
+            release();
+            return;
+        }
+        mObjectKeys[handle] = key;
+        mObjectReleases.push_back(std::move(release));
+    }
+
+    bool RenderPipelineCache::objectKey(const void *handle, uint64_t &key) const
+    {
+        auto it = mObjectKeys.find(handle);
+        if (it == mObjectKeys.end())
+        {
+            return false;
+        }
+        key = it->second;
+        return true;
+    }
+
+    wgpu::PipelineLayout RenderPipelineCache::pipelineLayout(wgpu::Device device, const std::vector<wgpu::BindGroupLayout> &bindGroupLayouts)
+    {
+        wgpu::PipelineLayoutDescriptor layoutDesc{};
+        layoutDesc.bindGroupLayoutCount = bindGroupLayouts.size();
+        layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)bindGroupLayouts.data();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint64_t key = hashValue(reinterpret_cast<uintptr_t>(static_cast<WGPUDevice>(device)));
+        key = hashValue(static_cast<uint64_t>(bindGroupLayouts.size()), key);
+        for (const wgpu::BindGroupLayout &bindGroupLayout : bindGroupLayouts)
+        {
+            uint64_t layoutKey = 0;
+            if (!objectKey(static_cast<WGPUBindGroupLayout>(bindGroupLayout), layoutKey))
+            {
+                return device.createPipelineLayout(layoutDesc);
+            }
+            key = hashValue(layoutKey, key);
+        }
+
+        auto it = mPipelineLayouts.find(key);
+        if (it == mPipelineLayouts.end())
+        {
+            wgpu::PipelineLayout layout = device.createPipelineLayout(layoutDesc);
+            it = mPipelineLayouts.emplace(key, layout).first;
+            // Pipelines using this layout are hashed with the content of its bind groups.
+            mObjectKeys[static_cast<WGPUPipelineLayout>(layout)] = key;
+        }
+        it->second.reference();
+        return it->second;
+    }
+
+    wgpu::RenderPipeline RenderPipelineCache::renderPipeline(wgpu::Device device, const wgpu::RenderPipelineDescriptor &descriptor)
+    {
+        uint64_t key = 0;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!hashDescriptor(device, descriptor, key))
+            {
+                ++mUncached;
+                return device.createRenderPipeline(descriptor);
+            }
+
+            auto it = mPipelines.find(key);
+            if (it != mPipelines.end())
+            {
+                ++mHits;
+                it->second.reference();
+                return it->second;
+            }
+            ++mMisses;
+        }
+
+        // Compile without holding the lock, other threads can keep hitting the cache meanwhile.
+        wgpu::RenderPipeline pipeline = device.createRenderPipeline(descriptor);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto [it, inserted] = mPipelines.emplace(key, pipeline);
+        if (!inserted)
+        {
+            // Another thread built the same pipeline at the same time, keep the first one.
+            pipeline.release();
+        }
+        it->second.reference();
+        return it->second;
+    }
+
+    void RenderPipelineCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto &[key, pipeline] : mPipelines)
+        {
+            pipeline.release();
+        }
+        for (auto &[key, layout] : mPipelineLayouts)
+        {
+            layout.release();
+        }
+        for (std::function<void()> &release : mObjectReleases)
+        {
+            release();
+        }
+        mPipelines.clear();
+        mPipelineLayouts.clear();
+        mObjectReleases.clear();
+        mObjectKeys.clear();
+    }
+
+    int RenderPipelineCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mHits;
+    }
+
+    int RenderPipelineCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mMisses;
+    }
+
+    int RenderPipelineCache::uncached() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mUncached;
+    }
+
+    void RenderPipelineCache::report(std::ostream &out) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        out << "Render pipeline cache: " << mHits << " hits, " << mMisses << " misses, "
+            << mUncached << " uncached, " << mPipelines.size() << " pipelines" << std::endl;
+    }
+
+    uint64_t RenderPipelineCache::hashBindGroupLayoutEntries(const std::vector<wgpu::BindGroupLayoutEntry> &entries)
+    {
+        // Field by field, the structs have padding and extension pointers we must not hash.
+        uint64_t hash = hashValue(static_cast<uint64_t>(entries.size()));
+        for (const wgpu::BindGroupLayoutEntry &entry : entries)
+        {
+            hash = hashValue(entry.binding, hash);
+            hash = hashValue(static_cast<uint32_t>(entry.visibility), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.buffer.type), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.buffer.hasDynamicOffset), hash);
+            hash = hashValue(entry.buffer.minBindingSize, hash);
+            hash = hashValue(static_cast<uint32_t>(entry.sampler.type), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.texture.sampleType), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.texture.viewDimension), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.texture.multisampled), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.storageTexture.access), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.storageTexture.format), hash);
+            hash = hashValue(static_cast<uint32_t>(entry.storageTexture.viewDimension), hash);
+        }
+        return hash;
+    }
+
+    // Returns false when the descriptor has extension structs or objects we don't know the
+    // content of, we can't tell whether two of them are equal.
+    bool RenderPipelineCache::hashDescriptor(WGPUDevice device, const WGPURenderPipelineDescriptor &descriptor, uint64_t &hash) const
+    {
+        if (descriptor.nextInChain || descriptor.vertex.nextInChain || descriptor.primitive.nextInChain ||
+            descriptor.multisample.nextInChain)
+        {
+            return false;
+        }
+
+        hash = hashValue(reinterpret_cast<uintptr_t>(device));
+        // 0 is the automatic layout
+        uint64_t layoutKey = 0;
+        if (descriptor.layout && !objectKey(descriptor.layout, layoutKey))
+        {
+            return false;
+        }
+        hash = hashValue(layoutKey, hash);
+
+        const WGPUVertexState &vertex = descriptor.vertex;
+        uint64_t vertexModuleKey = 0;
+        if (!objectKey(vertex.module, vertexModuleKey))
+        {
+            return false;
+        }
+        hash = hashStage(vertexModuleKey, vertex.entryPoint, vertex.constantCount, vertex.constants, hash);
+        hash = hashValue(static_cast<uint64_t>(vertex.bufferCount), hash);
+        for (size_t i = 0; i < vertex.bufferCount; ++i)
+        {
+            const WGPUVertexBufferLayout &buffer = vertex.buffers[i];
+            hash = hashValue(buffer.arrayStride, hash);
+            hash = hashValue(static_cast<uint32_t>(buffer.stepMode), hash);
+            // The order attributes are listed in does not matter, their locations do.
+            std::vector<WGPUVertexAttribute> attributes(buffer.attributes, buffer.attributes + buffer.attributeCount);
+            std::sort(attributes.begin(), attributes.end(), [](const WGPUVertexAttribute &a, const WGPUVertexAttribute &b)
+                      { return a.shaderLocation < b.shaderLocation; });
+            hash = hashValue(static_cast<uint64_t>(attributes.size()), hash);
+            for (const WGPUVertexAttribute &attribute : attributes)
+            {
+                hash = hashValue(attribute.shaderLocation, hash);
+                hash = hashValue(static_cast<uint32_t>(attribute.format), hash);
+                hash = hashValue(attribute.offset, hash);
+            }
+        }
+
+        const WGPUPrimitiveState &primitive = descriptor.primitive;
+        hash = hashValue(static_cast<uint32_t>(primitive.topology), hash);
+        hash = hashValue(static_cast<uint32_t>(primitive.stripIndexFormat), hash);
+        hash = hashValue(static_cast<uint32_t>(primitive.frontFace), hash);
+        hash = hashValue(static_cast<uint32_t>(primitive.cullMode), hash);
+
+        hash = hashValue(static_cast<uint32_t>(descriptor.depthStencil != nullptr), hash);
+        if (const WGPUDepthStencilState *depthStencil = descriptor.depthStencil)
+        {
+            if (depthStencil->nextInChain)
+            {
+                return false;
+            }
+            hash = hashValue(static_cast<uint32_t>(depthStencil->format), hash);
+            hash = hashValue(static_cast<uint32_t>(depthStencil->depthWriteEnabled), hash);
+            hash = hashValue(static_cast<uint32_t>(depthStencil->depthCompare), hash);
+            hash = hashStencilFace(depthStencil->stencilFront, hash);
+            hash = hashStencilFace(depthStencil->stencilBack, hash);
+            hash = hashValue(depthStencil->stencilReadMask, hash);
+            hash = hashValue(depthStencil->stencilWriteMask, hash);
+            hash = hashValue(depthStencil->depthBias, hash);
+            hash = hashValue(depthStencil->depthBiasSlopeScale, hash);
+            hash = hashValue(depthStencil->depthBiasClamp, hash);
+        }
+
+        const WGPUMultisampleState &multisample = descriptor.multisample;
+        hash = hashValue(multisample.count, hash);
+        hash = hashValue(multisample.mask, hash);
+        hash = hashValue(static_cast<uint32_t>(multisample.alphaToCoverageEnabled), hash);
+
+        hash = hashValue(static_cast<uint32_t>(descriptor.fragment != nullptr), hash);
+        if (const WGPUFragmentState *fragment = descriptor.fragment)
+        {
+            if (fragment->nextInChain)
+            {
+                return false;
+            }
+            uint64_t fragmentModuleKey = 0;
+            if (!objectKey(fragment->module, fragmentModuleKey))
+            {
+                return false;
+            }
+            hash = hashStage(fragmentModuleKey, fragment->entryPoint, fragment->constantCount, fragment->constants, hash);
+            hash = hashValue(static_cast<uint64_t>(fragment->targetCount), hash);
+            for (size_t i = 0; i < fragment->targetCount; ++i)
+            {
+                const WGPUColorTargetState &target = fragment->targets[i];
+                if (target.nextInChain)
+                {
+                    return false;
+                }
+                hash = hashValue(static_cast<uint32_t>(target.format), hash);
+                hash = hashValue(static_cast<uint32_t>(target.writeMask), hash);
+                hash = hashValue(static_cast<uint32_t>(target.blend != nullptr), hash);
+                if (target.blend)
+                {
+                    hash = hashBlendComponent(target.blend->color, hash);
+                    hash = hashBlendComponent(target.blend->alpha, hash);
+                }
+            }
+        }
+        return true;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Hands out one shared RenderPipeline per distinct pipeline state, so building the same
+    // pipeline again (another scene, a hot reload that changed nothing...) costs a hash
+    // lookup instead of a compilation.
+    //
+    // The key is a canonical hash of the descriptor: every field that matters, vertex
+    // attributes and constants sorted, labels ignored. Objects referenced by the descriptor
+    // are hashed by their content: pipeline layouts it created itself, and shader modules or
+    // bind group layouts given a key with setObjectKey(). A descriptor using any other object
+    // is not cached, a handle alone could be recycled for something else after a release.
+    //
+    // Pipelines belong to a device, clear() must be called before the device goes away.
+    class RenderPipelineCache
+    {
+    public:
+        RenderPipelineCache() = default;
+        ~RenderPipelineCache() { clear(); }
+
+        RenderPipelineCache(const RenderPipelineCache &) = delete;
+        RenderPipelineCache &operator=(const RenderPipelineCache &) = delete;
+
+        // Tells the cache what an object contains, e.g. the hash of a module's WGSL. The cache
+        // keeps a reference to the object so its handle can't be reused by another one.
+        void setObjectKey(wgpu::ShaderModule shaderModule, uint64_t key);
+        void setObjectKey(wgpu::BindGroupLayout bindGroupLayout, uint64_t key);
+
+        // Both return a new reference, release it as if the object was created directly.
+        wgpu::PipelineLayout pipelineLayout(wgpu::Device device, const std::vector<wgpu::BindGroupLayout> &bindGroupLayouts);
+        wgpu::RenderPipeline renderPipeline(wgpu::Device device, const wgpu::RenderPipelineDescriptor &descriptor);
+
+        // Releases every cached object.
+        void clear();
+
+        int hits() const;
+        int misses() const;
+        // Descriptors we can't hash (extension structs, unknown objects), created every time.
+        int uncached() const;
+        void report(std::ostream &out) const;
+
+        static uint64_t hashBindGroupLayoutEntries(const std::vector<wgpu::BindGroupLayoutEntry> &entries);
+
+    private:
+        bool objectKey(const void *handle, uint64_t &key) const;
+        void keepObject(const void *handle, uint64_t key, std::function<void()> release);
+        bool hashDescriptor(WGPUDevice device, const WGPURenderPipelineDescriptor &descriptor, uint64_t &hash) const;
+
+        mutable std::mutex mMutex;
+        std::unordered_map<const void *, uint64_t> mObjectKeys;
+        std::vector<std::function<void()>> mObjectReleases;
+        std::unordered_map<uint64_t, wgpu::PipelineLayout> mPipelineLayouts;
+        std::unordered_map<uint64_t, wgpu::RenderPipeline> mPipelines;
+        int mHits = 0;
+        int mMisses = 0;
+        int mUncached = 0;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,310 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+#include "AsyncRequests.h"
+#include "ResourceRegistry.h"
+
+namespace learn::webgpu
+{
+
+    void ResourceRegistry::attach(wgpu::Device device, wgpu::Queue queue)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDevice = device;
+        mQueue = queue;
+    }
+
+    void ResourceRegistry::setShaderFactory(ShaderFactory factory)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShaderFactory = std::move(factory);
+    }
+
+    ResourceRegistry::Handle ResourceRegistry::addShader(std::string label, std::string source)
+    {
+        ShaderRecord record{std::move(label), std::move(source)};
+        record.module = createShader(mDevice, record);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShaders.push_back(std::move(record));
+        return mShaders.size() - 1;
+    }
+
+    ResourceRegistry::Handle ResourceRegistry::addBuffer(std::string label, WGPUBufferUsageFlags usage, const void *data, uint64_t size)
+    {
+        BufferRecord record{std::move(label), usage};
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        if (bytes)
+            record.data.assign(bytes, bytes + size);
+        else
+            record.data.assign(size, 0);
+        // writeBuffer only takes multiples of 4 bytes.
+        record.data.resize((size + 3) & ~uint64_t(3), 0);
+        record.buffer = createBuffer(mDevice, mQueue, record);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBuffers.push_back(std::move(record));
+        return mBuffers.size() - 1;
+    }
+
+    ResourceRegistry::Handle ResourceRegistry::addBindGroupLayout(std::string label, std::vector<wgpu::BindGroupLayoutEntry> entries)
+    {
+        BindGroupLayoutRecord record{std::move(label), std::move(entries)};
+        record.layout = createBindGroupLayout(mDevice, record);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBindGroupLayouts.push_back(std::move(record));
+        return mBindGroupLayouts.size() - 1;
+    }
+
+    ResourceRegistry::Handle ResourceRegistry::addRenderPipeline(std::string label, PipelineBuilder builder)
+    {
+        PipelineRecord record{std::move(label), std::move(builder)};
+        record.pipeline = record.builder(mDevice, *this);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPipelines.push_back(std::move(record));
+        return mPipelines.size() - 1;
+    }
+
+    ResourceRegistry::Handle ResourceRegistry::addBindGroup(std::string label, Handle layout, std::vector<BufferBinding> entries)
+    {
+        BindGroupRecord record{std::move(label), layout, std::move(entries)};
+        record.bindGroup = createBindGroup(mDevice, record);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBindGroups.push_back(std::move(record));
+        return mBindGroups.size() - 1;
+    }
+
+    void ResourceRegistry::writeBuffer(Handle buffer, uint64_t offset, const void *data, uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        BufferRecord &record = mBuffers[buffer];
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        std::copy(bytes, bytes + size, record.data.begin() + offset);
+        mQueue.writeBuffer(record.buffer, offset, data, size);
+    }
+
+    void ResourceRegistry::replaceShader(Handle handle, std::string source, wgpu::ShaderModule module)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ShaderRecord &record = mShaders[handle];
+        if (record.module)
+            record.module.release();
+        record.source = std::move(source);
+        record.module = module;
+    }
+
+    void ResourceRegistry::replaceRenderPipeline(Handle handle, wgpu::RenderPipeline pipeline)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        PipelineRecord &record = mPipelines[handle];
+        if (record.pipeline)
+            record.pipeline.release();
+        record.pipeline = pipeline;
+    }
+
+    wgpu::ShaderModule ResourceRegistry::shader(Handle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mShaders[handle].module;
+    }
+
+    wgpu::Buffer ResourceRegistry::buffer(Handle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBuffers[handle].buffer;
+    }
+
+    wgpu::BindGroupLayout ResourceRegistry::bindGroupLayout(Handle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBindGroupLayouts[handle].layout;
+    }
+
+    wgpu::RenderPipeline ResourceRegistry::renderPipeline(Handle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mPipelines[handle].pipeline;
+    }
+
+    wgpu::BindGroup ResourceRegistry::bindGroup(Handle handle) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBindGroups[handle].bindGroup;
+    }
+
+    void ResourceRegistry::recreate(wgpu::Device device, wgpu::Queue queue)
+    {
+        // The old objects belong to the lost device, they are useless now.
+        releaseAll();
+        attach(device, queue);
+
+        // No record is added while we rebuild, so we can walk the deques without the lock
+        // and only take it to publish each new object.
+        auto publish = [this](auto &slot, auto object)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            slot = object;
+        };
+
+        // First wave: everything that only needs the device.
+        std::vector<std::future<void>> tasks;
+        for (ShaderRecord &record : mShaders)
+        {
+            tasks.push_back(launchAsync([this, device, &record, publish]()
+                                        { publish(record.module, createShader(device, record)); }));
+        }
+        tasks.push_back(launchAsync([this, device, queue, publish]()
+        {
+            for (BufferRecord &record : mBuffers)
+            {
+                publish(record.buffer, createBuffer(device, queue, record));
+            }
+        }));
+        tasks.push_back(launchAsync([this, device, publish]()
+        {
+            for (BindGroupLayoutRecord &record : mBindGroupLayouts)
+            {
+                publish(record.layout, createBindGroupLayout(device, record));
+            }
+        }));
+        for (std::future<void> &task : tasks)
+        {
+            task.get();
+        }
+        tasks.clear();
+
+        // Second wave: pipelines need shaders and layouts, bind groups need buffers and layouts.
+        for (PipelineRecord &record : mPipelines)
+        {
+            tasks.push_back(launchAsync([this, device, &record, publish]()
+                                        { publish(record.pipeline, record.builder(device, *this)); }));
+        }
+        tasks.push_back(launchAsync([this, device, publish]()
+        {
+            for (BindGroupRecord &record : mBindGroups)
+            {
+                publish(record.bindGroup, createBindGroup(device, record));
+            }
+        }));
+        for (std::future<void> &task : tasks)
+        {
+            task.get();
+        }
+    }
+
+    void ResourceRegistry::releaseAll()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (BindGroupRecord &record : mBindGroups)
+        {
+            if (record.bindGroup)
+                record.bindGroup.release();
+            record.bindGroup = nullptr;
+        }
+        for (PipelineRecord &record : mPipelines)
+        {
+            if (record.pipeline)
+                record.pipeline.release();
+            record.pipeline = nullptr;
+        }
+        for (BindGroupLayoutRecord &record : mBindGroupLayouts)
+        {
+            if (record.layout)
+                record.layout.release();
+            record.layout = nullptr;
+        }
+        for (BufferRecord &record : mBuffers)
+        {
+            if (record.buffer)
+            {
+                record.buffer.destroy();
+                record.buffer.release();
+            }
+            record.buffer = nullptr;
+        }
+        for (ShaderRecord &record : mShaders)
+        {
+            if (record.module)
+                record.module.release();
+            record.module = nullptr;
+        }
+        mDevice = nullptr;
+        mQueue = nullptr;
+    }
+
+    wgpu::ShaderModule ResourceRegistry::createShader(wgpu::Device device, const ShaderRecord &record) const
+    {
+        ShaderFactory factory;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            factory = mShaderFactory;
+        }
+        if (factory)
+        {
+            return factory(device, record.label, record.source);
+        }
+
+        wgpu::ShaderModuleDescriptor shaderModuleDesc = {};
+        shaderModuleDesc.label = record.label.c_str();
+#ifdef WEBGPU_BACKEND_WGPU
+        shaderModuleDesc.hintCount = 0;
+        shaderModuleDesc.hints = nullptr;
+#endif
+        // ShaderModule needs code, and it can't be directly connected to the ShaderModule.
+        // We need a ShaderModuleWGSLDescriptor for that.
+        wgpu::ShaderModuleWGSLDescriptor shaderCodeDesc;
+        shaderCodeDesc.chain.next = nullptr;
+        shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
+        shaderCodeDesc.code = record.source.c_str();
+
+        // Chain the module with the code.
+        shaderModuleDesc.nextInChain = &shaderCodeDesc.chain;
+        return device.createShaderModule(shaderModuleDesc);
+    }
+
+    wgpu::Buffer ResourceRegistry::createBuffer(wgpu::Device device, wgpu::Queue queue, const BufferRecord &record) const
+    {
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = record.label.c_str();
+        bufferDesc.usage = record.usage;
+        bufferDesc.size = record.data.size();
+        bufferDesc.mappedAtCreation = false;
+        wgpu::Buffer buffer = device.createBuffer(bufferDesc);
+        queue.writeBuffer(buffer, 0, record.data.data(), record.data.size());
+        return buffer;
+    }
+
+    wgpu::BindGroupLayout ResourceRegistry::createBindGroupLayout(wgpu::Device device, const BindGroupLayoutRecord &record) const
+    {
+        wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+        bindGroupLayoutDesc.label = record.label.c_str();
+        bindGroupLayoutDesc.entryCount = static_cast<uint32_t>(record.entries.size());
+        bindGroupLayoutDesc.entries = record.entries.data();
+        return device.createBindGroupLayout(bindGroupLayoutDesc);
+    }
+
+    wgpu::BindGroup ResourceRegistry::createBindGroup(wgpu::Device device, const BindGroupRecord &record) const
+    {
+        std::vector<wgpu::BindGroupEntry> entries(record.entries.size());
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            entries[i].binding = record.entries[i].binding;
+            entries[i].buffer = buffer(record.entries[i].buffer);
+            entries[i].offset = record.entries[i].offset;
+            entries[i].size = record.entries[i].size;
+        }
+
+        wgpu::BindGroupDescriptor bindGroupDesc;
+        bindGroupDesc.label = record.label.c_str();
+        bindGroupDesc.layout = bindGroupLayout(record.layout);
+        bindGroupDesc.entryCount = static_cast<uint32_t>(entries.size());
+        bindGroupDesc.entries = entries.data();
+        return device.createBindGroup(bindGroupDesc);
+    }
+} // namespace learn::webgpu
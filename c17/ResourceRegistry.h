@@ -0,0 +1,132 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Keeps the CPU side description of every GPU object the application creates: WGSL
+    // sources, buffer contents, bind group layouts and bind groups, plus a builder function
+    // for each render pipeline. The GPU objects are created right away on the attached device,
+    // and when that device is lost recreate() builds all of them again on a new one.
+    //
+    // add*() can be called from several threads at once (init builds the pipeline and the
+    // buffers in parallel), the GPU object is created outside of the lock so they don't wait
+    // on each other.
+    class ResourceRegistry
+    {
+    public:
+        using Handle = size_t;
+        static constexpr Handle kInvalidHandle = std::numeric_limits<Handle>::max();
+
+        using PipelineBuilder = std::function<wgpu::RenderPipeline(wgpu::Device, const ResourceRegistry &)>;
+        // Creates a shader module from a label and a WGSL source, e.g. through a cache.
+        using ShaderFactory = std::function<wgpu::ShaderModule(wgpu::Device, const std::string &, const std::string &)>;
+
+        struct BufferBinding
+        {
+            uint32_t binding;
+            Handle buffer;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        ~ResourceRegistry() { releaseAll(); }
+
+        void attach(wgpu::Device device, wgpu::Queue queue);
+        // Without a factory the WGSL goes straight to device.createShaderModule.
+        void setShaderFactory(ShaderFactory factory);
+
+        Handle addShader(std::string label, std::string source);
+        // The data is copied and kept, size is rounded up to a multiple of 4 bytes.
+        // A null data gives a zeroed buffer.
+        Handle addBuffer(std::string label, WGPUBufferUsageFlags usage, const void *data, uint64_t size);
+        Handle addBindGroupLayout(std::string label, std::vector<wgpu::BindGroupLayoutEntry> entries);
+        Handle addRenderPipeline(std::string label, PipelineBuilder builder);
+        Handle addBindGroup(std::string label, Handle layout, std::vector<BufferBinding> entries);
+
+        // Same as queue.writeBuffer, but also updates the retained copy so a rebuilt
+        // buffer comes back with its latest content (e.g. the current time uniform).
+        void writeBuffer(Handle buffer, uint64_t offset, const void *data, uint64_t size);
+
+        // Swaps in a new WGSL source and the module built from it, e.g. after a hot reload.
+        // The old module is released, recreate() uses the new source from now on.
+        void replaceShader(Handle handle, std::string source, wgpu::ShaderModule module);
+        void replaceRenderPipeline(Handle handle, wgpu::RenderPipeline pipeline);
+
+        wgpu::ShaderModule shader(Handle handle) const;
+        wgpu::Buffer buffer(Handle handle) const;
+        wgpu::BindGroupLayout bindGroupLayout(Handle handle) const;
+        wgpu::RenderPipeline renderPipeline(Handle handle) const;
+        wgpu::BindGroup bindGroup(Handle handle) const;
+
+        // Rebuilds every object on a new device. Shaders, buffers and layouts don't depend
+        // on each other and are created in parallel, then pipelines and bind groups.
+        void recreate(wgpu::Device device, wgpu::Queue queue);
+
+        // Releases the GPU objects but keeps the descriptions.
+        void releaseAll();
+
+    private:
+        struct ShaderRecord
+        {
+            std::string label;
+            std::string source;
+            wgpu::ShaderModule module = nullptr;
+        };
+
+        struct BufferRecord
+        {
+            std::string label;
+            WGPUBufferUsageFlags usage;
+            std::vector<uint8_t> data;
+            wgpu::Buffer buffer = nullptr;
+        };
+
+        struct BindGroupLayoutRecord
+        {
+            std::string label;
+            std::vector<wgpu::BindGroupLayoutEntry> entries;
+            wgpu::BindGroupLayout layout = nullptr;
+        };
+
+        struct PipelineRecord
+        {
+            std::string label;
+            PipelineBuilder builder;
+            wgpu::RenderPipeline pipeline = nullptr;
+        };
+
+        struct BindGroupRecord
+        {
+            std::string label;
+            Handle layout;
+            std::vector<BufferBinding> entries;
+            wgpu::BindGroup bindGroup = nullptr;
+        };
+
+        wgpu::ShaderModule createShader(wgpu::Device device, const ShaderRecord &record) const;
+        wgpu::Buffer createBuffer(wgpu::Device device, wgpu::Queue queue, const BufferRecord &record) const;
+        wgpu::BindGroupLayout createBindGroupLayout(wgpu::Device device, const BindGroupLayoutRecord &record) const;
+        wgpu::BindGroup createBindGroup(wgpu::Device device, const BindGroupRecord &record) const;
+
+        mutable std::mutex mMutex;
+        ShaderFactory mShaderFactory;
+        wgpu::Device mDevice = nullptr;
+        wgpu::Queue mQueue = nullptr;
+        // deque so that references to records stay valid while others are added
+        std::deque<ShaderRecord> mShaders;
+        std::deque<BufferRecord> mBuffers;
+        std::deque<BindGroupLayoutRecord> mBindGroupLayouts;
+        std::deque<PipelineRecord> mPipelines;
+        std::deque<BindGroupRecord> mBindGroups;
+    };
+} // namespace learn::webgpu
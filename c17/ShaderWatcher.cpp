@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <iostream>
+
+#include "ShaderWatcher.h"
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif // __linux__
+
+namespace learn::webgpu
+{
+
+#ifdef __linux__
+
+    ShaderWatcher::ShaderWatcher(std::string directory) : mDirectory(std::move(directory))
+    {
+        mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (mInotify < 0)
+        {
+            std::cout << "could not initialize inotify" << std::endl;
+            return;
+        }
+        // IN_CLOSE_WRITE for editors writing in place, IN_MOVED_TO for the ones renaming a new file.
+        mWatch = inotify_add_watch(mInotify, mDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (mWatch < 0)
+        {
+            std::cout << "could not watch " << mDirectory << std::endl;
+        }
+    }
+
+    ShaderWatcher::~ShaderWatcher()
+    {
+        if (mInotify >= 0)
+        {
+            close(mInotify);
+        }
+    }
+
+    bool ShaderWatcher::valid() const
+    {
+        return mInotify >= 0 && mWatch >= 0;
+    }
+
+    std::vector<std::string> ShaderWatcher::poll()
+    {
+        std::vector<std::string> changed;
+        if (!valid())
+        {
+            return changed;
+        }
+
+        // inotify_event has a variable length name at the end, the buffer has to be
+        // aligned for it and large enough for at least one event.
+        alignas(inotify_event) char buffer[4096];
+        while (true)
+        {
+            ssize_t length = read(mInotify, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                // EAGAIN: nothing left to read.
+                break;
+            }
+            for (char *cursor = buffer; cursor < buffer + length;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(cursor);
+                if (event->len > 0)
+                {
+                    std::string name = event->name;
+                    if (std::find(changed.begin(), changed.end(), name) == changed.end())
+                    {
+                        changed.push_back(name);
+                    }
+                }
+                cursor += sizeof(inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+
+#else
+
+    ShaderWatcher::ShaderWatcher(std::string directory) : mDirectory(std::move(directory))
+    {
+        // Remember the current state, only later writes count as changes.
+        scan(nullptr);
+        mLastScan = std::chrono::steady_clock::now();
+    }
+
+    ShaderWatcher::~ShaderWatcher() = default;
+
+    bool ShaderWatcher::valid() const
+    {
+        std::error_code error;
+        return std::filesystem::is_directory(mDirectory, error);
+    }
+
+    std::vector<std::string> ShaderWatcher::poll()
+    {
+        std::vector<std::string> changed;
+        // Reading the directory every frame would be a waste, a shader edit can wait a bit.
+        auto now = std::chrono::steady_clock::now();
+        if (now - mLastScan < std::chrono::milliseconds(250))
+        {
+            return changed;
+        }
+        mLastScan = now;
+        scan(&changed);
+        return changed;
+    }
+
+    void ShaderWatcher::scan(std::vector<std::string> *changed)
+    {
+        std::error_code error;
+        for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            std::string name = entry.path().filename().string();
+            std::filesystem::file_time_type writeTime = entry.last_write_time(error);
+            if (error)
+            {
+                continue;
+            }
+            auto it = mWriteTimes.find(name);
+            if (it == mWriteTimes.end() || it->second != writeTime)
+            {
+                mWriteTimes[name] = writeTime;
+                if (changed)
+                {
+                    changed->push_back(name);
+                }
+            }
+        }
+    }
+
+#endif // __linux__
+} // namespace learn::webgpu
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Tells which files of a directory were written since the last poll(). On Linux it uses
+    // inotify, the directory is watched rather than the files because most editors save by
+    // writing a new file and renaming it over the old one. Elsewhere it compares the file
+    // modification times every few hundred milliseconds.
+    class ShaderWatcher
+    {
+    public:
+        explicit ShaderWatcher(std::string directory);
+        ~ShaderWatcher();
+
+        ShaderWatcher(const ShaderWatcher &) = delete;
+        ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+        bool valid() const;
+        const std::string &directory() const { return mDirectory; }
+
+        // Never blocks, every changed file name is returned once even if it was written several times.
+        std::vector<std::string> poll();
+
+    private:
+        std::string mDirectory;
+#ifdef __linux__
+        int mInotify = -1;
+        int mWatch = -1;
+#else
+        void scan(std::vector<std::string> *changed);
+
+        std::map<std::string, std::filesystem::file_time_type> mWriteTimes;
+        std::chrono::steady_clock::time_point mLastScan;
+#endif
+    };
+} // namespace learn::webgpu
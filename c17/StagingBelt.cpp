@@ -0,0 +1,158 @@
+#include <webgpu/webgpu.hpp>
+
+#include "AsyncRequests.h"
+#include "StagingBelt.h"
+
+namespace learn::webgpu
+{
+
+    StagingBelt::StagingBelt(uint64_t chunkSize, uint32_t chunkCount)
+        : mChunkSize((chunkSize + 7) & ~uint64_t(7)), mChunkCount(chunkCount), mChunks(new Chunk[chunkCount])
+    {
+    }
+
+    StagingBelt::~StagingBelt()
+    {
+        release();
+    }
+
+    void StagingBelt::create(wgpu::Device device)
+    {
+        release();
+        mDevice = device;
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Staging belt chunk";
+        bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+        bufferDesc.size = mChunkSize;
+        // Writable right away, the first uploads don't wait for a map.
+        bufferDesc.mappedAtCreation = true;
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            mChunks[i].buffer = device.createBuffer(bufferDesc);
+            mChunks[i].state = ChunkState::Mapped;
+            mChunks[i].used = 0;
+        }
+        mCurrent = 0;
+    }
+
+    void StagingBelt::release()
+    {
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            if (mChunks[i].buffer)
+            {
+                // Rejects a pending mapping, its callback still fires (with an error).
+                mChunks[i].buffer.destroy();
+            }
+        }
+        // Wait for those callbacks while the chunks are still ours. One poll isn't always
+        // enough, and a late callback would mark a chunk that create() mapped again, or one
+        // that is already freed.
+        if (mDevice)
+        {
+            while (hasPendingMap())
+            {
+                processDeviceEvents(mDevice, true);
+            }
+        }
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            if (mChunks[i].buffer)
+            {
+                mChunks[i].buffer.release();
+                mChunks[i].buffer = nullptr;
+            }
+            mChunks[i].state = ChunkState::Failed;
+        }
+        mDevice = nullptr;
+    }
+
+    bool StagingBelt::hasPendingMap() const
+    {
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            if (mChunks[i].state == ChunkState::Mapping)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool StagingBelt::upload(wgpu::CommandEncoder encoder, wgpu::Buffer destination, uint64_t offset, uint64_t size, const BufferFiller &fill)
+    {
+        if (!mDevice || size > mChunkSize)
+        {
+            return false;
+        }
+        // Mapped ranges start at multiples of 8 bytes.
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            Chunk &chunk = mChunks[mCurrent];
+            uint64_t start = (chunk.used + 7) & ~uint64_t(7);
+            if (chunk.state == ChunkState::Mapped && start + size <= mChunkSize)
+            {
+                void *data = chunk.buffer.getMappedRange(start, size);
+                if (!data)
+                {
+                    return false;
+                }
+                fill(data, size);
+                encoder.copyBufferToBuffer(chunk.buffer, start, destination, offset, size);
+                chunk.used = start + size;
+                mStatistics.uploadedBytes += size;
+                ++mStatistics.uploads;
+                return true;
+            }
+            mCurrent = (mCurrent + 1) % mChunkCount;
+        }
+        ++mStatistics.stalls;
+        return false;
+    }
+
+    void StagingBelt::finish()
+    {
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            Chunk &chunk = mChunks[i];
+            if (chunk.state == ChunkState::Mapped && chunk.used > 0)
+            {
+                chunk.buffer.unmap();
+                chunk.state = ChunkState::Written;
+            }
+        }
+    }
+
+    void StagingBelt::submitted()
+    {
+        auto onMapped = [](WGPUBufferMapAsyncStatus status, void *pUserData)
+        {
+            Chunk &chunk = *reinterpret_cast<Chunk *>(pUserData);
+            chunk.state = status == WGPUBufferMapAsyncStatus_Success ? ChunkState::Mapped : ChunkState::Failed;
+        };
+        for (uint32_t i = 0; i < mChunkCount; ++i)
+        {
+            Chunk &chunk = mChunks[i];
+            if (chunk.state == ChunkState::Written)
+            {
+                chunk.used = 0;
+                chunk.state = ChunkState::Mapping;
+                wgpuBufferMapAsync(chunk.buffer, wgpu::MapMode::Write, 0, mChunkSize, onMapped, (void *)&chunk);
+            }
+        }
+    }
+
+    void StagingBelt::poll()
+    {
+        if (mDevice)
+        {
+            processDeviceEvents(mDevice, false);
+        }
+    }
+
+    void StagingBelt::report(std::ostream &out) const
+    {
+        out << "staging belt: " << mStatistics.uploadedBytes << " bytes in " << mStatistics.uploads << " uploads through "
+            << mChunkCount << " x " << mChunkSize << " bytes, " << mStatistics.stalls << " stalls" << std::endl;
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "MappedUpload.h"
+
+namespace learn::webgpu
+{
+
+    // Streams data to the GPU through a fixed set of mapped staging buffers, the chunks.
+    // upload() writes into the mapped chunk in use and records a copy from it into the
+    // destination. finish() unmaps the chunks written so the encoder can be submitted, and
+    // submitted() maps them again: they become writable once the GPU is done copying.
+    //
+    // However much is uploaded, the staging memory stays at chunkCount * chunkSize. When
+    // every chunk is still on its way, upload() returns false and the caller tries again
+    // next frame instead of waiting.
+    class StagingBelt
+    {
+    public:
+        StagingBelt(uint64_t chunkSize, uint32_t chunkCount);
+        ~StagingBelt();
+        StagingBelt(const StagingBelt &) = delete;
+        StagingBelt &operator=(const StagingBelt &) = delete;
+
+        // Creates the chunks, mapped, on device. Again after a device loss.
+        void create(wgpu::Device device);
+        void release();
+
+        uint64_t chunkSize() const { return mChunkSize; }
+
+        // fill writes size bytes (at most chunkSize, a multiple of 4) that are then copied to
+        // destination at offset by encoder.
+        bool upload(wgpu::CommandEncoder encoder, wgpu::Buffer destination, uint64_t offset, uint64_t size, const BufferFiller &fill);
+        // Call before submitting the encoders given to upload().
+        void finish();
+        // Call after submitting them.
+        void submitted();
+        // Lets the device fire the map callbacks without blocking.
+        void poll();
+
+        struct Statistics
+        {
+            uint64_t uploadedBytes = 0;
+            uint64_t uploads = 0;
+            // upload() found no mapped chunk.
+            uint64_t stalls = 0;
+        };
+        const Statistics &statistics() const { return mStatistics; }
+        void report(std::ostream &out) const;
+
+    private:
+        enum class ChunkState
+        {
+            Mapped,
+            // Unmapped by finish(), the copies from it are waiting to be submitted.
+            Written,
+            Mapping,
+            Failed
+        };
+
+        struct Chunk
+        {
+            wgpu::Buffer buffer = nullptr;
+            std::atomic<ChunkState> state{ChunkState::Failed};
+            // Bytes written since it was mapped.
+            uint64_t used = 0;
+        };
+
+        // A chunk waits for its map callback.
+        bool hasPendingMap() const;
+
+        wgpu::Device mDevice = nullptr;
+        uint64_t mChunkSize = 0;
+        uint32_t mChunkCount = 0;
+        // Never reallocated: the map callbacks point at the chunks.
+        std::unique_ptr<Chunk[]> mChunks;
+        // The chunk uploads are appended to while it has room.
+        uint32_t mCurrent = 0;
+        Statistics mStatistics;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // Records when each startup phase (window creation, adapter request, shader
+    // compilation...) begins and ends relative to the moment the application started.
+    // Phases can run on different threads, so every access goes through a mutex.
+    // Once the first frame is presented we can print a per phase report and see
+    // which phases overlapped and which ones are still on the critical path.
+    class StartupTimeline
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct Phase
+        {
+            std::string name;
+            double startMs;
+            double endMs;
+        };
+
+        // RAII helper, the phase ends when the scope goes away.
+        class Scope
+        {
+        public:
+            Scope(StartupTimeline &timeline, std::string name)
+                : mTimeline(timeline), mName(std::move(name)), mStart(Clock::now()) {}
+            ~Scope() { mTimeline.record(mName, mStart, Clock::now()); }
+
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+
+        private:
+            StartupTimeline &mTimeline;
+            std::string mName;
+            Clock::time_point mStart;
+        };
+
+        StartupTimeline() : mOrigin(Clock::now()) {}
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mOrigin = Clock::now();
+            mPhases.clear();
+            mFirstFrameMs = -1.0;
+        }
+
+        Scope scope(std::string name) { return Scope(*this, std::move(name)); }
+
+        void record(const std::string &name, Clock::time_point start, Clock::time_point end)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mPhases.push_back({name, toMs(start), toMs(end)});
+        }
+
+        void markFirstFrame()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mFirstFrameMs < 0.0)
+            {
+                mFirstFrameMs = toMs(Clock::now());
+            }
+        }
+
+        double timeToFirstFrameMs() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mFirstFrameMs;
+        }
+
+        std::vector<Phase> phases() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mPhases;
+        }
+
+        // Prints every phase with its start offset and duration. The sum of all durations
+        // is what a fully serial startup would cost, comparing it with the time to first
+        // frame tells us how much the overlapped init actually saved.
+        void report(std::ostream &out) const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            double serialMs = 0.0;
+            out << std::fixed << std::setprecision(2);
+            out << "Startup phases:" << std::endl;
+            for (const Phase &phase : mPhases)
+            {
+                double duration = phase.endMs - phase.startMs;
+                serialMs += duration;
+                out << " - " << std::left << std::setw(24) << phase.name << std::right
+                    << " start " << std::setw(9) << phase.startMs << " ms"
+                    << "  duration " << std::setw(9) << duration << " ms" << std::endl;
+            }
+            out << " Sum of phases:       " << serialMs << " ms" << std::endl;
+            if (mFirstFrameMs >= 0.0)
+            {
+                out << " Time to first frame: " << mFirstFrameMs << " ms" << std::endl;
+            }
+            out << std::defaultfloat;
+        }
+
+    private:
+        double toMs(Clock::time_point point) const
+        {
+            return std::chrono::duration<double, std::milli>(point - mOrigin).count();
+        }
+
+        mutable std::mutex mMutex;
+        Clock::time_point mOrigin;
+        std::vector<Phase> mPhases;
+        double mFirstFrameMs = -1.0;
+    };
+} // namespace learn::webgpu
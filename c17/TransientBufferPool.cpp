@@ -0,0 +1,226 @@
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <random>
+
+#include "TransientBufferPool.h"
+
+namespace learn::webgpu
+{
+
+    uint64_t TransientBufferPool::sizeClass(uint64_t size)
+    {
+        uint64_t sizeClass = kMinSize;
+        while (sizeClass < size)
+        {
+            sizeClass *= 2;
+        }
+        return sizeClass;
+    }
+
+    void TransientBufferPool::reset(wgpu::Device device)
+    {
+        releaseAll();
+        mDevice = device;
+    }
+
+    void TransientBufferPool::releaseAll()
+    {
+        for (auto &[key, buffers] : mFree)
+        {
+            for (wgpu::Buffer &buffer : buffers)
+            {
+                buffer.destroy();
+                buffer.release();
+            }
+        }
+        mFree.clear();
+        // Destroying is fine while the GPU still uses them, the driver frees them after.
+        for (Pending &pending : mPending)
+        {
+            pending.lease.buffer.destroy();
+            pending.lease.buffer.release();
+        }
+        mPending.clear();
+        mStatistics.heldBytes = 0;
+        mStatistics.pendingBytes = 0;
+    }
+
+    TransientBufferPool::Lease TransientBufferPool::acquire(WGPUBufferUsageFlags usage, uint64_t size)
+    {
+        ++mStatistics.requests;
+        Lease lease;
+        lease.usage = usage;
+        lease.size = sizeClass(size);
+        mStatistics.leasedBytes += lease.size;
+
+        auto free = mFree.find(Key{usage, lease.size});
+        if (free != mFree.end() && !free->second.empty())
+        {
+            ++mStatistics.hits;
+            lease.buffer = free->second.back();
+            free->second.pop_back();
+            mStatistics.heldBytes -= lease.size;
+            return lease;
+        }
+
+        ++mStatistics.created;
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Transient buffer";
+        bufferDesc.usage = usage;
+        bufferDesc.size = lease.size;
+        bufferDesc.mappedAtCreation = false;
+        lease.buffer = mDevice.createBuffer(bufferDesc);
+        return lease;
+    }
+
+    void TransientBufferPool::release(const Lease &lease, GpuFence fence)
+    {
+        mStatistics.leasedBytes -= lease.size;
+        if (mTimeline.isComplete(fence))
+        {
+            recycle(lease);
+            return;
+        }
+        mStatistics.pendingBytes += lease.size;
+        mPending.push_back(Pending{fence, lease});
+    }
+
+    void TransientBufferPool::collect()
+    {
+        while (!mPending.empty() && mTimeline.isComplete(mPending.front().fence))
+        {
+            mStatistics.pendingBytes -= mPending.front().lease.size;
+            recycle(mPending.front().lease);
+            mPending.pop_front();
+        }
+    }
+
+    void TransientBufferPool::recycle(const Lease &lease)
+    {
+        if (mStatistics.heldBytes + lease.size > mMaxHeldBytes)
+        {
+            ++mStatistics.destroyed;
+            wgpu::Buffer buffer = lease.buffer;
+            buffer.destroy();
+            buffer.release();
+            return;
+        }
+        mStatistics.heldBytes += lease.size;
+        mFree[Key{lease.usage, lease.size}].push_back(lease.buffer);
+    }
+
+    void TransientBufferPool::report(std::ostream &out) const
+    {
+        out << "transient buffers: " << mStatistics.requests << " requests, " << std::fixed << std::setprecision(1)
+            << mStatistics.hitRate() * 100.0 << "% hits, " << mStatistics.created << " created, " << mStatistics.destroyed
+            << " destroyed, " << mStatistics.heldBytes << " bytes held (" << mStatistics.pendingBytes << " waiting for the GPU, "
+            << mStatistics.leasedBytes << " in use)" << std::defaultfloat << std::endl;
+    }
+
+    namespace
+    {
+        struct FrameResult
+        {
+            double wallMs = 0.0;
+            double cpuMs = 0.0;
+        };
+
+        // Every frame clears a few scratch buffers of 1 KB to 1 MB on the GPU, at most three
+        // frames ahead of it. The random sizes are the same for both runs.
+        FrameResult runScratchFrames(wgpu::Device device, TransientBufferPool *pool, GpuTimeline &timeline, int frames)
+        {
+            constexpr WGPUBufferUsageFlags kUsage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::CopySrc;
+            std::mt19937 random(1);
+            std::uniform_int_distribution<int> countDistribution(1, 8);
+            std::uniform_int_distribution<int> sizeDistribution(10, 20);
+            std::array<GpuFence, 3> frameFences{};
+
+            std::clock_t cpuStart = std::clock();
+            auto start = std::chrono::steady_clock::now();
+            std::vector<TransientBufferPool::Lease> leases;
+            for (int frame = 0; frame < frames; ++frame)
+            {
+                timeline.wait(frameFences[frame % frameFences.size()]);
+                if (pool)
+                {
+                    pool->collect();
+                }
+
+                wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::Default);
+                int count = countDistribution(random);
+                leases.clear();
+                for (int i = 0; i < count; ++i)
+                {
+                    uint64_t size = uint64_t(1) << sizeDistribution(random);
+                    // Not always a power of two, like real scratch sizes.
+                    size -= size / 4 * (i % 2);
+                    TransientBufferPool::Lease lease;
+                    if (pool)
+                    {
+                        lease = pool->acquire(kUsage, size);
+                    }
+                    else
+                    {
+                        wgpu::BufferDescriptor bufferDesc;
+                        bufferDesc.label = "Scratch buffer";
+                        bufferDesc.usage = kUsage;
+                        bufferDesc.size = size;
+                        bufferDesc.mappedAtCreation = false;
+                        lease.buffer = device.createBuffer(bufferDesc);
+                        lease.usage = kUsage;
+                        lease.size = size;
+                    }
+                    encoder.clearBuffer(lease.buffer, 0, size);
+                    leases.push_back(lease);
+                }
+                wgpu::CommandBuffer command = encoder.finish(wgpu::Default);
+                encoder.release();
+                GpuFence fence = timeline.submit(command);
+                command.release();
+                frameFences[frame % frameFences.size()] = fence;
+
+                for (TransientBufferPool::Lease &lease : leases)
+                {
+                    if (pool)
+                    {
+                        pool->release(lease, fence);
+                    }
+                    else
+                    {
+                        lease.buffer.destroy();
+                        lease.buffer.release();
+                    }
+                }
+            }
+            timeline.wait(timeline.signal());
+            FrameResult result;
+            result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+            result.cpuMs = static_cast<double>(std::clock() - cpuStart) * 1000.0 / CLOCKS_PER_SEC / frames;
+            return result;
+        }
+    } // namespace
+
+    void benchmarkTransientBuffers(wgpu::Device device, wgpu::Queue queue, std::ostream &out)
+    {
+        constexpr int kFrames = 1000;
+        GpuTimeline timeline(device, queue);
+        TransientBufferPool pool(timeline);
+        pool.reset(device);
+
+        out << kFrames << " frames of 1 to 8 scratch buffers from 1 KB to 1 MB" << std::endl;
+        out << "path              wall ms/frame   cpu ms/frame" << std::endl;
+        const char *pathNames[] = {"create/destroy", "pool"};
+        for (int path = 0; path < 2; ++path)
+        {
+            FrameResult result = runScratchFrames(device, path == 1 ? &pool : nullptr, timeline, kFrames);
+            out << std::left << std::setw(18) << pathNames[path] << std::right << std::fixed << std::setprecision(3)
+                << std::setw(13) << result.wallMs << std::setw(15) << result.cpuMs << std::defaultfloat << std::endl;
+        }
+        pool.collect();
+        pool.report(out);
+    }
+} // namespace learn::webgpu
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "GpuTimeline.h"
+
+namespace learn::webgpu
+{
+
+    // Recycles short lived buffers (scratch space of a compute pass, staging for a readback...)
+    // instead of creating and destroying them in the driver every frame. Buffers are grouped
+    // by usage and by size class, the next power of two of the requested size, so a request
+    // is served by any earlier buffer of the same class.
+    //
+    // A released buffer may still be read or written by commands on the queue, so it only
+    // goes back to the pool once the fence given with it completed. Mapped buffers have to be
+    // unmapped before they are released.
+    //
+    // Nothing in the application leases from it yet, its buffers are all created at setup and
+    // the readbacks and mesh streaming have rings of their own. benchmarkTransientBuffers is
+    // the only user, it shows what a per-frame scratch workload would gain.
+    class TransientBufferPool
+    {
+    public:
+        struct Lease
+        {
+            wgpu::Buffer buffer = nullptr;
+            WGPUBufferUsageFlags usage = 0;
+            // The size class, at least the requested size.
+            uint64_t size = 0;
+        };
+
+        static constexpr uint64_t kMinSize = 256;
+        static constexpr uint64_t kDefaultMaxHeldBytes = 64ull * 1024 * 1024;
+
+        explicit TransientBufferPool(GpuTimeline &timeline, uint64_t maxHeldBytes = kDefaultMaxHeldBytes)
+            : mTimeline(timeline), mMaxHeldBytes(maxHeldBytes) {}
+        ~TransientBufferPool() { releaseAll(); }
+        TransientBufferPool(const TransientBufferPool &) = delete;
+        TransientBufferPool &operator=(const TransientBufferPool &) = delete;
+
+        // Buffers are created on device from now on, after a device loss the old ones are dropped.
+        void reset(wgpu::Device device);
+        void releaseAll();
+
+        // A buffer of at least size bytes. Its content is whatever the last user left in it.
+        Lease acquire(WGPUBufferUsageFlags usage, uint64_t size);
+        // Gives lease back once fence completes, the fence of the last submit that uses it.
+        void release(const Lease &lease, GpuFence fence);
+        // Moves the buffers whose fence completed back to the pool, call it once per frame.
+        void collect();
+
+        static uint64_t sizeClass(uint64_t size);
+
+        struct Statistics
+        {
+            uint64_t requests = 0;
+            // Requests served by a pooled buffer.
+            uint64_t hits = 0;
+            uint64_t created = 0;
+            // Destroyed because the pool already held maxHeldBytes.
+            uint64_t destroyed = 0;
+            // Idle in the pool, waiting for their fence, and handed out.
+            uint64_t heldBytes = 0;
+            uint64_t pendingBytes = 0;
+            uint64_t leasedBytes = 0;
+
+            double hitRate() const { return requests ? static_cast<double>(hits) / static_cast<double>(requests) : 0.0; }
+        };
+        const Statistics &statistics() const { return mStatistics; }
+        void report(std::ostream &out) const;
+
+    private:
+        using Key = std::pair<WGPUBufferUsageFlags, uint64_t>;
+        struct Pending
+        {
+            GpuFence fence;
+            Lease lease;
+        };
+
+        void recycle(const Lease &lease);
+
+        GpuTimeline &mTimeline;
+        uint64_t mMaxHeldBytes = 0;
+        wgpu::Device mDevice = nullptr;
+        std::map<Key, std::vector<wgpu::Buffer>> mFree;
+        // In release order, which is close to fence order, collect() stops at the first
+        // fence that isn't complete yet.
+        std::deque<Pending> mPending;
+        Statistics mStatistics;
+    };
+
+    // Runs a bursty scratch workload, a few buffers of random sizes per frame, once creating
+    // and destroying them every frame and once through a TransientBufferPool, and prints the
+    // CPU time per frame and the pool's hit rate.
+    void benchmarkTransientBuffers(wgpu::Device device, wgpu::Queue queue, std::ostream &out);
+} // namespace learn::webgpu
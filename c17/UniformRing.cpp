@@ -0,0 +1,47 @@
+#include <webgpu/webgpu.hpp>
+
+#include <cstring>
+
+#include "UniformRing.h"
+
+namespace learn::webgpu
+{
+
+    UniformRing::UniformRing(uint64_t regionSize, uint32_t regionCount)
+        : mRegionSize(regionSize), mRegionCount(regionCount), mStaging(regionSize)
+    {
+    }
+
+    void UniformRing::beginFrame(uint32_t region)
+    {
+        mRegion = region % mRegionCount;
+        mUsed = 0;
+        mBlockCount = 0;
+    }
+
+    bool UniformRing::push(const void *data, uint64_t size, uint32_t &offset)
+    {
+        // The alignment is always a power of two.
+        uint64_t start = (mUsed + mAlignment - 1) & ~uint64_t(mAlignment - 1);
+        if (start + size > mRegionSize)
+        {
+            return false;
+        }
+        std::memcpy(mStaging.data() + start, data, size);
+        mUsed = start + size;
+        ++mBlockCount;
+        offset = static_cast<uint32_t>(mRegion * mRegionSize + start);
+        return true;
+    }
+
+    void UniformRing::flush(wgpu::Queue queue, wgpu::Buffer buffer, uint64_t bufferOffset)
+    {
+        if (mUsed == 0)
+        {
+            return;
+        }
+        // writeBuffer wants a multiple of 4 bytes, the region size is one already.
+        uint64_t size = (mUsed + 3) & ~uint64_t(3);
+        queue.writeBuffer(buffer, bufferOffset + mRegion * mRegionSize, mStaging.data(), size);
+    }
+} // namespace learn::webgpu
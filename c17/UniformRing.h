@@ -0,0 +1,53 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // One big uniform buffer cut into a region per frame. During a frame every uniform block
+    // (one per object, per draw...) is appended to a CPU copy of the current region, at an
+    // offset aligned to minUniformBufferOffsetAlignment, and flush() uploads all of them with
+    // a single writeBuffer. Draws pick their block with the dynamic offset of setBindGroup,
+    // so the bind group layout entry needs hasDynamicOffset.
+    //
+    // With queue.writeBuffer the uploads are ordered with the submits anyway, the regions
+    // are there so the GPU never reads a block we are rewriting once frames overlap: one
+    // region per frame in flight.
+    class UniformRing
+    {
+    public:
+        UniformRing() = default;
+        UniformRing(uint64_t regionSize, uint32_t regionCount);
+
+        uint64_t bufferSize() const { return mRegionSize * mRegionCount; }
+        // From the device limits, may change when the device is recreated.
+        void setAlignment(uint32_t alignment) { mAlignment = alignment; }
+
+        // Starts over in region, the one of the frame slot (see FrameRing), so the blocks of
+        // the frames still in flight are left alone.
+        void beginFrame(uint32_t region);
+        // Copies a block into the current region. Returns false when the region is full,
+        // offset is then left untouched.
+        bool push(const void *data, uint64_t size, uint32_t &offset);
+        // Uploads what was pushed since beginFrame(). bufferOffset is where the ring starts
+        // in buffer, the dynamic offsets are relative to it so it is also the binding offset.
+        void flush(wgpu::Queue queue, wgpu::Buffer buffer, uint64_t bufferOffset = 0);
+
+        uint32_t blockCount() const { return mBlockCount; }
+        uint64_t bytesUsed() const { return mUsed; }
+
+    private:
+        uint64_t mRegionSize = 0;
+        uint32_t mRegionCount = 0;
+        // WebGPU default, the device can only require less.
+        uint32_t mAlignment = 256;
+        uint32_t mRegion = 0;
+        uint64_t mUsed = 0;
+        uint32_t mBlockCount = 0;
+        std::vector<uint8_t> mStaging;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,388 @@
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+
+#include "Hash.h"
+#include "VertexLayout.h"
+
+namespace learn::webgpu
+{
+
+    namespace
+    {
+        enum class Encoding
+        {
+            Float32,
+            Unorm8,
+            Snorm8,
+            Unorm16,
+            Snorm16
+        };
+
+        struct Format
+        {
+            Encoding encoding;
+            uint32_t components;
+        };
+
+        uint32_t componentBytes(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::Unorm8:
+            case Encoding::Snorm8:
+                return 1;
+            case Encoding::Unorm16:
+            case Encoding::Snorm16:
+                return 2;
+            default:
+                return 4;
+            }
+        }
+
+        // Largest integer of a normalized encoding, 1.0 maps to it.
+        float normalizedMax(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::Unorm8:
+                return 255.0f;
+            case Encoding::Snorm8:
+                return 127.0f;
+            case Encoding::Unorm16:
+                return 65535.0f;
+            case Encoding::Snorm16:
+                return 32767.0f;
+            default:
+                return 1.0f;
+            }
+        }
+
+        bool isSigned(Encoding encoding)
+        {
+            return encoding == Encoding::Snorm8 || encoding == Encoding::Snorm16;
+        }
+
+        // 8 and 16 bit formats only come in x2 and x4.
+        uint32_t formatComponents(Encoding encoding, uint32_t components)
+        {
+            if (encoding == Encoding::Float32)
+                return components;
+            return components <= 2 ? 2 : 4;
+        }
+
+        wgpu::VertexFormat toVertexFormat(Encoding encoding, uint32_t components)
+        {
+            bool four = components > 2;
+            switch (encoding)
+            {
+            case Encoding::Unorm8:
+                return four ? wgpu::VertexFormat::Unorm8x4 : wgpu::VertexFormat::Unorm8x2;
+            case Encoding::Snorm8:
+                return four ? wgpu::VertexFormat::Snorm8x4 : wgpu::VertexFormat::Snorm8x2;
+            case Encoding::Unorm16:
+                return four ? wgpu::VertexFormat::Unorm16x4 : wgpu::VertexFormat::Unorm16x2;
+            case Encoding::Snorm16:
+                return four ? wgpu::VertexFormat::Snorm16x4 : wgpu::VertexFormat::Snorm16x2;
+            default:
+                break;
+            }
+            switch (components)
+            {
+            case 1:
+                return wgpu::VertexFormat::Float32;
+            case 2:
+                return wgpu::VertexFormat::Float32x2;
+            case 3:
+                return wgpu::VertexFormat::Float32x3;
+            default:
+                return wgpu::VertexFormat::Float32x4;
+            }
+        }
+
+        Format fromVertexFormat(wgpu::VertexFormat format)
+        {
+            switch (format)
+            {
+            case wgpu::VertexFormat::Unorm8x2:
+                return {Encoding::Unorm8, 2};
+            case wgpu::VertexFormat::Unorm8x4:
+                return {Encoding::Unorm8, 4};
+            case wgpu::VertexFormat::Snorm8x2:
+                return {Encoding::Snorm8, 2};
+            case wgpu::VertexFormat::Snorm8x4:
+                return {Encoding::Snorm8, 4};
+            case wgpu::VertexFormat::Unorm16x2:
+                return {Encoding::Unorm16, 2};
+            case wgpu::VertexFormat::Unorm16x4:
+                return {Encoding::Unorm16, 4};
+            case wgpu::VertexFormat::Snorm16x2:
+                return {Encoding::Snorm16, 2};
+            case wgpu::VertexFormat::Snorm16x4:
+                return {Encoding::Snorm16, 4};
+            case wgpu::VertexFormat::Float32:
+                return {Encoding::Float32, 1};
+            case wgpu::VertexFormat::Float32x2:
+                return {Encoding::Float32, 2};
+            case wgpu::VertexFormat::Float32x3:
+                return {Encoding::Float32, 3};
+            default:
+                return {Encoding::Float32, 4};
+            }
+        }
+
+        const char *encodingName(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::Unorm8:
+                return "unorm8";
+            case Encoding::Snorm8:
+                return "snorm8";
+            case Encoding::Unorm16:
+                return "unorm16";
+            case Encoding::Snorm16:
+                return "snorm16";
+            default:
+                return "float32";
+            }
+        }
+
+        // The smallest encoding whose range holds the attribute and whose rounding error
+        // (half a step) stays within the tolerance.
+        Encoding chooseEncoding(const VertexAttributeDesc &attribute, bool compress)
+        {
+            if (!compress || attribute.tolerance <= 0.0f)
+                return Encoding::Float32;
+            bool unsignedRange = attribute.minValue >= 0.0f && attribute.maxValue <= 1.0f;
+            bool signedRange = attribute.minValue >= -1.0f && attribute.maxValue <= 1.0f;
+            const Encoding candidates[] = {Encoding::Unorm8, Encoding::Snorm8, Encoding::Unorm16, Encoding::Snorm16};
+            for (Encoding encoding : candidates)
+            {
+                bool fits = isSigned(encoding) ? signedRange : unsignedRange;
+                if (fits && 0.5f / normalizedMax(encoding) <= attribute.tolerance)
+                    return encoding;
+            }
+            return Encoding::Float32;
+        }
+
+        uint64_t formatBytes(const Format &format)
+        {
+            return static_cast<uint64_t>(componentBytes(format.encoding)) * format.components;
+        }
+
+        void writeComponent(uint8_t *destination, Encoding encoding, float value)
+        {
+            if (encoding == Encoding::Float32)
+            {
+                std::memcpy(destination, &value, sizeof(float));
+                return;
+            }
+            float low = isSigned(encoding) ? -1.0f : 0.0f;
+            float scaled = std::round(std::clamp(value, low, 1.0f) * normalizedMax(encoding));
+            switch (encoding)
+            {
+            case Encoding::Unorm8:
+                *destination = static_cast<uint8_t>(scaled);
+                break;
+            case Encoding::Snorm8:
+            {
+                int8_t signedValue = static_cast<int8_t>(scaled);
+                std::memcpy(destination, &signedValue, 1);
+                break;
+            }
+            case Encoding::Unorm16:
+            {
+                uint16_t unsignedValue = static_cast<uint16_t>(scaled);
+                std::memcpy(destination, &unsignedValue, 2);
+                break;
+            }
+            default:
+            {
+                int16_t signedValue = static_cast<int16_t>(scaled);
+                std::memcpy(destination, &signedValue, 2);
+                break;
+            }
+            }
+        }
+    } // namespace
+
+    void VertexAttributeDesc::measure(const float *data, size_t count)
+    {
+        if (count == 0)
+            return;
+        auto range = std::minmax_element(data, data + count);
+        minValue = *range.first;
+        maxValue = *range.second;
+    }
+
+    VertexLayout::VertexLayout(std::vector<VertexAttributeDesc> attributes, const VertexLayoutOptions &options)
+        : mAttributes(std::move(attributes)), mPlacements(mAttributes.size())
+    {
+        std::vector<uint64_t> sizes(mAttributes.size());
+        for (size_t i = 0; i < mAttributes.size(); ++i)
+        {
+            Encoding encoding = chooseEncoding(mAttributes[i], options.compress);
+            uint32_t components = formatComponents(encoding, mAttributes[i].components);
+            mPlacements[i].format = toVertexFormat(encoding, components);
+            sizes[i] = formatBytes({encoding, components});
+        }
+
+        // Largest attributes first, so every offset is a multiple of the attribute size
+        // (up to 4) without padding in between.
+        std::vector<size_t> order(mAttributes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b)
+                         { return sizes[a] > sizes[b]; });
+
+        size_t streamCount = options.streams == VertexStreams::Interleaved ? std::min<size_t>(1, order.size()) : order.size();
+        mStreamAttributes.resize(streamCount);
+        std::vector<uint64_t> strides(streamCount, 0);
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            Placement &placement = mPlacements[order[i]];
+            // Split streams keep the declaration order, attribute i goes to vertex buffer slot i.
+            placement.stream = options.streams == VertexStreams::Interleaved ? 0 : static_cast<uint32_t>(order[i]);
+            placement.offset = strides[placement.stream];
+            strides[placement.stream] += sizes[order[i]];
+
+            wgpu::VertexAttribute attribute;
+            attribute.format = placement.format;
+            attribute.offset = placement.offset;
+            attribute.shaderLocation = mAttributes[order[i]].location;
+            mStreamAttributes[placement.stream].push_back(attribute);
+        }
+
+        mBufferLayouts.resize(streamCount);
+        for (size_t stream = 0; stream < streamCount; ++stream)
+        {
+            wgpu::VertexBufferLayout &layout = mBufferLayouts[stream];
+            layout.attributeCount = static_cast<uint32_t>(mStreamAttributes[stream].size());
+            layout.attributes = mStreamAttributes[stream].data();
+            // arrayStride has to be a multiple of 4.
+            layout.arrayStride = (strides[stream] + 3) & ~uint64_t(3);
+            layout.stepMode = wgpu::VertexStepMode::Vertex;
+        }
+    }
+
+    uint64_t VertexLayout::bytesPerVertex() const
+    {
+        uint64_t bytes = 0;
+        for (const wgpu::VertexBufferLayout &layout : mBufferLayouts)
+            bytes += layout.arrayStride;
+        return bytes;
+    }
+
+    uint64_t VertexLayout::identity() const
+    {
+        uint64_t hash = hashValue(static_cast<uint64_t>(mBufferLayouts.size()));
+        for (const wgpu::VertexBufferLayout &layout : mBufferLayouts)
+        {
+            hash = hashValue(layout.arrayStride, hash);
+            hash = hashValue(static_cast<uint32_t>(layout.stepMode), hash);
+            for (size_t i = 0; i < layout.attributeCount; ++i)
+            {
+                const wgpu::VertexAttribute &attribute = layout.attributes[i];
+                hash = hashValue(static_cast<uint32_t>(attribute.format), hash);
+                hash = hashValue(attribute.offset, hash);
+                hash = hashValue(attribute.shaderLocation, hash);
+            }
+        }
+        return hash;
+    }
+
+    uint64_t VertexLayout::uncompressedBytesPerVertex() const
+    {
+        uint64_t bytes = 0;
+        for (const VertexAttributeDesc &attribute : mAttributes)
+            bytes += attribute.components * sizeof(float);
+        return bytes;
+    }
+
+    std::vector<std::vector<uint8_t>> VertexLayout::pack(const std::vector<const float *> &attributeData, uint32_t vertexCount) const
+    {
+        std::vector<std::vector<uint8_t>> streams(mBufferLayouts.size());
+        for (size_t stream = 0; stream < streams.size(); ++stream)
+        {
+            streams[stream].assign(mBufferLayouts[stream].arrayStride * vertexCount, 0);
+        }
+
+        for (size_t i = 0; i < mAttributes.size(); ++i)
+        {
+            const Placement &placement = mPlacements[i];
+            Format format = fromVertexFormat(placement.format);
+            uint32_t componentSize = componentBytes(format.encoding);
+            uint64_t stride = mBufferLayouts[placement.stream].arrayStride;
+            uint32_t components = mAttributes[i].components;
+            uint8_t *base = streams[placement.stream].data() + placement.offset;
+            for (uint32_t vertex = 0; vertex < vertexCount; ++vertex)
+            {
+                const float *source = attributeData[i] + static_cast<size_t>(vertex) * components;
+                uint8_t *destination = base + vertex * stride;
+                // Padding components stay 0, the shader doesn't read them.
+                for (uint32_t c = 0; c < components; ++c)
+                {
+                    writeComponent(destination + c * componentSize, format.encoding, source[c]);
+                }
+            }
+        }
+        return streams;
+    }
+
+    std::string VertexLayout::wgslVertexInput() const
+    {
+        std::vector<size_t> order(mAttributes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b)
+                  { return mAttributes[a].location < mAttributes[b].location; });
+
+        std::ostringstream wgsl;
+        wgsl << "struct VertexInput {\n";
+        for (size_t i : order)
+        {
+            const VertexAttributeDesc &attribute = mAttributes[i];
+            wgsl << "    @location(" << attribute.location << ") " << attribute.name << ": ";
+            if (attribute.components == 1)
+                wgsl << "f32";
+            else
+                wgsl << "vec" << attribute.components << "f";
+            wgsl << ",\n";
+        }
+        wgsl << "};";
+        return wgsl.str();
+    }
+
+    std::string VertexLayout::applyToWgsl(const std::string &source) const
+    {
+        size_t start = source.find("struct VertexInput");
+        if (start == std::string::npos)
+            return source;
+        size_t end = source.find('}', start);
+        if (end == std::string::npos)
+            return source;
+        ++end;
+        if (end < source.size() && source[end] == ';')
+            ++end;
+        return source.substr(0, start) + wgslVertexInput() + source.substr(end);
+    }
+
+    void VertexLayout::report(std::ostream &out) const
+    {
+        out << "vertex layout: " << streamCount() << " stream(s), " << bytesPerVertex() << " bytes per vertex instead of "
+            << uncompressedBytesPerVertex() << std::endl;
+        for (size_t i = 0; i < mAttributes.size(); ++i)
+        {
+            Format format = fromVertexFormat(mPlacements[i].format);
+            out << "  @location(" << mAttributes[i].location << ") " << mAttributes[i].name << ": "
+                << encodingName(format.encoding) << "x" << format.components << " in stream " << mPlacements[i].stream
+                << " at offset " << mPlacements[i].offset;
+            if (format.encoding != Encoding::Float32)
+                out << ", error up to " << 0.5f / normalizedMax(format.encoding);
+            out << std::endl;
+        }
+    }
+} // namespace learn::webgpu
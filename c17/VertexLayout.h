@@ -0,0 +1,95 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace learn::webgpu
+{
+
+    // One attribute as the shader sees it: components floats, @location(location).
+    // The range and the tolerance decide whether a smaller format than Float32 can hold it.
+    struct VertexAttributeDesc
+    {
+        std::string name;
+        uint32_t location = 0;
+        uint32_t components = 1;
+        float minValue = 0.0f;
+        float maxValue = 0.0f;
+        // Largest error we accept on a value, 0 keeps the attribute as Float32.
+        float tolerance = 0.0f;
+
+        // Sets minValue and maxValue from count floats of data.
+        void measure(const float *data, size_t count);
+    };
+
+    enum class VertexStreams
+    {
+        // All attributes in one buffer, one fetch per vertex.
+        Interleaved,
+        // One buffer per attribute, handy when a pass only needs some of them.
+        Split
+    };
+
+    struct VertexLayoutOptions
+    {
+        VertexStreams streams = VertexStreams::Interleaved;
+        // Use normalized 8/16 bit formats when the range and the tolerance allow it.
+        bool compress = true;
+    };
+
+    // Works out the vertex formats and the buffer layouts for a set of attributes, packs the
+    // vertex data accordingly and writes the matching WGSL VertexInput.
+    //
+    // Compressed attributes are still floats in the shader, Unorm8x4 colors arrive as vec4f
+    // with the values back in [0, 1]. The shader may declare fewer components than the
+    // format has, so a vec3f color can be fed from Unorm8x4 and the WGSL doesn't change.
+    class VertexLayout
+    {
+    public:
+        VertexLayout() = default;
+        VertexLayout(std::vector<VertexAttributeDesc> attributes, const VertexLayoutOptions &options);
+
+        // The layouts point into this object, it can be moved but not copied.
+        VertexLayout(const VertexLayout &) = delete;
+        VertexLayout &operator=(const VertexLayout &) = delete;
+        VertexLayout(VertexLayout &&) = default;
+        VertexLayout &operator=(VertexLayout &&) = default;
+
+        const std::vector<wgpu::VertexBufferLayout> &bufferLayouts() const { return mBufferLayouts; }
+        size_t streamCount() const { return mBufferLayouts.size(); }
+        uint64_t bytesPerVertex() const;
+        // What the same attributes take as Float32.
+        uint64_t uncompressedBytesPerVertex() const;
+        // Hash of the buffer layouts, data packed by two layouts with the same identity is
+        // interchangeable. Stored in mesh files to check they match the pipeline.
+        uint64_t identity() const;
+
+        // attributeData[i] holds components floats per vertex for the i-th attribute given to
+        // the constructor. Returns the bytes of every stream, ready to be uploaded.
+        std::vector<std::vector<uint8_t>> pack(const std::vector<const float *> &attributeData, uint32_t vertexCount) const;
+
+        std::string wgslVertexInput() const;
+        // Replaces the struct VertexInput of a WGSL source with wgslVertexInput().
+        std::string applyToWgsl(const std::string &source) const;
+
+        void report(std::ostream &out) const;
+
+    private:
+        struct Placement
+        {
+            wgpu::VertexFormat format = wgpu::VertexFormat::Undefined;
+            uint32_t stream = 0;
+            uint64_t offset = 0;
+        };
+
+        std::vector<VertexAttributeDesc> mAttributes;
+        std::vector<Placement> mPlacements;
+        // Grouped by stream, the buffer layouts point into it.
+        std::vector<std::vector<wgpu::VertexAttribute>> mStreamAttributes;
+        std::vector<wgpu::VertexBufferLayout> mBufferLayouts;
+    };
+} // namespace learn::webgpu
@@ -0,0 +1,35 @@
+# Turns a WGSL file, and its SPIR-V translation when there is one, into a C++ header.
+# Run as a script:
+#   cmake -DNAME=Triangle -DWGSL=triangle.wgsl [-DSPIRV=triangle.spv] -DOUTPUT=TriangleShader.h -P EmbedShader.cmake
+
+file(READ "${WGSL}" WGSL_HEX HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," WGSL_BYTES "${WGSL_HEX}")
+
+set(SPIRV_WORDS "0")
+set(SPIRV_WORD_COUNT 0)
+if (SPIRV AND EXISTS "${SPIRV}")
+	file(READ "${SPIRV}" SPIRV_HEX HEX)
+	string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LENGTH)
+	math(EXPR SPIRV_WORD_COUNT "${SPIRV_HEX_LENGTH} / 8")
+	# naga writes the words little endian, swap the bytes back into uint32_t literals.
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])" "0x\\4\\3\\2\\1," SPIRV_WORDS "${SPIRV_HEX}")
+endif()
+
+file(WRITE "${OUTPUT}.tmp"
+"// Generated by cmake/EmbedShader.cmake from ${WGSL}, do not edit.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace learn::webgpu::shaders
+{
+    inline constexpr char k${NAME}Wgsl[] = {${WGSL_BYTES} 0x00};
+    // Translated and validated by naga at build time, empty when naga was not found.
+    inline constexpr uint32_t k${NAME}Spirv[] = {${SPIRV_WORDS}};
+    inline constexpr size_t k${NAME}SpirvWords = ${SPIRV_WORD_COUNT};
+} // namespace learn::webgpu::shaders
+")
+# Only touch the header when it changed, so the App is not rebuilt for nothing.
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
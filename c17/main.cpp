@@ -1,24 +1,406 @@
-
 #include <webgpu/webgpu.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "Application.h"
+#include "AdapterSelector.h"
+
+namespace
+{
+    // The value of a count option like --frames. std::stoul would throw on "abc" and take
+    // "-1" as a huge count, so anything but plain digits that fit in 32 bits is refused.
+    bool parseCount(const std::string &option, const std::string &text, uint32_t &value)
+    {
+        unsigned long long parsed = std::strtoull(text.c_str(), nullptr, 10);
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || parsed > UINT32_MAX)
+        {
+            std::cout << "invalid value " << text << " for " << option << ", expected a count" << std::endl;
+            return false;
+        }
+        value = static_cast<uint32_t>(parsed);
+        return true;
+    }
+
+    // Probes and ranks every adapter without opening a window, this works on a
+    // machine without a display or GPU when combined with --fallback-adapter.
+    int listAdapters(bool forceFallbackAdapter)
+    {
+        wgpu::InstanceDescriptor desc = {};
+        wgpu::Instance instance = wgpu::createInstance(desc);
+        if (!instance)
+        {
+            std::cout << "falied to create wgpu instance" << std::endl;
+            return -1;
+        }
+
+        learn::webgpu::AdapterSelectorOptions selectorOptions;
+        selectorOptions.forceFallbackAdapter = forceFallbackAdapter;
+        selectorOptions.cachePath = "";
+        int result = 0;
+        {
+            learn::webgpu::AdapterSelector selector(instance, selectorOptions);
+            wgpu::Adapter adapter = selector.select();
+            selector.report(std::cout);
+            if (adapter)
+            {
+                adapter.release();
+            }
+            else
+            {
+                result = -1;
+            }
+        }
+        instance.release();
+        return result;
+    }
+
+    // Runs init twice, once with an empty pipeline cache and once with what the first run
+    // left in it, and compares the time spent in setupPipeline.
+    int benchPipelineCache(learn::webgpu::ApplicationOptions options)
+    {
+        const char *passNames[] = {"cold", "warm"};
+        double pipelineMs[2] = {0.0, 0.0};
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            options.clearPipelineCache = pass == 0;
+            learn::webgpu::Application app(options);
+            if (!app.init())
+            {
+                return -1;
+            }
+            for (const learn::webgpu::StartupTimeline::Phase &phase : app.startupTimeline().phases())
+            {
+                if (phase.name == "pipeline setup")
+                {
+                    pipelineMs[pass] = phase.endMs - phase.startMs;
+                }
+            }
+            app.terminate();
+        }
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            std::cout << passNames[pass] << " setupPipeline: " << pipelineMs[pass] << " ms" << std::endl;
+        }
+        return 0;
+    }
+
+    // One of the benchmarks of the Application, it prints its results to out.
+    using Benchmark = std::function<void(learn::webgpu::Application &app, std::ostream &out)>;
+
+    // Initializes the application with options, runs benchmark and tears it down again.
+    int runBenchmark(const learn::webgpu::ApplicationOptions &options, const Benchmark &benchmark)
+    {
+        learn::webgpu::Application app(options);
+        if (!app.init())
+        {
+            return -1;
+        }
+        benchmark(app, std::cout);
+        app.terminate();
+        return 0;
+    }
+} // namespace
 
-int main()
+int main(int argc, char *argv[])
 {
-    learn::webgpu::Application app;
+    learn::webgpu::ApplicationOptions options;
+    // --bench-startup prints the startup phases once the first frame is presented and exits.
+    // --serial-init runs every init phase back to back, to compare against the overlapped init.
+    // --fallback-adapter only uses the software adapter, --list-adapters ranks them and exits.
+    // --simulate-device-loss destroys the device after the first frame and reports how long
+    // it takes until a frame is rendered again on the recovered device.
+    // --bench-pipeline-cache compares setupPipeline with an empty and a filled pipeline cache.
+    // --shader-translator CMD translates the WGSL of pipeline cache misses with CMD, e.g. naga.
+    // --bench-upload compares mappedAtCreation and writeBuffer uploads from 1 KB to 1 GB.
+    // --bench-readback compares the CPU time of spinning, blocking and ring buffer readbacks.
+    // --readback-frames reads every headless frame back and prints the hash of the last one.
+    // --bench-transient-buffers compares per frame scratch buffer creation with the buffer pool.
+    // --gpu-culling N draws N copies of the mesh, culled on the GPU and drawn with indirect draws.
+    // --bench-indirect compares CPU-issued draws with the GPU culling for 1k to 1M objects.
+    // --instances N draws N animated copies of the mesh with one instanced draw.
+    // --bench-instancing prints how many instances per second a single draw gets through.
+    // --present-mode fifo|fifo-relaxed|mailbox|immediate picks how frames reach the display,
+    // P switches between the supported modes while running and prints how the last one did.
+    // --bench-present-modes prints frame time and latency in each supported present mode.
+    // --frames-in-flight N lets the CPU record up to N frames (1 to 3) ahead of the GPU.
+    // --record-threads N records the draws of the mesh on N threads (0 for one per core).
+    // --bench-parallel-recording compares one recording thread with --record-threads of them.
+    // --static-scene records the draws of the mesh once into render bundles and replays them.
+    // --bench-render-bundles compares encoding 10 to 100k draws per frame with replaying a bundle.
+    // --split-vertex-streams uses a vertex buffer per attribute instead of one interleaved buffer,
+    // --float-vertices keeps every attribute as Float32 instead of compressing them.
+    // --uint32-indices always uses 32 bit indices, to compare with the automatic choice.
+    // --mesh-grid N replaces the rectangle by a grid of N x N quads, --write-mesh PATH saves the
+    // mesh to a file and --mesh PATH draws the one of a file, streamed in over the first frames.
+    // Files are written for a vertex layout, write and draw them with the same layout flags.
+    // --hot-reload loads the shaders from the source tree and reloads them when they are saved.
+    // --headless renders --frames N frames (1000 by default) into an offscreen texture without
+    // a window and prints the frame rate, add --fallback-adapter on machines without a GPU.
+    bool benchStartup = false;
+    bool showAdapters = false;
+    bool simulateDeviceLoss = false;
+    bool benchCache = false;
+    // The --bench-* option that was given, the last one wins.
+    Benchmark benchmark;
+    long headlessFrames = 1000;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--bench-startup")
+        {
+            benchStartup = true;
+        }
+        else if (arg == "--serial-init")
+        {
+            options.overlappedInit = false;
+        }
+        else if (arg == "--fallback-adapter")
+        {
+            options.forceFallbackAdapter = true;
+        }
+        else if (arg == "--list-adapters")
+        {
+            showAdapters = true;
+        }
+        else if (arg == "--simulate-device-loss")
+        {
+            simulateDeviceLoss = true;
+        }
+        else if (arg == "--bench-pipeline-cache")
+        {
+            benchCache = true;
+        }
+        else if (arg == "--shader-translator" && i + 1 < argc)
+        {
+            options.pipelineCache.translator = argv[++i];
+        }
+        else if (arg == "--bench-upload")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkUploads(out); };
+        }
+        else if (arg == "--bench-readback")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkReadbacks(out); };
+        }
+        else if (arg == "--bench-transient-buffers")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkTransientBuffers(out); };
+        }
+        else if (arg == "--gpu-culling" && i + 1 < argc)
+        {
+            if (!parseCount(arg, argv[++i], options.cullObjects))
+            {
+                return -1;
+            }
+        }
+        else if (arg == "--bench-indirect")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkIndirectDraws(out); };
+        }
+        else if (arg == "--instances" && i + 1 < argc)
+        {
+            if (!parseCount(arg, argv[++i], options.instances))
+            {
+                return -1;
+            }
+        }
+        else if (arg == "--bench-instancing")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkInstancing(out); };
+        }
+        else if (arg == "--present-mode" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (!learn::webgpu::parsePresentMode(name, options.presentMode))
+            {
+                std::cout << "unknown present mode " << name << ", expected fifo, fifo-relaxed, mailbox or immediate" << std::endl;
+                return -1;
+            }
+        }
+        else if (arg == "--bench-present-modes")
+        {
+            // 300 frames in every present mode the window supports.
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkPresentModes(out, 300); };
+        }
+        else if (arg == "--frames-in-flight" && i + 1 < argc)
+        {
+            if (!parseCount(arg, argv[++i], options.framesInFlight))
+            {
+                return -1;
+            }
+        }
+        else if (arg == "--record-threads" && i + 1 < argc)
+        {
+            if (!parseCount(arg, argv[++i], options.recordThreads))
+            {
+                return -1;
+            }
+        }
+        else if (arg == "--bench-parallel-recording")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkParallelRecording(out); };
+        }
+        else if (arg == "--static-scene")
+        {
+            options.staticScene = true;
+        }
+        else if (arg == "--bench-render-bundles")
+        {
+            benchmark = [](learn::webgpu::Application &app, std::ostream &out)
+                        { app.benchmarkRenderBundles(out); };
+        }
+        else if (arg == "--readback-frames")
+        {
+            options.readbackFrames = true;
+        }
+        else if (arg == "--split-vertex-streams")
+        {
+            options.vertexLayout.streams = learn::webgpu::VertexStreams::Split;
+        }
+        else if (arg == "--float-vertices")
+        {
+            options.vertexLayout.compress = false;
+        }
+        else if (arg == "--uint32-indices")
+        {
+            options.indexPacking = learn::webgpu::IndexPacking::Uint32;
+        }
+        else if (arg == "--mesh-grid" && i + 1 < argc)
+        {
+            if (!parseCount(arg, argv[++i], options.meshGridSize))
+            {
+                return -1;
+            }
+        }
+        else if (arg == "--write-mesh" && i + 1 < argc)
+        {
+            options.writeMeshPath = argv[++i];
+        }
+        else if (arg == "--mesh" && i + 1 < argc)
+        {
+            options.meshPath = argv[++i];
+        }
+        else if (arg == "--hot-reload")
+        {
+            options.shaderDirectory = SHADER_DIR;
+        }
+        else if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            uint32_t frames = 0;
+            if (!parseCount(arg, argv[++i], frames))
+            {
+                return -1;
+            }
+            headlessFrames = frames;
+        }
+        else
+        {
+            std::cout << "unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    if (showAdapters)
+    {
+        return listAdapters(options.forceFallbackAdapter);
+    }
+    if (benchCache)
+    {
+        return benchPipelineCache(options);
+    }
+    if (benchmark)
+    {
+        return runBenchmark(options, benchmark);
+    }
+
+    learn::webgpu::Application app(options);
 
     if (!app.init())
     {
         return -1;
     }
 
+    // The whole batch is timed including the wait for the GPU at the end, submitting
+    // is much faster than executing when nothing throttles us on present.
+    std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+    long framesRendered = 0;
+    bool firstFrame = true;
+    bool deviceDestroyed = false;
+    int framesSinceLoss = 0;
+    int exitCode = 0;
     while (app.isRunning())
     {
-        app.render();
+        bool rendered = app.render();
+        if (rendered)
+        {
+            ++framesRendered;
+        }
+        if (rendered && firstFrame)
+        {
+            firstFrame = false;
+            app.startupTimeline().markFirstFrame();
+            if (benchStartup)
+            {
+                app.startupTimeline().report(std::cout);
+                break;
+            }
+        }
+        if (simulateDeviceLoss)
+        {
+            if (!deviceDestroyed && rendered)
+            {
+                app.simulateDeviceLoss();
+                deviceDestroyed = true;
+            }
+            else if (deviceDestroyed && app.recoveryCount() > 0 && rendered)
+            {
+                std::cout << "Device loss recovery: " << app.lastRecoveryMs() << " ms" << std::endl;
+                break;
+            }
+            else if (deviceDestroyed && ++framesSinceLoss > 60)
+            {
+                std::cout << "Device loss recovery failed" << std::endl;
+                exitCode = -1;
+                break;
+            }
+        }
         app.mainLoop();
+        if (options.headless && framesRendered >= headlessFrames)
+        {
+            break;
+        }
+    }
+
+    if (app.deviceLost())
+    {
+        std::cout << "Device lost and not recovered" << std::endl;
+        exitCode = -1;
+    }
+    else if (options.headless)
+    {
+        app.waitForGpu();
+        double batchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+        std::cout << "Headless: " << framesRendered << " frames in " << batchMs << " ms, "
+                  << (batchMs > 0.0 ? framesRendered * 1000.0 / batchMs : 0.0) << " fps" << std::endl;
     }
 
     app.terminate();
-}
\ No newline at end of file
+    return exitCode;
+}
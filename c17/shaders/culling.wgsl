@@ -0,0 +1,81 @@
+// GPU-driven drawing of many copies of the mesh, see GpuCulling.h.
+// cs_cull lists the objects that touch the viewport, vs_culled draws them as the instances
+// of one indirect draw. vs_direct draws object instance_index, for the CPU-issued draws.
+
+struct Params {
+    time: f32,
+    objectCount: u32,
+};
+
+struct CullObject {
+    offset: vec2f,
+    scale: f32,
+    radius: f32,
+};
+
+struct VisibleList {
+    count: atomic<u32>,
+    objects: array<u32>,
+};
+
+// The same buffer as VisibleList, read only for the vertex stage.
+struct DrawnList {
+    count: u32,
+    objects: array<u32>,
+};
+
+@group(0) @binding(0) var<uniform> params: Params;
+@group(0) @binding(1) var<storage, read> objects: array<CullObject>;
+@group(0) @binding(2) var<storage, read_write> visible: VisibleList;
+@group(0) @binding(3) var<storage, read> drawn: DrawnList;
+
+const kViewMin = vec2f(-1.0, -1.0);
+const kViewMax = vec2f(1.0, 1.0);
+const kWorkgroupSize = 64u;
+
+@compute @workgroup_size(kWorkgroupSize)
+fn cs_cull(@builtin(global_invocation_id) id: vec3u, @builtin(num_workgroups) groups: vec3u) {
+    // More than 65535 workgroups are dispatched as rows of groups.x workgroups.
+    let index = id.x + id.y * groups.x * kWorkgroupSize;
+    if (index >= params.objectCount) {
+        return;
+    }
+    let candidate = objects[index];
+    // The bounding square of the bounding circle against the viewport.
+    if (all(candidate.offset + candidate.radius >= kViewMin) && all(candidate.offset - candidate.radius <= kViewMax)) {
+        let slot = atomicAdd(&visible.count, 1u);
+        visible.objects[slot] = index;
+    }
+}
+
+struct VertexInput {
+    @location(0) position: vec2f,
+    @location(1) color: vec3f,
+};
+
+struct VertexOutput {
+    @builtin(position) position: vec4f,
+    @location(0) color: vec3f
+};
+
+fn place(in: VertexInput, placed: CullObject) -> VertexOutput {
+    var out: VertexOutput;
+    out.position = vec4f(in.position * placed.scale + placed.offset, 0.0, 1.0);
+    out.color = vec3f(sin(in.color[0] + params.time), cos(in.color[1]), sin(in.color[2] * params.time));
+    return out;
+}
+
+@vertex
+fn vs_culled(in: VertexInput, @builtin(instance_index) instance: u32) -> VertexOutput {
+    return place(in, objects[drawn.objects[instance]]);
+}
+
+@vertex
+fn vs_direct(in: VertexInput, @builtin(instance_index) instance: u32) -> VertexOutput {
+    return place(in, objects[instance]);
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+    return vec4f(in.color, 1.0f);
+}
@@ -0,0 +1,39 @@
+// Many copies of the mesh in a single draw, see InstancedRenderer.h.
+// The vertex buffers step per vertex as usual, the instance buffer steps once per copy
+// and gives it its place, size, tint and its own moment in the animation.
+
+@group(0) @binding(0) var<uniform> uTime: f32;
+
+struct VertexInput {
+    @location(0) position: vec2f,
+    @location(1) color: vec3f,
+};
+
+struct InstanceInput {
+    @location(2) offset: vec2f,
+    @location(3) scale: f32,
+    @location(4) phase: f32,
+    @location(5) tint: vec4f,
+};
+
+struct VertexOutput {
+    @builtin(position) position: vec4f,
+    @location(0) color: vec3f
+};
+
+@vertex
+fn vs_main(in: VertexInput, instance: InstanceInput) -> VertexOutput {
+    var out: VertexOutput;
+    // The triangle's animation, each instance a little ahead or behind the others.
+    let time = uTime + instance.phase;
+    let size = instance.scale * (0.8 + 0.2 * sin(time));
+    out.position = vec4f(in.position * size + instance.offset, 0.0, 1.0);
+    let animated = vec3f(sin(in.color[0] + time), cos(in.color[1]), sin(in.color[2] * time));
+    out.color = mix(animated, instance.tint.rgb, 0.5);
+    return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+    return vec4f(in.color, 1.0f);
+}
@@ -1,7 +1,12 @@
+#include <cassert>
 #include <iostream>
 #include <vector>
 #include <webgpu/webgpu.h>
 
+#ifdef __EMSCRIPTEN__
+#  include <emscripten.h>
+#endif // __EMSCRIPTEN__
+
 WGPUAdapter requestAdapterSync(WGPUInstance wgpuInstance, WGPURequestAdapterOptions* options) {
     
     struct UserData {
@@ -22,6 +27,14 @@ WGPUAdapter requestAdapterSync(WGPUInstance wgpuInstance, WGPURequestAdapterOpti
 
     wgpuInstanceRequestAdapter(wgpuInstance, options, adapterCallback, &userData);
     
+    // The callback is only guaranteed to run synchronously on wgpu-native, in the browser
+    // we have to yield until it actually fired before reading the result.
+#ifdef __EMSCRIPTEN__
+    while (!userData.requestEnded) {
+        emscripten_sleep(100);
+    }
+#endif // __EMSCRIPTEN__
+    assert(userData.requestEnded);
     return userData.adapter;
 }
 
@@ -43,6 +56,12 @@ WGPUDevice requestDeviceSync(WGPUAdapter wgpuAdapter, WGPUDeviceDescriptor* desc
     };
 
     wgpuAdapterRequestDevice(wgpuAdapter, descriptor, onDeviceRequestEnded, (void*)&userData);
+#ifdef __EMSCRIPTEN__
+    while (!userData.requestEnded) {
+        emscripten_sleep(100);
+    }
+#endif // __EMSCRIPTEN__
+    assert(userData.requestEnded);
     return userData.devide;
 }
 
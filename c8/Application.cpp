@@ -1,8 +1,13 @@
+#include <cassert>
 #include <iostream>
 #include <vector>
 
 #include "Application.h"
 
+#ifdef __EMSCRIPTEN__
+#  include <emscripten.h>
+#endif // __EMSCRIPTEN__
+
 namespace learn::webgpu {
 
     
@@ -30,6 +35,14 @@ std::cout << "Adapter request failed" << message << std::endl;
 
     wgpuInstanceRequestAdapter(wgpuInstance, options, adapterCallback, &userData);
     
+    // The callback is only guaranteed to run synchronously on wgpu-native, in the browser
+    // we have to yield until it actually fired before reading the result.
+#ifdef __EMSCRIPTEN__
+    while (!userData.requestEnded) {
+        emscripten_sleep(100);
+    }
+#endif // __EMSCRIPTEN__
+    assert(userData.requestEnded);
     return userData.adapter;
 }
 
@@ -53,6 +66,12 @@ WGPUDevice requestDeviceSync(WGPUAdapter wgpuAdapter, WGPUDeviceDescriptor* desc
     };
 
     wgpuAdapterRequestDevice(wgpuAdapter, descriptor, onDeviceRequestEnded, (void*)&userData);
+#ifdef __EMSCRIPTEN__
+    while (!userData.requestEnded) {
+        emscripten_sleep(100);
+    }
+#endif // __EMSCRIPTEN__
+    assert(userData.requestEnded);
     return userData.devide;
 }
 